@@ -0,0 +1,495 @@
+/*
+ *  pkmBenchmark.cpp
+ *
+ *  Benchmarks for pkmFFT, pkmSTFT and pkmDCT
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  A standalone program timing pkmFFT::forward/inverse, pkmSTFT::STFT/ISTFT
+ *  and pkmDCT::dctII_1D over sizes, hops, signal lengths and thread counts,
+ *  so a change of backend or layout can be checked for regressions.
+ *
+ *  For each case it reports ns per transform (per frame for the STFT),
+ *  MFLOPS by the 5 N log2 N convention (nominal: a real transform does
+ *  about half that) and bytes per second of input read plus output
+ *  written.  Times are the best of five repetitions, each long enough to
+ *  take min-time / 5.  With several threads, pkmFFT and pkmDCT run one
+ *  instance per thread on their own buffers and report the aggregate
+ *  time per transform; pkmSTFT runs with setNumThreads(threads).
+ *
+ *  Build (pkmSTFT.h needs pkmMatrix.h on the include path):
+ *
+ *  c++ -std=c++11 -O3 -pthread -I. -I<pkmMatrix> pkmBenchmark.cpp -o pkmBenchmark
+ *
+ *  Usage:
+ *
+ *  ./pkmBenchmark                              // every benchmark, as a table
+ *  ./pkmBenchmark --only fft,dct --max-log2 14
+ *  ./pkmBenchmark --threads 1,2,4,8 --json results.json
+ *  ./pkmBenchmark --min-time 1 --json -        // JSON on stdout
+ *  ./pkmBenchmark --only fft --polar fast      // vectorized polar conversion
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "pkmFFT.h"
+#include "pkmSTFT.h"
+#include "pkmDCT.h"
+#include "pkmSIMD.h"
+
+struct pkmBenchmarkResult
+{
+	std::string			name;				// e.g. "fft.forward"
+	int					size,
+						hop,				// stft only
+						threads;
+	long				length;				// stft signal length in samples
+	bool				bWindowed;
+	long				iterations;			// per repetition
+	double				ns,					// per transform or frame
+						mflops,
+						bytesPerSecond;
+};
+
+struct pkmBenchmarkOptions
+{
+	std::vector<int>	threads;
+	double				minTime;
+	int					minLog2,
+						maxLog2;
+	bool				bFFT,
+						bSTFT,
+						bDCT;
+	const char			*json;				// NULL for a table, "-" for stdout
+	pkmPolarAccuracy	polar;				// of pkmFFT and pkmSTFT
+};
+
+static const char * pkmBenchmarkPolarName(pkmPolarAccuracy accuracy)
+{
+	switch (accuracy) {
+		case PKM_POLAR_FAST:	return "fast";
+		case PKM_POLAR_FASTEST:	return "fastest";
+		default:				return "exact";
+	}
+}
+
+static double pkmBenchmarkNow()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// runs run(iterations, threads), which does iterations calls on each of
+// threads threads, until one repetition takes minTime / 5, then keeps the
+// best of five; returns seconds per call
+template <typename F>
+static double pkmBenchmarkTime(const F &run, int threads, double minTime, long &iterations)
+{
+	iterations = 1;
+	for (;;) {
+		double start = pkmBenchmarkNow();
+		run(iterations, threads);
+		double elapsed = pkmBenchmarkNow() - start;
+		if (elapsed >= minTime / 5 || iterations >= (1L << 30))
+			break;
+		long next = elapsed > 0 ? (long) (iterations * (minTime / 5) / elapsed * 1.2) : iterations * 10;
+		iterations = std::max(iterations * 2, std::min(next, iterations * 100));
+	}
+	double best = 1e30;
+	for (int rep = 0; rep < 5; rep++) {
+		double start = pkmBenchmarkNow();
+		run(iterations, threads);
+		best = std::min(best, pkmBenchmarkNow() - start);
+	}
+	return best / ((double) iterations * threads);
+}
+
+// calls body(thread, iterations) on threads threads at once
+template <typename F>
+static void pkmBenchmarkSpread(int threads, long iterations, const F &body)
+{
+	if (threads == 1) {
+		body(0, iterations);
+		return;
+	}
+	std::vector<std::thread> pool;
+	for (int t = 0; t < threads; t++)
+		pool.push_back(std::thread([&, t]() { body(t, iterations); }));
+	for (size_t t = 0; t < pool.size(); t++)
+		pool[t].join();
+}
+
+static double pkmBenchmarkFlops(int n)
+{
+	return 5.0 * n * log2((double) n);
+}
+
+static void pkmBenchmarkFill(float *x, long n, unsigned seed)
+{
+	for (long i = 0; i < n; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		x[i] = (float) (seed >> 8) / 8388608.0f - 1.0f;
+	}
+}
+
+static void pkmBenchmarkFFT(const pkmBenchmarkOptions &options, std::vector<pkmBenchmarkResult> &results)
+{
+	for (int log2n = options.minLog2; log2n <= options.maxLog2; log2n++) {
+		const int n = 1 << log2n;
+		for (size_t ti = 0; ti < options.threads.size(); ti++) {
+			const int threads = options.threads[ti];
+			std::vector<pkmFFT *> ffts;
+			std::vector<std::vector<float> > buffers, outputs, magnitudes, phases;
+			for (int t = 0; t < threads; t++) {
+				ffts.push_back(new pkmFFT(n));
+				ffts.back()->setPolarAccuracy(options.polar);
+				buffers.push_back(std::vector<float>(n));
+				outputs.push_back(std::vector<float>(n));
+				magnitudes.push_back(std::vector<float>(n / 2));
+				phases.push_back(std::vector<float>(n / 2));
+				pkmBenchmarkFill(&buffers[t][0], n, t + 1);
+			}
+			
+			for (int windowed = 1; windowed >= 0; windowed--) {
+				for (int inverse = 0; inverse < 2; inverse++) {
+					pkmBenchmarkResult r;
+					r.name = inverse ? "fft.inverse" : "fft.forward";
+					r.size = n;
+					r.hop = 0;
+					r.threads = threads;
+					r.length = n;
+					r.bWindowed = windowed != 0;
+					
+					double seconds = pkmBenchmarkTime([&](long iterations, int threads) {
+						pkmBenchmarkSpread(threads, iterations, [&](int t, long iterations) {
+							pkmFFT *fft = ffts[t];
+							float *buffer = &buffers[t][0], *output = &outputs[t][0];
+							float *m = &magnitudes[t][0], *p = &phases[t][0];
+							for (long i = 0; i < iterations; i++) {
+								if (inverse)
+									fft->inverse(0, output, m, p, windowed != 0);
+								else
+									fft->forward(0, buffer, m, p, windowed != 0);
+							}
+						});
+					}, threads, options.minTime, r.iterations);
+					
+					// n samples one way and n / 2 magnitudes and phases the other
+					r.ns = seconds * 1e9;
+					r.mflops = pkmBenchmarkFlops(n) / seconds * 1e-6;
+					r.bytesPerSecond = 2.0 * n * sizeof(float) / seconds;
+					results.push_back(r);
+				}
+			}
+			for (int t = 0; t < threads; t++)
+				delete ffts[t];
+		}
+	}
+}
+
+static void pkmBenchmarkSTFT(const pkmBenchmarkOptions &options, std::vector<pkmBenchmarkResult> &results)
+{
+	const int sizes[] = { 1024, 4096 };
+	const int hopDivisors[] = { 2, 4, 8 };
+	const long lengths[] = { 44100, 441000, 2646000 };		// 1, 10 and 60 s at 44.1 kHz
+	
+	for (int li = 0; li < 3; li++) {
+		const long length = lengths[li];
+		std::vector<float> signal(length);
+		pkmBenchmarkFill(&signal[0], length, 7);
+		
+		for (int si = 0; si < 2; si++) {
+			const int n = sizes[si];
+			if (n < (1 << options.minLog2) || n > (1 << options.maxLog2))
+				continue;
+			for (int hi = 0; hi < 3; hi++) {
+				pkmSTFT stft(n, n / hopDivisors[hi]);
+				stft.setPolarAccuracy(options.polar);
+				const int frames = stft.getNumWindows((int) length);
+				std::vector<float> magnitudes((size_t) frames * stft.getBins()), phases(magnitudes.size());
+				std::vector<float> output(length);
+				
+				for (size_t ti = 0; ti < options.threads.size(); ti++) {
+					stft.setNumThreads(options.threads[ti]);
+					stft.reserve((int) length);
+					for (int inverse = 0; inverse < 2; inverse++) {
+						pkmBenchmarkResult r;
+						r.name = inverse ? "stft.istft" : "stft.stft";
+						r.size = n;
+						r.hop = n / hopDivisors[hi];
+						r.threads = options.threads[ti];
+						r.length = length;
+						r.bWindowed = true;
+						
+						// frames are spread by pkmSTFT itself, so time one caller
+						double seconds = pkmBenchmarkTime([&](long iterations, int) {
+							for (long i = 0; i < iterations; i++) {
+								if (inverse)
+									stft.ISTFT(&output[0], (int) length, &magnitudes[0], &phases[0]);
+								else
+									stft.STFT(&signal[0], (int) length, &magnitudes[0], &phases[0]);
+							}
+						}, 1, options.minTime, r.iterations);
+						
+						r.ns = seconds * 1e9 / frames;
+						r.mflops = pkmBenchmarkFlops(n) * frames / seconds * 1e-6;
+						r.bytesPerSecond = (length + 2.0 * magnitudes.size()) * sizeof(float) / seconds;
+						results.push_back(r);
+					}
+				}
+			}
+		}
+	}
+}
+
+static void pkmBenchmarkDCT(const pkmBenchmarkOptions &options, std::vector<pkmBenchmarkResult> &results)
+{
+	const int maxLog2 = std::min(options.maxLog2, 16);
+	for (int log2n = std::max(options.minLog2, 3); log2n <= maxLog2; log2n++) {
+		const int n = 1 << log2n;
+		for (size_t ti = 0; ti < options.threads.size(); ti++) {
+			const int threads = options.threads[ti];
+			std::vector<pkmDCT *> dcts;
+			std::vector<std::vector<float> > inputs, outputs;
+			for (int t = 0; t < threads; t++) {
+				dcts.push_back(new pkmDCT());
+				dcts.back()->setup(2 * n);
+				inputs.push_back(std::vector<float>(n));
+				outputs.push_back(std::vector<float>(n));
+				pkmBenchmarkFill(&inputs[t][0], n, t + 11);
+			}
+			
+			pkmBenchmarkResult r;
+			r.name = "dct.dctII_1D";
+			r.size = n;
+			r.hop = 0;
+			r.threads = threads;
+			r.length = n;
+			r.bWindowed = false;
+			double seconds = pkmBenchmarkTime([&](long iterations, int threads) {
+				pkmBenchmarkSpread(threads, iterations, [&](int t, long iterations) {
+					for (long i = 0; i < iterations; i++)
+						dcts[t]->dctII_1D(&inputs[t][0], &outputs[t][0]);
+				});
+			}, threads, options.minTime, r.iterations);
+			
+			r.ns = seconds * 1e9;
+			r.mflops = pkmBenchmarkFlops(n) / seconds * 1e-6;
+			r.bytesPerSecond = 2.0 * n * sizeof(float) / seconds;
+			results.push_back(r);
+			
+			for (int t = 0; t < threads; t++)
+				delete dcts[t];
+		}
+	}
+}
+
+static void pkmBenchmarkWriteJSON(FILE *f, const pkmBenchmarkOptions &options, const std::vector<pkmBenchmarkResult> &results)
+{
+	std::shared_ptr<const pkmFFTPlan<float> > plan = pkmFFTPlanCache::instance().plan<float>(1024);
+	fprintf(f, "{\n");
+	fprintf(f, "  \"backend\": \"%s\",\n", plan->name());
+	fprintf(f, "  \"isa\": \"%s\",\n", pkmSIMDISAName(pkmSIMDGetISA()));
+	fprintf(f, "  \"polar\": \"%s\",\n", pkmBenchmarkPolarName(options.polar));
+	fprintf(f, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+	fprintf(f, "  \"min_time\": %g,\n", options.minTime);
+	fprintf(f, "  \"flops_convention\": \"5 N log2 N\",\n");
+	fprintf(f, "  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const pkmBenchmarkResult &r = results[i];
+		fprintf(f, "    {\"name\": \"%s\", \"size\": %d, \"hop\": %d, \"length\": %ld, \"windowed\": %s, "
+				   "\"threads\": %d, \"iterations\": %ld, \"ns\": %.3f, \"mflops\": %.1f, \"bytes_per_second\": %.0f}%s\n",
+				r.name.c_str(), r.size, r.hop, r.length, r.bWindowed ? "true" : "false",
+				r.threads, r.iterations, r.ns, r.mflops, r.bytesPerSecond, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+static void pkmBenchmarkWriteTable(const std::vector<pkmBenchmarkResult> &results)
+{
+	printf("%-14s %8s %6s %9s %4s %7s %14s %10s %10s\n", 
+		   "benchmark", "size", "hop", "length", "win", "threads", "ns", "MFLOPS", "MB/s");
+	for (size_t i = 0; i < results.size(); i++) {
+		const pkmBenchmarkResult &r = results[i];
+		printf("%-14s %8d %6d %9ld %4s %7d %14.1f %10.1f %10.1f\n",
+			   r.name.c_str(), r.size, r.hop, r.length, r.bWindowed ? "yes" : "no",
+			   r.threads, r.ns, r.mflops, r.bytesPerSecond * 1e-6);
+	}
+}
+
+static void pkmBenchmarkUsage()
+{
+	printf("usage: pkmBenchmark [--only fft,stft,dct] [--threads 1,2,4] [--min-time seconds]\n"
+		   "                    [--min-log2 n] [--max-log2 n] [--polar exact|fast|fastest]\n"
+		   "                    [--json file|-]\n");
+}
+
+int main(int argc, char **argv)
+{
+	pkmBenchmarkOptions options;
+	options.minTime = 0.25;
+	options.minLog2 = 5;
+	options.maxLog2 = 20;
+	options.bFFT = options.bSTFT = options.bDCT = true;
+	options.json = NULL;
+	options.polar = PKM_POLAR_EXACT;
+	
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i], *value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (!strcmp(arg, "--help") || !strcmp(arg, "-h")) {
+			pkmBenchmarkUsage();
+			return 0;
+		}
+		if (value == NULL) {
+			pkmBenchmarkUsage();
+			return 1;
+		}
+		i++;
+		if (!strcmp(arg, "--only")) {
+			std::string list = std::string(",") + value + ",";
+			options.bFFT = list.find(",fft,") != std::string::npos;
+			options.bSTFT = list.find(",stft,") != std::string::npos;
+			options.bDCT = list.find(",dct,") != std::string::npos;
+		}
+		else if (!strcmp(arg, "--threads")) {
+			for (const char *p = value; *p; ) {
+				int t = atoi(p);
+				if (t > 0)
+					options.threads.push_back(t);
+				p = strchr(p, ',');
+				if (p == NULL)
+					break;
+				p++;
+			}
+		}
+		else if (!strcmp(arg, "--min-time"))
+			options.minTime = atof(value);
+		else if (!strcmp(arg, "--min-log2"))
+			options.minLog2 = std::max(atoi(value), 2);
+		else if (!strcmp(arg, "--max-log2"))
+			options.maxLog2 = std::min(atoi(value), 24);
+		else if (!strcmp(arg, "--json"))
+			options.json = value;
+		else if (!strcmp(arg, "--polar")) {
+			if (!strcmp(value, "fast"))
+				options.polar = PKM_POLAR_FAST;
+			else if (!strcmp(value, "fastest"))
+				options.polar = PKM_POLAR_FASTEST;
+			else if (strcmp(value, "exact")) {
+				pkmBenchmarkUsage();
+				return 1;
+			}
+		}
+		else {
+			pkmBenchmarkUsage();
+			return 1;
+		}
+	}
+	if (options.threads.empty()) {
+		options.threads.push_back(1);
+		int hardware = (int) std::thread::hardware_concurrency();
+		if (hardware > 1)
+			options.threads.push_back(hardware);
+	}
+	
+	std::vector<pkmBenchmarkResult> results;
+	if (options.bFFT)
+		pkmBenchmarkFFT(options, results);
+	if (options.bSTFT)
+		pkmBenchmarkSTFT(options, results);
+	if (options.bDCT)
+		pkmBenchmarkDCT(options, results);
+	
+	if (options.json == NULL) {
+		pkmBenchmarkWriteTable(results);
+	}
+	else {
+		FILE *f = strcmp(options.json, "-") ? fopen(options.json, "w") : stdout;
+		if (f == NULL) {
+			printf("\npkmBenchmark could not write %s.\n", options.json);
+			return 1;
+		}
+		pkmBenchmarkWriteJSON(f, options, results);
+		if (f != stdout)
+			fclose(f);
+	}
+	return 0;
+}
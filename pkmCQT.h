@@ -0,0 +1,520 @@
+/*
+ *  pkmCQT.h
+ *
+ *  Constant-Q transform with sparse spectral kernels
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  pkmCQT gives numBins log-spaced bins, binsPerOctave to the octave from
+ *  minFrequency, as in Brown and Puckette's efficient constant-Q transform:
+ *  each bin's windowed complex exponential of Q cycles is transformed once
+ *  by the constructor, its negligible spectral values (below threshold
+ *  times its peak) dropped, and each frame is then one pkmFFT plus a short
+ *  sparse dot product per bin.  Magnitudes are normalized so a sinusoid of
+ *  amplitude A at a bin's frequency reads about A.
+ *
+ *  With bMultirate (the default) only the top octave has kernels.  Every
+ *  lower octave is the same analysis after one more halving of the sample
+ *  rate through a centered half-band filter, so all octaves share one
+ *  small FFT size instead of the lowest bin's window setting it for all.
+ *  With the highest bin under sampleRate / 3 the 31 tap filters add no
+ *  measurable aliasing: a tone's response more than 3 bins away stays at
+ *  the kernels' own -36 dB.  Otherwise one FFT long enough for the lowest
+ *  bin analyses every bin.
+ *
+ *  Frame t is centered on sample t * hopSize (the signal is zero before
+ *  the first sample) and is complete once its lowest octave's window has
+ *  arrived, getLatency() samples after its center.  Samples are pushed in
+ *  blocks of any size and frames come out of a queue of maxFrames, as with
+ *  pkmStreamingSTFT; nothing is allocated after the constructor.  hopSize
+ *  is rounded up to a multiple of the decimation of the lowest octave.
+ *
+ *  Usage:
+ *
+ *  pkmCQT cqt(44100, 32.70f, 84, 12, 512);
+ *  float magnitudes[84];
+ *
+ *  // audio callback
+ *  cqt.push(input, numSamples);
+ *  while (cqt.pop(magnitudes))
+ *      process(magnitudes);
+ *
+ *  // or a whole buffer, one row of 84 per hop
+ *  float *rows = (float *) malloc (sizeof(float) * cqt.getNumFrames(buffer_size) * 84);
+ *  cqt.compute(buffer, buffer_size, rows);
+ *
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <complex>
+#include <vector>
+#include "pkmFFT.h"
+
+template <typename T>
+class pkmBasicCQT
+{
+public:
+	
+	pkmBasicCQT(double sampleRate, 
+				double minFrequency = 32.703, 
+				int numBins = 84, 
+				int binsPerOctave = 12, 
+				int hop = 512, 
+				bool bMultirate = true, 
+				int maxFrames = 64, 
+				double threshold = 0.0054)
+	{
+		this->numBins = numBins;
+		this->binsPerOctave = binsPerOctave;
+		levels = bMultirate ? (numBins + binsPerOctave - 1) / binsPerOctave : 1;
+		kernelBins = bMultirate ? std::min(numBins, binsPerOctave) : numBins;
+		queueSize = maxFrames > 0 ? maxFrames : 1;
+		
+		const int decimation = 1 << (levels - 1);
+		hopSize = (std::max(hop, 1) + decimation - 1) / decimation * decimation;
+		
+		// kernels of the top octave, or of every bin
+		const double Q = 1.0 / (pow(2.0, 1.0 / binsPerOctave) - 1.0);
+		const int firstKernel = numBins - kernelBins;
+		int longest = (int) ceil(Q * sampleRate / (minFrequency * pow(2.0, (double) firstKernel / binsPerOctave)));
+		fftSize = 2;
+		while (fftSize < longest)
+			fftSize *= 2;
+		FFT = new pkmBasicFFT<T>(fftSize);
+		fftBins = FFT->fftSizeOver2;
+		makeKernels(sampleRate, minFrequency, Q, firstKernel, threshold);
+		
+		// half-band filter taps at odd offsets 1, 3, ..., halfLength
+		const int taps = 8;
+		halfLength = 2 * taps - 1;
+		halfBand.resize(taps);
+		for (int i = 0; i < taps; i++) {
+			const int d = 2 * i + 1;
+			const double blackman = 0.42 + 0.5 * cos(M_PI * d / (halfLength + 1)) + 0.08 * cos(2.0 * M_PI * d / (halfLength + 1));
+			halfBand[i] = (T) (sin(M_PI * d / 2.0) / (M_PI * d) * blackman);
+		}
+		
+		// each level keeps from the oldest sample a pending frame or
+		// decimation reads up to its newest, written twice for contiguity
+		rings.resize(levels);
+		for (int o = 0; o < levels; o++) {
+			Level &level = rings[o];
+			level.size = fftSize * ((1 << (levels - 1 - o)) + 1) + (halfLength + 2) * (2 << (levels - 1 - o)) + hopSize / (1 << o) + 4;
+			level.samples = (T *) calloc(2 * level.size, sizeof(T));
+		}
+		
+		spectrumReal = (T *) malloc(sizeof(T) * fftBins);
+		spectrumImag = (T *) malloc(sizeof(T) * fftBins);
+		frame = (T *) malloc(sizeof(T) * numBins);
+		queue = (T *) malloc(sizeof(T) * queueSize * numBins);
+		positions = (long long *) malloc(sizeof(long long) * queueSize);
+		if (spectrumReal == NULL || spectrumImag == NULL || frame == NULL || queue == NULL || positions == NULL) {
+			printf("\npkmCQT failed to allocate enough memory.\n");
+		}
+		
+		// samples needed for frame 0, centered on sample 0
+		long long needed = fftSize / 2;
+		for (int o = levels - 1; o > 0; o--)
+			needed = 2 * (needed - 1) + halfLength + 1;
+		latency = (int) needed;
+		
+		reset();
+	}
+	
+	~pkmBasicCQT()
+	{
+		delete FFT;
+		for (int o = 0; o < levels; o++)
+			free(rings[o].samples);
+		free(spectrumReal);
+		free(spectrumImag);
+		free(frame);
+		free(queue);
+		free(positions);
+	}
+	
+	// back to silence with an empty queue
+	void reset()
+	{
+		for (int o = 0; o < levels; o++) {
+			memset(rings[o].samples, 0, sizeof(T) * 2 * rings[o].size);
+			rings[o].count = 0;
+		}
+		nextFrame = 0;
+		droppedFrames = 0;
+		head = 0;
+		numQueued = 0;
+	}
+	
+	// returns the number of frames completed by these samples
+	template <typename S>
+	int push(const S *samples, int count)
+	{
+		int completed = 0;
+		for (int i = 0; i < count; i++) {
+			if (pushSample(samples[i])) {
+				enqueue();
+				completed++;
+			}
+		}
+		return completed;
+	}
+	
+	int framesAvailable() const
+	{
+		return numQueued;
+	}
+	
+	// the oldest queued frame, valid until the next push or pop
+	const T * frontMagnitudes() const
+	{
+		return numQueued ? queue + (long) head * numBins : NULL;
+	}
+	
+	// getSamplesPushed() when the oldest queued frame was completed, or -1
+	long long framePosition() const
+	{
+		return numQueued ? positions[head] : -1;
+	}
+	
+	// copies out the oldest queued frame, low bins first, and removes it;
+	// false when the queue is empty
+	template <typename S>
+	bool pop(S *magnitudes)
+	{
+		if (numQueued == 0)
+			return false;
+		const T *m = frontMagnitudes();
+		for (int k = 0; k < numBins; k++)
+			magnitudes[k] = m[k];
+		head = (head + 1) % queueSize;
+		numQueued--;
+		return true;
+	}
+	
+	// frames centered every hopSize samples of buffer
+	int getNumFrames(int bufSize) const
+	{
+		return (bufSize + hopSize - 1) / hopSize;
+	}
+	
+	// a whole buffer from silence, getNumFrames(bufSize) rows of numBins;
+	// resets the stream
+	template <typename S>
+	int compute(const T *buffer, int bufSize, S *magnitudes)
+	{
+		reset();
+		const int numFrames = getNumFrames(bufSize);
+		int frames = 0;
+		for (long long n = 0; frames < numFrames; n++) {
+			if (pushSample(n < bufSize ? buffer[n] : 0)) {
+				for (int k = 0; k < numBins; k++)
+					magnitudes[(long) frames * numBins + k] = frame[k];
+				frames++;
+			}
+		}
+		reset();
+		return numFrames;
+	}
+	
+	int getBins() const
+	{
+		return numBins;
+	}
+	
+	int getHopSize() const
+	{
+		return hopSize;
+	}
+	
+	// samples from a frame's center to when it is complete
+	int getLatency() const
+	{
+		return latency;
+	}
+	
+	int getFFTSize() const
+	{
+		return fftSize;
+	}
+	
+	// spectral values kept over all kernels
+	int getKernelSize() const
+	{
+		return (int) kernelReal.size();
+	}
+	
+	long long getSamplesPushed() const
+	{
+		return rings[0].count;
+	}
+	
+	long long getDroppedFrames() const
+	{
+		return droppedFrames;
+	}
+	
+private:
+	
+	struct Level
+	{
+		T			*samples;
+		int			size;
+		long long	count;
+	};
+	
+	// bin kb's kernel: conj of the spectrum of a Hann windowed exponential
+	// centered in the frame, scaled so the dot product with pkmFFT's 2X[j]
+	// gives the amplitude of a matching sinusoid
+	void makeKernels(double sampleRate, double minFrequency, double Q, int firstKernel, double threshold)
+	{
+		std::shared_ptr<const pkmFFTPlan<T> > plan = pkmFFTPlanCache::instance().plan<T>(fftSize);
+		std::vector<T> scratch(plan->scratchSize() + 1), real(fftSize), imag(fftSize), 
+			ar(fftBins), ai(fftBins), br(fftBins), bi(fftBins);
+		std::vector<std::complex<double> > K(fftBins);
+		
+		kernelStart.resize(kernelBins);
+		kernelOffset.resize(kernelBins + 1);
+		for (int kb = 0; kb < kernelBins; kb++) {
+			const double f = minFrequency * pow(2.0, (double) (firstKernel + kb) / binsPerOctave);
+			const int N = std::min(fftSize, (int) ceil(Q * sampleRate / f));
+			const int start = (fftSize - N) / 2;
+			double sum = 0;
+			for (int n = 0; n < N; n++)
+				sum += 0.5 * (1.0 - cos(2.0 * M_PI * n / N));
+			std::fill(real.begin(), real.end(), (T) 0);
+			std::fill(imag.begin(), imag.end(), (T) 0);
+			for (int n = 0; n < N; n++) {
+				const double w = 0.5 * (1.0 - cos(2.0 * M_PI * n / N)) / sum;
+				const double phase = 2.0 * M_PI * f / sampleRate * (n - N / 2.0);
+				real[start + n] = (T) (w * cos(phase));
+				imag[start + n] = (T) (w * sin(phase));
+			}
+			
+			// spectrum of the complex kernel from two real transforms
+			pkmDSP::ctoz(&real[0], &ar[0], &ai[0], fftBins);
+			plan->forward(&ar[0], &ai[0], &scratch[0]);
+			pkmDSP::ctoz(&imag[0], &br[0], &bi[0], fftBins);
+			plan->forward(&br[0], &bi[0], &scratch[0]);
+			double peak = 0;
+			for (int j = 1; j < fftBins; j++) {
+				K[j] = std::complex<double>(ar[j] - bi[j], ai[j] + br[j]) * 0.5;
+				peak = std::max(peak, std::abs(K[j]));
+			}
+			
+			// keep the run between the first and last values above threshold;
+			// bin 0 (DC and Nyquist) is left out
+			int first = fftBins, last = 0;
+			for (int j = 1; j < fftBins; j++) {
+				if (std::abs(K[j]) >= threshold * peak) {
+					first = std::min(first, j);
+					last = j;
+				}
+			}
+			kernelOffset[kb] = (int) kernelReal.size();
+			kernelStart[kb] = first;
+			for (int j = first; j <= last; j++) {
+				std::complex<double> w = std::conj(K[j]) / (double) fftSize;
+				kernelReal.push_back((T) w.real());
+				kernelImag.push_back((T) w.imag());
+			}
+		}
+		kernelOffset[kernelBins] = (int) kernelReal.size();
+	}
+	
+	// stores sample i of a level, at i and i + size
+	void store(Level &level, long long i, T x)
+	{
+		const int p = (int) (i % level.size);
+		level.samples[p] = x;
+		level.samples[p + level.size] = x;
+	}
+	
+	// samples [i, i + n) of a level, n <= size; earlier than the first
+	// sample reads as silence
+	const T * window(const Level &level, long long i) const
+	{
+		return level.samples + (int) (((i % level.size) + level.size) % level.size);
+	}
+	
+	// true when this sample completes the next frame, then in frame
+	bool pushSample(T x)
+	{
+		store(rings[0], rings[0].count++, x);
+		
+		// cascade down while each level has the lookahead for its next sample
+		for (int o = 0; o + 1 < levels; o++) {
+			Level &src = rings[o], &dst = rings[o + 1];
+			if (2 * dst.count + halfLength >= src.count)
+				break;
+			const T *c = window(src, 2 * dst.count - halfLength);
+			T y = (T) 0.5 * c[halfLength];
+			for (size_t i = 0; i < halfBand.size(); i++) {
+				const int d = 2 * (int) i + 1;
+				y += halfBand[i] * (c[halfLength - d] + c[halfLength + d]);
+			}
+			store(dst, dst.count++, y);
+		}
+		
+		const long long center = nextFrame * hopSize;
+		for (int o = 0; o < levels; o++)
+			if (rings[o].count < (center >> o) + fftSize / 2)
+				return false;
+		
+		analyze(center);
+		nextFrame++;
+		return true;
+	}
+	
+	void analyze(long long center)
+	{
+		for (int o = 0; o < levels; o++) {
+			const T *x = window(rings[o], (center >> o) - fftSize / 2);
+			FFT->forward(0, (T *) x, PKM_FFT_OUTPUT_SPLIT, spectrumReal, spectrumImag, false);
+			
+			// level o holds the bins o octaves below the kernels
+			const int firstBin = numBins - kernelBins - o * binsPerOctave;
+			for (int kb = 0; kb < kernelBins; kb++) {
+				const int k = firstBin + kb;
+				if (k < 0)
+					continue;
+				const T *wr = &kernelReal[kernelOffset[kb]], *wi = &kernelImag[kernelOffset[kb]];
+				const T *xr = spectrumReal + kernelStart[kb], *xi = spectrumImag + kernelStart[kb];
+				const int n = kernelOffset[kb + 1] - kernelOffset[kb];
+				T re = 0, im = 0;
+				for (int j = 0; j < n; j++) {
+					re += xr[j] * wr[j] - xi[j] * wi[j];
+					im += xr[j] * wi[j] + xi[j] * wr[j];
+				}
+				frame[k] = sqrt(re * re + im * im);
+			}
+		}
+	}
+	
+	void enqueue()
+	{
+		if (numQueued == queueSize) {
+			// full: the oldest frame makes room
+			head = (head + 1) % queueSize;
+			numQueued--;
+			droppedFrames++;
+		}
+		const int slot = (head + numQueued) % queueSize;
+		memcpy(queue + (long) slot * numBins, frame, sizeof(T) * numBins);
+		positions[slot] = rings[0].count;
+		numQueued++;
+	}
+	
+	pkmBasicCQT(const pkmBasicCQT &);
+	pkmBasicCQT & operator=(const pkmBasicCQT &);
+	
+	pkmBasicFFT<T>		*FFT;
+	
+	std::vector<int>	kernelStart,
+						kernelOffset;		// into kernelReal/Imag, kernelBins + 1
+	std::vector<T>		kernelReal,
+						kernelImag,
+						halfBand;
+	
+	std::vector<Level>	rings;				// one per octave in multirate mode
+	
+	T					*spectrumReal,
+						*spectrumImag,
+						*frame,
+						*queue;				// queueSize x numBins
+	long long			*positions,
+						nextFrame,
+						droppedFrames;
+	
+	int					numBins,
+						binsPerOctave,
+						levels,
+						kernelBins,
+						fftSize,
+						fftBins,
+						hopSize,
+						halfLength,
+						latency,
+						queueSize,
+						head,
+						numQueued;
+};
+
+typedef pkmBasicCQT<float> pkmCQT;
+typedef pkmBasicCQT<double> pkmCQTD;
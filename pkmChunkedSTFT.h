@@ -0,0 +1,533 @@
+/*
+ *  pkmChunkedSTFT.h
+ *
+ *  Out-of-core STFT over a stream read in chunks
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  pkmChunkedSTFT runs an STFT over a signal far larger than memory: a
+ *  source callback supplies samples, a sink callback (or a
+ *  pkmSpectrogramFile) takes the frames, and only a few chunks of
+ *  chunkFrames frames are held at once.  Framing and padding are those of
+ *  pkmSTFT on the whole signal, so the frames are the ones pkmSTFT::STFT
+ *  would give for the same samples.
+ *
+ *  Three stages run at once, connected by bounded queues of recycled
+ *  buffers, so a slow stage holds the others back instead of letting
+ *  memory grow:
+ *
+ *      read        its own thread; pulls samples from the source and
+ *                  carries the last fftSize - hopSize of each chunk over
+ *                  to the next
+ *      compute     the calling thread; pkmSTFT's frames over the shared
+ *                  pkmThreadPool
+ *      write       its own thread; hands finished chunks to the sink
+ *
+ *  Chunks are sized so that the buffers of the queueDepth chunks in flight
+ *  at each stage, and pkmSTFT's workspace, stay within the memory budget
+ *  (the shared FFT plans are not counted).  After run(), getReadStats(),
+ *  getComputeStats() and getWriteStats() give each stage's time busy and
+ *  waiting on its neighbours, and the bytes and frames it moved.
+ *
+ *  Usage:
+ *
+ *  FILE *in = fopen("recording.f32", "rb");
+ *  pkmChunkedSTFT stft(1024, 256, 64 << 20);
+ *  pkmSpectrogramFile file;
+ *  file.create("recording.pkmspec", 1024, 256, stft.getNumFrames(numSamples), 48000, PKM_SPECTROGRAM_FLOAT16);
+ *  stft.run(numSamples, [&](float *samples, long count) {
+ *      return (long) fread(samples, sizeof(float), count, in);
+ *  }, file);
+ *  printf("compute %.1f MB/s\n", stft.getComputeStats().getBytesPerSecond() / 1e6);
+ *
+ *  or with a sink of any storage type:
+ *
+ *  stft.run<float>(numSamples, source, [&](long firstFrame, int numFrames, const float *magnitudes, const float *phases) {
+ *      return consume(firstFrame, numFrames, magnitudes, phases);	// false stops the run
+ *  });
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "pkmSTFT.h"
+#include "pkmSpectrogramFile.h"
+#include "pkmWorkspace.h"
+
+// what one stage of a run did
+struct pkmChunkedSTFTStage
+{
+	long				chunks,
+						frames;
+	uint64_t			bytes;				// samples read, spectra computed or spectra written
+	double				busySeconds,
+						waitSeconds;		// blocked on a neighbouring stage
+	
+	double getBytesPerSecond() const
+	{
+		return busySeconds > 0 ? bytes / busySeconds : 0;
+	}
+	double getFramesPerSecond() const
+	{
+		return busySeconds > 0 ? frames / busySeconds : 0;
+	}
+};
+
+template <typename T>
+class pkmBasicChunkedSTFT
+{
+public:
+	
+	// returns how many samples it wrote to samples, up to count; fewer
+	// only at the end of the stream
+	typedef std::function<long(T *samples, long count)> Source;
+	
+	pkmBasicChunkedSTFT(int size, int hop = 0, size_t budget = 256 << 20, int depth = 2)
+	: stft(size, hop)
+	{
+		fftSize = size;
+		hopSize = stft.getHopSize();
+		fftBins = stft.getBins();
+		memoryBudget = budget;
+		queueDepth = depth < 1 ? 1 : depth;
+		chunkFrames = 0;
+		seconds = 0;
+		clearStats();
+	}
+	
+	void setMemoryBudget(size_t bytes)
+	{
+		memoryBudget = bytes;
+	}
+	
+	// buffers in flight between each pair of stages
+	void setQueueDepth(int depth)
+	{
+		queueDepth = depth < 1 ? 1 : depth;
+	}
+	
+	// threads computing frames; 0 uses every thread of pkmThreadPool::shared()
+	void setNumThreads(int n)
+	{
+		stft.setNumThreads(n);
+	}
+	
+	// as pkmSTFT::getNumWindows, exactly for any length
+	long getNumFrames(long numSamples) const
+	{
+		long padded = (numSamples + fftSize - 1) / fftSize * fftSize;
+		return padded < fftSize ? 0 : (padded - fftSize) / hopSize + 1;
+	}
+	
+	// frames per chunk the budget allows for a signal of numSamples stored
+	// as S, or 0 if it is too small for a chunk of one frame
+	template <typename S>
+	int getChunkFrames(long numSamples) const
+	{
+		size_t base = getMemoryUsage<S>(1);
+		if (base > memoryBudget)
+			return 0;
+		size_t perFrame = (queueDepth + 1) * hopSize * sizeof(T) + queueDepth * 2 * fftBins * sizeof(S);
+		long frames = 1 + (long) ((memoryBudget - base) / perFrame);
+		
+		// no more than the signal needs, and short enough for pkmSTFT's
+		// float padding arithmetic
+		frames = std::min(frames, std::max(getNumFrames(numSamples), 1L));
+		frames = std::min(frames, (long) (((1 << 24) - 2 * fftSize) / hopSize + 1));
+		while (frames > 1 && getMemoryUsage<S>((int) frames) > memoryBudget)
+			frames--;
+		return (int) frames;
+	}
+	
+	// bytes a run with chunks of frames frames holds: queueDepth chunks of
+	// samples and of spectra, the carried overlap and pkmSTFT's workspace
+	template <typename S>
+	size_t getMemoryUsage(int frames) const
+	{
+		int workers = stft.getNumThreads() > 0 ? stft.getNumThreads() : pkmThreadPool::shared().size();
+		size_t samples = pkmWorkspace::bytes<T>(computeSamples(frames));
+		size_t spectra = pkmWorkspace::bytes<S>((size_t) computeFrames(frames) * fftBins);
+		return queueDepth * (samples + 2 * spectra) + pkmWorkspace::bytes<T>(std::max(fftSize - hopSize, 1)) +
+			   samples + workers * pkmWorkspace::bytes<T>(fftSize * 16);
+	}
+	
+	// frames of numSamples samples from source to sink(firstFrame,
+	// numFrames, magnitudes, phases), chunk by chunk in order.  returns
+	// false if the budget is too small, the source ends early or the sink
+	// returns false
+	template <typename S, typename Sink>
+	bool run(long numSamples, const Source &source, const Sink &sink)
+	{
+		clearStats();
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+		
+		chunkFrames = getChunkFrames<S>(numSamples);
+		if (chunkFrames == 0) {
+			printf("\npkmChunkedSTFT: a memory budget of %lu bytes is too small for one chunk.\n", (unsigned long) memoryBudget);
+			return false;
+		}
+		
+		const long totalFrames = getNumFrames(numSamples);
+		const long numChunks = (totalFrames + chunkFrames - 1) / chunkFrames;
+		const long padded = (numSamples + fftSize - 1) / fftSize * fftSize;
+		const long shift = (padded - numSamples) / 2;
+		const int chunkSamples = (chunkFrames - 1) * hopSize + fftSize;
+		const int inputSamples = computeSamples(chunkFrames);
+		const int chunkBins = computeFrames(chunkFrames) * fftBins;
+		const int overlap = fftSize - hopSize;		// negative when frames leave gaps
+		
+		// every buffer up front; the queues pass their indices around
+		buffers.reserve(queueDepth * (pkmWorkspace::bytes<T>(inputSamples) + 2 * pkmWorkspace::bytes<S>(chunkBins)) +
+						pkmWorkspace::bytes<T>(std::max(overlap, 1)));
+		std::vector<T *> inputs(queueDepth);
+		std::vector<S *> magnitudes(queueDepth), phases(queueDepth);
+		std::vector<long> inputChunk(queueDepth), outputChunk(queueDepth);
+		for (int i = 0; i < queueDepth; i++) {
+			inputs[i] = buffers.get<T>(inputSamples);
+			magnitudes[i] = buffers.get<S>(chunkBins);
+			phases[i] = buffers.get<S>(chunkBins);
+		}
+		T *carry = buffers.get<T>(std::max(overlap, 1));
+		stft.reserve(inputSamples);
+		
+		Queue freeInputs, fullInputs, freeOutputs, fullOutputs;
+		for (int i = 0; i < queueDepth; i++) {
+			freeInputs.push(i);
+			freeOutputs.push(i);
+		}
+		std::atomic<bool> bFailed(false);
+		Queue *queues[4] = { &freeInputs, &fullInputs, &freeOutputs, &fullOutputs };
+		auto fail = [&]() {
+			bFailed = true;
+			for (int i = 0; i < 4; i++)
+				queues[i]->close();
+		};
+		
+		// read: the chunk starting at padded sample c * chunkFrames * hopSize
+		std::thread reader([&]() {
+			long position = 0;			// padded samples consumed
+			for (long c = 0; c < numChunks && !bFailed; c++) {
+				int b = 0;
+				if (!timedPop(freeInputs, b, readStats))
+					break;
+				Timer busy(readStats.busySeconds);
+				T *dst = inputs[b];
+				long start = c * chunkFrames * hopSize;
+				int have = 0;
+				if (c > 0 && overlap > 0) {
+					pkmDSP::copy(overlap, carry, 1, dst, 1);
+					have = overlap;
+				}
+				bool bOk = true;
+				while (bOk && position < start) {
+					int skip = (int) std::min((long) chunkSamples, start - position);
+					bOk = readPadded(source, dst + have, skip, position, shift, numSamples);
+				}
+				if (bOk)
+					bOk = readPadded(source, dst + have, chunkSamples - have, position, shift, numSamples);
+				if (!bOk) {
+					printf("\npkmChunkedSTFT: the source ended before %ld samples.\n", numSamples);
+					fail();
+					break;
+				}
+				if (overlap > 0)
+					pkmDSP::copy(overlap, dst + chunkSamples - overlap, 1, carry, 1);
+				pkmDSP::vclr(dst + chunkSamples, 1, inputSamples - chunkSamples);
+				readStats.chunks++;
+				readStats.frames += std::min((long) chunkFrames, totalFrames - c * chunkFrames);
+				readStats.bytes += (uint64_t) (chunkSamples - have) * sizeof(T);
+				inputChunk[b] = c;
+				fullInputs.push(b);
+			}
+			fullInputs.close();
+		});
+		
+		// write
+		std::thread writer([&]() {
+			int o = 0;
+			while (timedPop(fullOutputs, o, writeStats) && !bFailed) {
+				Timer busy(writeStats.busySeconds);
+				long c = outputChunk[o];
+				int frames = (int) std::min((long) chunkFrames, totalFrames - c * chunkFrames);
+				if (!sink(c * chunkFrames, frames, (const S *) magnitudes[o], (const S *) phases[o])) {
+					fail();
+					break;
+				}
+				writeStats.chunks++;
+				writeStats.frames += frames;
+				writeStats.bytes += 2 * (uint64_t) frames * fftBins * sizeof(S);
+				freeOutputs.push(o);
+			}
+		});
+		
+		// compute on this thread, fanned out over the pool
+		int b = 0;
+		while (timedPop(fullInputs, b, computeStats) && !bFailed) {
+			int o = 0;
+			if (!timedPop(freeOutputs, o, computeStats))
+				break;
+			Timer busy(computeStats.busySeconds);
+			long c = inputChunk[b];
+			int frames = (int) std::min((long) chunkFrames, totalFrames - c * chunkFrames);
+			stft.STFT(inputs[b], inputSamples, magnitudes[o], phases[o]);
+			freeInputs.push(b);
+			computeStats.chunks++;
+			computeStats.frames += frames;
+			computeStats.bytes += 2 * (uint64_t) frames * fftBins * sizeof(S);
+			outputChunk[o] = c;
+			fullOutputs.push(o);
+		}
+		fullOutputs.close();
+		
+		reader.join();
+		writer.join();
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+		return !bFailed;
+	}
+	
+	// into a file made for this transform with getNumFrames(numSamples)
+	// frames; the write stage copies chunks into the mapping and starts
+	// their writeback
+	bool run(long numSamples, const Source &source, pkmSpectrogramFile &file)
+	{
+		if (!file.isWritable() || file.getFFTSize() != fftSize || file.getHopSize() != hopSize ||
+			file.getWindow() != PKM_FFT_WINDOW_HANN || file.getNumFrames() != getNumFrames(numSamples)) {
+			printf("\npkmChunkedSTFT: spectrogram file is read only or not made for this transform.\n");
+			return false;
+		}
+		bool bOk = false;
+		switch (file.getType()) {
+			case PKM_SPECTROGRAM_FLOAT32:	bOk = runToFile<float>(numSamples, source, file); break;
+			case PKM_SPECTROGRAM_FLOAT64:	bOk = runToFile<double>(numSamples, source, file); break;
+			case PKM_SPECTROGRAM_FLOAT16:	bOk = runToFile<pkmHalf>(numSamples, source, file); break;
+			case PKM_SPECTROGRAM_BFLOAT16:	bOk = runToFile<pkmBFloat16>(numSamples, source, file); break;
+		}
+		if (bOk)
+			file.setNumSamples(numSamples);
+		return bOk;
+	}
+	
+	// frames per chunk of the last run
+	int getChunkFrames() const
+	{
+		return chunkFrames;
+	}
+	
+	const pkmChunkedSTFTStage &getReadStats() const			{ return readStats; }
+	const pkmChunkedSTFTStage &getComputeStats() const		{ return computeStats; }
+	const pkmChunkedSTFTStage &getWriteStats() const		{ return writeStats; }
+	
+	// wall time of the last run
+	double getSeconds() const
+	{
+		return seconds;
+	}
+	
+private:
+	
+	// blocking queue of buffer indices; never holds more than queueDepth,
+	// since only that many buffers exist.  pop fails once closed and empty
+	class Queue
+	{
+	public:
+		Queue() : bClosed(false) {}
+		
+		void push(int i)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				items.push_back(i);
+			}
+			ready.notify_one();
+		}
+		bool pop(int &i)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			ready.wait(lock, [this] { return !items.empty() || bClosed; });
+			if (items.empty())
+				return false;
+			i = items.front();
+			items.pop_front();
+			return true;
+		}
+		void close()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				bClosed = true;
+			}
+			ready.notify_all();
+		}
+		
+	private:
+		std::mutex				mutex;
+		std::condition_variable	ready;
+		std::deque<int>			items;
+		bool					bClosed;
+	};
+	
+	// adds the time until it goes out of scope to seconds
+	struct Timer
+	{
+		Timer(double &s) : total(s), start(std::chrono::steady_clock::now()) {}
+		~Timer() { total += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+		double									&total;
+		std::chrono::steady_clock::time_point	start;
+	};
+	
+	static bool timedPop(Queue &queue, int &i, pkmChunkedSTFTStage &stats)
+	{
+		Timer wait(stats.waitSeconds);
+		return queue.pop(i);
+	}
+	
+	// n samples of the padded signal from position on: shift zeros, the
+	// source's numSamples, then zeros
+	static bool readPadded(const Source &source, T *dst, int n, long &position, long shift, long numSamples)
+	{
+		int i = 0;
+		if (position < shift) {
+			int zeros = (int) std::min((long) n, shift - position);
+			pkmDSP::vclr(dst, 1, zeros);
+			i = zeros;
+		}
+		while (i < n && position + i < shift + numSamples) {
+			long want = std::min((long) (n - i), shift + numSamples - position - i);
+			long got = source(dst + i, want);
+			if (got <= 0)
+				return false;
+			i += (int) got;
+		}
+		if (i < n)
+			pkmDSP::vclr(dst + i, 1, n - i);
+		position += n;
+		return true;
+	}
+	
+	template <typename S>
+	bool runToFile(long numSamples, const Source &source, pkmSpectrogramFile &file)
+	{
+		return run<S>(numSamples, source, [&](long firstFrame, int numFrames, const S *magnitudes, const S *phases) {
+			memcpy(file.editMagnitudes<S>(firstFrame), magnitudes, sizeof(S) * numFrames * fftBins);
+			memcpy(file.editPhases<S>(firstFrame), phases, sizeof(S) * numFrames * fftBins);
+			file.flush(firstFrame, firstFrame + numFrames, false);
+			return true;
+		});
+	}
+	
+	// samples pkmSTFT is given for a chunk: the frames' span rounded up to
+	// whole ffts, so that it frames them without padding
+	int computeSamples(int frames) const
+	{
+		int span = (frames - 1) * hopSize + fftSize;
+		return (span + fftSize - 1) / fftSize * fftSize;
+	}
+	
+	// frames pkmSTFT computes from them; those past the chunk are dropped
+	int computeFrames(int frames) const
+	{
+		return (computeSamples(frames) - fftSize) / hopSize + 1;
+	}
+	
+	void clearStats()
+	{
+		memset(&readStats, 0, sizeof(readStats));
+		memset(&computeStats, 0, sizeof(computeStats));
+		memset(&writeStats, 0, sizeof(writeStats));
+	}
+	
+	mutable pkmBasicSTFT<T>	stft;
+	pkmWorkspace			buffers;
+	pkmChunkedSTFTStage		readStats,
+							computeStats,
+							writeStats;
+	size_t					memoryBudget;
+	double					seconds;
+	int						fftSize,
+							hopSize,
+							fftBins,
+							queueDepth,
+							chunkFrames;
+};
+
+typedef pkmBasicChunkedSTFT<float> pkmChunkedSTFT;
+typedef pkmBasicChunkedSTFT<double> pkmChunkedSTFTD;
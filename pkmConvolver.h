@@ -0,0 +1,282 @@
+/*
+ *  pkmConvolver.h
+ *
+ *  Uniformly partitioned overlap-save convolution
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  pkmConvolver convolves blocks of blockSize samples with an impulse
+ *  response of any length, split into partitions of blockSize samples.
+ *  Each partition's spectrum (a real FFT of 2 * blockSize points, zero
+ *  padded) is computed once by the constructor.  Every call to process()
+ *  runs one forward FFT of the last 2 * blockSize input samples, pushes the
+ *  spectrum onto a frequency-domain delay line, multiply-accumulates the
+ *  delay line against the partitions directly on split complex data, and
+ *  runs one inverse FFT whose second half is the output (overlap-save).
+ *
+ *  The output of a call is the convolution at the same samples as its
+ *  input, so the only latency is collecting a block.  Cost per block is
+ *  two FFTs of 2 * blockSize plus one complex multiply-add per bin and
+ *  partition.
+ *
+ *  One convolver serves numChannels independent channels sharing the
+ *  impulse response spectra; each channel has its own input history, delay
+ *  line and scratch, so different channels may be processed from different
+ *  threads at once.  Everything is allocated by the constructor; process()
+ *  never allocates.
+ *
+ *  Usage:
+ *
+ *  pkmConvolver reverb(impulse_response, ir_length, 256, 2);
+ *
+ *  // audio callback, 256 samples per channel
+ *  reverb.process(0, left_in, left_out);
+ *  reverb.process(1, right_in, right_out);
+ *
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory>
+#include <algorithm>
+#include "pkmFFTPlan.h"
+#include "pkmFFTPlanCache.h"
+#include "pkmDSP.h"
+
+template <typename T>
+class pkmBasicConvolver
+{
+public:
+	
+	pkmBasicConvolver(const T *ir, int irLength, int blockSize = 256, int numChannels = 1)
+	{
+		this->blockSize = blockSize;
+		channels = numChannels;
+		fftSize = 2 * blockSize;
+		partitions = irLength > 0 ? (irLength + blockSize - 1) / blockSize : 1;
+		
+		fftPlan = pkmFFTPlanCache::instance().plan<T>(fftSize);
+		scratchSize = fftPlan->scratchSize() + 1;
+		scratch = (T *) malloc(sizeof(T) * scratchSize * channels);
+		
+		// partition spectra, then per channel: 2 * blockSize of input
+		// history, a delay line of partitions spectra and an accumulator
+		irSpectra = (T *) malloc(sizeof(T) * fftSize * partitions);
+		history = (T *) calloc((size_t) fftSize * channels, sizeof(T));
+		delayLine = (T *) calloc((size_t) fftSize * partitions * channels, sizeof(T));
+		head = (int *) calloc(channels, sizeof(int));
+		accumulators = (T *) malloc(sizeof(T) * fftSize * channels);
+		if (scratch == NULL || irSpectra == NULL || history == NULL || delayLine == NULL || 
+			head == NULL || accumulators == NULL || !fftPlan->isValid())
+		{
+			printf("\npkmConvolver failed to allocate enough memory.\n");
+			return;
+		}
+		
+		// the plan's forward gives 2 X[k], so a product of two spectra comes
+		// back from the inverse 4 * fftSize times too large
+		const T scale = (T) 1 / (4 * (T) fftSize);
+		T *padded = accumulators;		// borrowed, blockSize samples
+		for (int p = 0; p < partitions; p++) {
+			const int n = std::min(blockSize, irLength - p*blockSize);
+			T *re = irSpectra + (long) p*fftSize, *im = re + blockSize;
+			pkmDSP::vclr(padded, 1, blockSize);
+			if (n > 0)
+				pkmDSP::vsmul(ir + (long) p*blockSize, 1, &scale, padded, 1, n);
+			// ctoz of [padded, zeros]
+			for (int j = 0; j < blockSize; j++) {
+				re[j] = 2*j < blockSize ? padded[2*j] : 0;
+				im[j] = 2*j+1 < blockSize ? padded[2*j+1] : 0;
+			}
+			fftPlan->forward(re, im, scratch);
+		}
+	}
+	
+	~pkmBasicConvolver()
+	{
+		free(scratch);
+		free(irSpectra);
+		free(history);
+		free(delayLine);
+		free(head);
+		free(accumulators);
+	}
+	
+	// blockSize samples of channel in, blockSize samples out; output may
+	// be the same buffer as input
+	void process(int channel, const T *input, T *output)
+	{
+		T *x = history + (long) channel*fftSize;
+		T *fdl = delayLine + (long) channel*fftSize*partitions;
+		T *yr = accumulators + (long) channel*fftSize, *yi = yr + blockSize;
+		T *work = scratch + (long) channel*scratchSize;
+		
+		// slide the history on by a block
+		pkmDSP::copy(blockSize, x + blockSize, 1, x, 1);
+		pkmDSP::copy(blockSize, input, 1, x + blockSize, 1);
+		
+		// newest spectrum goes in at head, the oldest falls off
+		int h = head[channel] = head[channel] == 0 ? partitions - 1 : head[channel] - 1;
+		T *re = fdl + (long) h*fftSize, *im = re + blockSize;
+		pkmDSP::ctoz(x, re, im, blockSize);
+		fftPlan->forward(re, im, work);
+		
+		// spectrum p blocks old meets partition p
+		pkmDSP::vclr(yr, 1, fftSize);
+		for (int p = 0; p < partitions; p++) {
+			const T *s = fdl + (long) ((h + p) % partitions)*fftSize;
+			const T *ir = irSpectra + (long) p*fftSize;
+			multiplyAccumulate(yr, yi, s, s + blockSize, ir, ir + blockSize);
+		}
+		
+		fftPlan->inverse(yr, yi, work);
+		
+		// the second half is free of circular wrap-around
+		if (blockSize & 1) {
+			for (int i = 0; i < blockSize; i++) {
+				const int n = blockSize + i;
+				output[i] = n & 1 ? yi[n/2] : yr[n/2];
+			}
+		}
+		else {
+			pkmDSP::ztoc(yr + blockSize/2, yi + blockSize/2, output, blockSize/2);
+		}
+	}
+	
+	// every channel at once
+	void process(const T * const *inputs, T * const *outputs)
+	{
+		for (int c = 0; c < channels; c++)
+			process(c, inputs[c], outputs[c]);
+	}
+	
+	// clears the input history and delay lines, as if fed silence
+	void reset()
+	{
+		pkmDSP::vclr(history, 1, fftSize * channels);
+		pkmDSP::vclr(delayLine, 1, fftSize * partitions * channels);
+	}
+	
+	int getBlockSize() const
+	{
+		return blockSize;
+	}
+	
+	int getNumPartitions() const
+	{
+		return partitions;
+	}
+	
+	int getNumChannels() const
+	{
+		return channels;
+	}
+	
+private:
+	
+	// y += a * b on packed split spectra; bin 0 holds the real DC and
+	// Nyquist values, which multiply separately
+	void multiplyAccumulate(T *yr, T *yi, const T *ar, const T *ai, const T *br, const T *bi)
+	{
+		const T dc = yr[0] + ar[0] * br[0], nyquist = yi[0] + ai[0] * bi[0];
+		for (int k = 0; k < blockSize; k++) {
+			yr[k] += ar[k] * br[k] - ai[k] * bi[k];
+			yi[k] += ar[k] * bi[k] + ai[k] * br[k];
+		}
+		yr[0] = dc;
+		yi[0] = nyquist;
+	}
+	
+	pkmBasicConvolver(const pkmBasicConvolver &);
+	pkmBasicConvolver & operator=(const pkmBasicConvolver &);
+	
+	std::shared_ptr<const pkmFFTPlan<T> > fftPlan;
+	T					*scratch,
+						*irSpectra,			// partitions x (blockSize re, blockSize im)
+						*history,			// channels x fftSize
+						*delayLine,			// channels x partitions spectra
+						*accumulators;		// channels x (blockSize re, blockSize im)
+	int					*head;				// newest spectrum of each channel
+	
+	int					blockSize,
+						scratchSize,
+						fftSize,
+						partitions,
+						channels;
+};
+
+typedef pkmBasicConvolver<float> pkmConvolver;
+typedef pkmBasicConvolver<double> pkmConvolverD;
@@ -1,7 +1,21 @@
 /*
  *  pkmDCT.h
  *
- *  DCT wraper for Apple's Accelerate Framework
+ *  DCT wraper for Apple's Accelerate Framework (or the portable backend in
+ *  pkmFFTPlan.h); pkmDCT works in float, pkmDCTD in double
+ *
+ *  Orthonormal DCT-II (dctII_*) and its inverse DCT-III (dctIII_*) of
+ *  size/2 points, on one vector, a batch of rows, or separable 2-D blocks.
+ *  Each goes through a real FFT of size/2 points (Makhoul's reordering)
+ *  rather than of the mirrored signal; batches run their rows through the
+ *  plan's batched kernels, one row per SIMD lane.
+ *
+ *  pkmDCT dct;
+ *  dct.setup(16);                              // 8 point DCT
+ *  dct.dctII_1D(x, X);
+ *  dct.dctIII_1D(X, x);
+ *  dct.dctII_batch(rows, coefficients, numRows, 4);
+ *  dct.dctII_2D(blocks, coefficients, numBlocks);    // 8 x 8 blocks
  *
  *  Created by Parag K. Mital - http://pkmital.com 
  *  Contact: parag@pkmital.com
@@ -82,102 +96,339 @@
 #ifndef pkmMatrix_pkmDCT_h
 #define pkmMatrix_pkmDCT_h
 
-#import <Accelerate/Accelerate.h>
-#import <math.h>
+#include <math.h>
+#include <iostream>
+#include <algorithm>
+#include "pkmFFTPlan.h"
+#include "pkmFFTPlanCache.h"
+#include "pkmDSP.h"
+#include "pkmWorkspace.h"
+#include "pkmInstrument.h"
 
-class pkmDCT 
+template <typename T>
+class pkmBasicDCT 
 {
 public:
-    pkmDCT()
+    pkmBasicDCT()
     {
         bAllocated = false;
     }
     
-    ~pkmDCT()
+    ~pkmBasicDCT()
+    {
+        release();
+    }
+    
+    void release()
     {
         if (bAllocated) {
-            free(dctCorrectionFactors);
-            vDSP_destroy_fftsetup(fftSetup);
-            free(mirroredData);
-            free(complexData->realp);
-            free(complexData->imagp);
-            free(complexData);
+            free(twiddleCos);
+            free(twiddleSin);
+            fftPlan.reset();
+            free(fftScratch);
+            free(reorderedData);
+            free(complexData.realp);
+            free(complexData.imagp);
+            free(batchData.realp);
+            free(batchData.imagp);
+            free(batchScratch);
             bAllocated = false;
         }
     }
     
-    // zero-pad to power of two...
+    // size is the mirrored length, twice the number of input samples; any
+    // even size from 4 works (powers of two are fastest)
     void setup(int size = 4096) 
     {     
-        fftSize = size;
-        fftSizeLog2n = log2f(fftSize);
-        dctSizeLog2n = fftSizeLog2n - 1;
-        dctSize = 1 << dctSizeLog2n;
+        release();
         
-        fftSetup = vDSP_create_fftsetup( fftSizeLog2n, FFT_RADIX2 );
+        dctSize = size / 2;
+        fftSize = dctSize;
+        fftBins = (fftSize + 1) / 2;
         
-        dctCorrectionFactors = (float*) malloc(sizeof(float) * fftSize);
+        fftPlan = pkmFFTPlanCache::instance().plan<T>(fftSize);
+        fftScratch = (T *)malloc(sizeof(T) * (fftPlan->scratchSize() + 1));
         
-        for (int i = 0; i < dctSize; i++) 
+        // e^(-i pi k / 2N) with the orthonormal scale folded in
+        twiddleCos = (T *)malloc(sizeof(T) * fftBins);
+        twiddleSin = (T *)malloc(sizeof(T) * fftBins);
+        for (int k = 0; k < fftBins; k++) 
         {
-            dctCorrectionFactors[2*i  ] = cosf( ( M_PI * (dctSize - 0.5) * i ) / dctSize ) / sqrtf(dctSize * 8.0);
-            dctCorrectionFactors[2*i+1] = sinf( ( M_PI * (dctSize - 0.5) * i ) / dctSize ) / sqrtf(dctSize * 8.0);
+            twiddleCos[k] = cos( ( M_PI * k ) / (2.0 * dctSize) ) / sqrt(dctSize * 2.0);
+            twiddleSin[k] = sin( ( M_PI * k ) / (2.0 * dctSize) ) / sqrt(dctSize * 2.0);
         }
-        dctCorrectionFactors[0] = dctCorrectionFactors[0] / sqrtf(2.0);
-        dctCorrectionFactors[1] = dctCorrectionFactors[1] / sqrtf(2.0); 
+        edgeScale = 1.0 / sqrt((double) dctSize);
         
-        mirroredData = (float *)malloc(sizeof(float) * fftSize);
-        complexData = (DSPSplitComplex*)calloc(1, sizeof(DSPSplitComplex));
-        complexData->realp = (float *)malloc(sizeof(float) * dctSize);
-        complexData->imagp = (float *)malloc(sizeof(float) * dctSize);
+        // one extra sample for odd sizes, which pack v[N] = 0
+        reorderedData = (T *)malloc(sizeof(T) * 2 * fftBins);
+        complexData.realp = (T *)malloc(sizeof(T) * fftBins);
+        complexData.imagp = (T *)malloc(sizeof(T) * fftBins);
+        
+        batchLanes = fftPlan->batchLanes();
+        batchData.realp = batchData.imagp = batchScratch = NULL;
+        if (batchLanes > 1) {
+            batchData.realp = (T *)malloc(sizeof(T) * fftBins * batchLanes);
+            batchData.imagp = (T *)malloc(sizeof(T) * fftBins * batchLanes);
+            batchScratch = (T *)malloc(sizeof(T) * (fftPlan->batchScratchSize() + 1));
+        }
         
         bAllocated = true;
     }
     
     // result is half the size of the input
-    void dctII_1D(float *input, float *result, int numCoefficients = -1) 
+    template <typename S>
+    void dctII_1D(const T *input, S *result, int numCoefficients = -1) 
     {   
         if (!bAllocated) {
-            cerr << "[ERROR]::pkmDCT::dctII_1D(...):: Not allocated! Call setup(int size); first!" << endl;
+            std::cerr << "[ERROR]::pkmDCT::dctII_1D(...):: Not allocated! Call setup(int size); first!" << std::endl;
             return;
         }
         
-        for (int i = 0; i < dctSize; i++) {
-            mirroredData[i] = input[dctSize-i-1];
+        PKM_INSTRUMENT_START(clock);
+        reorder(input);
+        PKM_INSTRUMENT_LAP(clock, PKM_STAGE_DCT_MIRROR, 2 * sizeof(T) * dctSize);
+        pkmDSP::ctoz(reorderedData, complexData.realp, complexData.imagp, fftBins);
+        PKM_INSTRUMENT_LAP(clock, PKM_STAGE_PACK, 4 * sizeof(T) * fftBins);
+        fftPlan->forward(complexData.realp, complexData.imagp, fftScratch);
+        PKM_INSTRUMENT_LAP(clock, PKM_STAGE_TRANSFORM, 4 * sizeof(T) * fftBins);
+        postTwiddle(complexData.realp, complexData.imagp, 1, result, coefficients(numCoefficients));
+        PKM_INSTRUMENT_LAP(clock, PKM_STAGE_DCT_TWIDDLE, 2 * sizeof(T) * fftBins + sizeof(S) * coefficients(numCoefficients));
+    }
+    
+    // inverse of dctII_1D; input holds the first numCoefficients
+    // coefficients (all of them by default), the rest are taken as 0
+    void dctIII_1D(const T *input, T *result, int numCoefficients = -1) 
+    {   
+        if (!bAllocated) {
+            std::cerr << "[ERROR]::pkmDCT::dctIII_1D(...):: Not allocated! Call setup(int size); first!" << std::endl;
+            return;
         }
-        for (int i = dctSize; i < fftSize; i++) {
-            mirroredData[i] = input[i-dctSize];
+        
+        PKM_INSTRUMENT_START(clock);
+        preTwiddle(input, coefficients(numCoefficients), complexData.realp, complexData.imagp, 1);
+        PKM_INSTRUMENT_LAP(clock, PKM_STAGE_DCT_TWIDDLE, sizeof(T) * (coefficients(numCoefficients) + 2 * fftBins));
+        fftPlan->inverse(complexData.realp, complexData.imagp, fftScratch);
+        PKM_INSTRUMENT_LAP(clock, PKM_STAGE_TRANSFORM, 4 * sizeof(T) * fftBins);
+        pkmDSP::ztoc(complexData.realp, complexData.imagp, reorderedData, fftBins);
+        PKM_INSTRUMENT_LAP(clock, PKM_STAGE_UNPACK, 4 * sizeof(T) * fftBins);
+        unreorder(result);
+        PKM_INSTRUMENT_LAP(clock, PKM_STAGE_DCT_MIRROR, 2 * sizeof(T) * dctSize);
+    }
+    
+    // dctII_1D of count rows of size/2 samples; row r of result is at
+    // result + r * numCoefficients (size/2 when -1 or larger)
+    template <typename S>
+    void dctII_batch(const T *input, S *result, int count, int numCoefficients = -1) 
+    {   
+        if (!bAllocated) {
+            std::cerr << "[ERROR]::pkmDCT::dctII_batch(...):: Not allocated! Call setup(int size); first!" << std::endl;
+            return;
         }
         
-        vDSP_ctoz((DSPComplex*) mirroredData, (vDSP_Stride) 2, complexData, (vDSP_Stride) 1, dctSize);
-        vDSP_fft_zrip( fftSetup, complexData, (vDSP_Stride) 1, fftSizeLog2n, kFFTDirection_Forward);
-        vDSP_ztoc(complexData, (vDSP_Stride) 1, (DSPComplex *) mirroredData, (vDSP_Stride) 2, dctSize);
-        vDSP_vmul(mirroredData, (vDSP_Stride) 1, dctCorrectionFactors, (vDSP_Stride) 1, mirroredData, (vDSP_Stride) 1, fftSize);
+        const int n = coefficients(numCoefficients);
+        if (batchLanes <= 1) {
+            for (int r = 0; r < count; r++)
+                dctII_1D(input + (long) r*dctSize, result + (long) r*n, n);
+            return;
+        }
         
-        if(numCoefficients == -1)
-        {
-            for (int i = 0; i < dctSize; i++) {
-                result[i] = mirroredData[2*i] - mirroredData[2*i+1];
+        const int lanes = batchLanes;
+        for (int r0 = 0; r0 < count; r0 += lanes) {
+            const int rows = std::min(lanes, count - r0);
+            PKM_INSTRUMENT_START(clock);
+            
+            // reorder each row into its lane; lanes past the last row are zero
+            for (int l = 0; l < rows; l++) {
+                reorder(input + (long) (r0 + l)*dctSize);
+                for (int j = 0; j < fftBins; j++) {
+                    batchData.realp[(long) j*lanes + l] = reorderedData[2*j];
+                    batchData.imagp[(long) j*lanes + l] = reorderedData[2*j+1];
+                }
             }
+            for (int j = 0; j < fftBins; j++)
+                for (int l = rows; l < lanes; l++)
+                    batchData.realp[(long) j*lanes + l] = batchData.imagp[(long) j*lanes + l] = 0;
+            
+            PKM_INSTRUMENT_LAP(clock, PKM_STAGE_DCT_MIRROR, 4 * sizeof(T) * dctSize * rows);
+            
+            fftPlan->forwardBatch(batchData.realp, batchData.imagp, batchScratch);
+            PKM_INSTRUMENT_LAP(clock, PKM_STAGE_TRANSFORM, 4 * sizeof(T) * fftBins * lanes);
+            
+            for (int l = 0; l < rows; l++)
+                postTwiddle(batchData.realp + l, batchData.imagp + l, lanes, result + (long) (r0 + l)*n, n);
+            PKM_INSTRUMENT_LAP(clock, PKM_STAGE_DCT_TWIDDLE, (2 * sizeof(T) * fftBins + sizeof(S) * n) * rows);
         }
-        else
-        {
-            for (int i = 0; i < numCoefficients; i++) {
-                result[i] = mirroredData[2*i] - mirroredData[2*i+1];
+    }
+    
+    // dctIII_1D of count rows of numCoefficients coefficients each
+    void dctIII_batch(const T *input, T *result, int count, int numCoefficients = -1) 
+    {   
+        if (!bAllocated) {
+            std::cerr << "[ERROR]::pkmDCT::dctIII_batch(...):: Not allocated! Call setup(int size); first!" << std::endl;
+            return;
+        }
+        
+        const int n = coefficients(numCoefficients);
+        if (batchLanes <= 1) {
+            for (int r = 0; r < count; r++)
+                dctIII_1D(input + (long) r*n, result + (long) r*dctSize, n);
+            return;
+        }
+        
+        const int lanes = batchLanes;
+        for (int r0 = 0; r0 < count; r0 += lanes) {
+            const int rows = std::min(lanes, count - r0);
+            PKM_INSTRUMENT_START(clock);
+            
+            for (int l = 0; l < rows; l++)
+                preTwiddle(input + (long) (r0 + l)*n, n, batchData.realp + l, batchData.imagp + l, lanes);
+            for (int j = 0; j < fftBins; j++)
+                for (int l = rows; l < lanes; l++)
+                    batchData.realp[(long) j*lanes + l] = batchData.imagp[(long) j*lanes + l] = 0;
+            PKM_INSTRUMENT_LAP(clock, PKM_STAGE_DCT_TWIDDLE, sizeof(T) * (n + 2 * fftBins) * rows);
+            
+            fftPlan->inverseBatch(batchData.realp, batchData.imagp, batchScratch);
+            PKM_INSTRUMENT_LAP(clock, PKM_STAGE_TRANSFORM, 4 * sizeof(T) * fftBins * lanes);
+            
+            for (int l = 0; l < rows; l++) {
+                for (int j = 0; j < fftBins; j++) {
+                    reorderedData[2*j] = batchData.realp[(long) j*lanes + l];
+                    reorderedData[2*j+1] = batchData.imagp[(long) j*lanes + l];
+                }
+                unreorder(result + (long) (r0 + l)*dctSize);
             }
+            PKM_INSTRUMENT_LAP(clock, PKM_STAGE_DCT_MIRROR, 4 * sizeof(T) * dctSize * rows);
         }
     }
     
+    // separable 2-D DCT-II of numBlocks square blocks of size/2 x size/2
+    // samples stored one after another, each row-major; result has the same
+    // layout.  rows are transformed as one batch, then the columns after a
+    // transpose
+    void dctII_2D(const T *input, T *result, int numBlocks = 1) 
+    {   
+        transform2D(input, result, numBlocks, false);
+    }
+    
+    // inverse of dctII_2D
+    void dctIII_2D(const T *input, T *result, int numBlocks = 1) 
+    {   
+        transform2D(input, result, numBlocks, true);
+    }
+    
 private:
+    
+    int coefficients(int numCoefficients) const
+    {
+        return numCoefficients < 0 || numCoefficients > dctSize ? dctSize : numCoefficients;
+    }
+    
+    // v[n] = x[2n], v[N-1-n] = x[2n+1], so the DFT of v gives the DCT
+    void reorder(const T *input)
+    {
+        T *v = reorderedData;
+        const int evens = (dctSize + 1) / 2, odds = dctSize / 2;
+        for (int i = 0; i < evens; i++)
+            v[i] = input[2*i];
+        for (int i = 0; i < odds; i++)
+            v[dctSize-1-i] = input[2*i+1];
+        if (dctSize & 1)
+            v[dctSize] = 0;
+    }
+    
+    void unreorder(T *result)
+    {
+        const T *v = reorderedData;
+        const int evens = (dctSize + 1) / 2, odds = dctSize / 2;
+        for (int i = 0; i < evens; i++)
+            result[2*i] = v[i];
+        for (int i = 0; i < odds; i++)
+            result[2*i+1] = v[dctSize-1-i];
+    }
+    
+    // C[k] = Re(e^(-i pi k / 2N) V[k]) and, from the conjugate symmetry of
+    // V, C[N-k] off the same bin; the plan's bins are 2 V[k]
+    template <typename S>
+    void postTwiddle(const T *re, const T *im, int stride, S *result, int numCoefficients)
+    {
+        const int n = numCoefficients;
+        const T edge = edgeScale / 2;
+        if (n > 0)
+            result[0] = re[0] * edge;
+        if (!(dctSize & 1) && dctSize/2 < n)
+            result[dctSize/2] = im[0] * edge;
+        
+        const int front = std::min(fftBins, n);
+        for (int k = 1; k < front; k++)
+            result[k] = twiddleCos[k] * re[(long) k*stride] + twiddleSin[k] * im[(long) k*stride];
+        for (int k = std::max(1, dctSize - n + 1); k < fftBins; k++)
+            result[dctSize-k] = twiddleSin[k] * re[(long) k*stride] - twiddleCos[k] * im[(long) k*stride];
+    }
+    
+    // the bins whose inverse FFT is v, from numCoefficients coefficients
+    void preTwiddle(const T *input, int numCoefficients, T *re, T *im, int stride)
+    {
+        // zero padded copy so C[k] and C[N-k] are plain loads
+        T *c = reorderedData;
+        pkmDSP::copy(numCoefficients, input, 1, c, 1);
+        pkmDSP::vclr(c + numCoefficients, 1, 2*fftBins - numCoefficients);
+        
+        re[0] = c[0] * edgeScale;
+        im[0] = dctSize & 1 ? 0 : c[dctSize/2] * edgeScale;
+        for (int k = 1; k < fftBins; k++) {
+            const T a = c[k], b = c[dctSize-k];
+            re[(long) k*stride] = twiddleCos[k] * a + twiddleSin[k] * b;
+            im[(long) k*stride] = twiddleSin[k] * a - twiddleCos[k] * b;
+        }
+    }
+    
+    void transform2D(const T *input, T *result, int numBlocks, bool bInverse)
+    {
+        if (!bAllocated) {
+            std::cerr << "[ERROR]::pkmDCT::dct" << (bInverse ? "III" : "II") << "_2D(...):: Not allocated! Call setup(int size); first!" << std::endl;
+            return;
+        }
+        
+        const long blockSize = (long) dctSize * dctSize;
+        workspace.reserve(2 * pkmWorkspace::bytes<T>(blockSize * numBlocks));
+        T *rows = workspace.get<T>(blockSize * numBlocks);
+        T *columns = workspace.get<T>(blockSize * numBlocks);
+        
+        // rows, transpose, rows again (the columns, in place), transpose back
+        if (bInverse)
+            dctIII_batch(input, rows, numBlocks * dctSize);
+        else
+            dctII_batch(input, rows, numBlocks * dctSize);
+        for (int b = 0; b < numBlocks; b++)
+            pkmDSP::mtrans(rows + b*blockSize, 1, columns + b*blockSize, 1, dctSize, dctSize);
+        if (bInverse)
+            dctIII_batch(columns, columns, numBlocks * dctSize);
+        else
+            dctII_batch(columns, columns, numBlocks * dctSize);
+        for (int b = 0; b < numBlocks; b++)
+            pkmDSP::mtrans(columns + b*blockSize, 1, result + b*blockSize, 1, dctSize, dctSize);
+    }
+    
     bool bAllocated;
     
-    FFTSetup fftSetup;
-    float* dctCorrectionFactors;
-    int fftSize, fftSizeLog2n, dctSize, dctSizeLog2n;
+    std::shared_ptr<const pkmFFTPlan<T> > fftPlan;
+    T *fftScratch;
+    T *twiddleCos, *twiddleSin;
+    T edgeScale;                    // 1/sqrt(N), for bin 0 and Nyquist
+    int fftSize, fftBins, dctSize;
+    
+    T *reorderedData;
+    pkmSplitComplex<T> complexData;
     
-    float *mirroredData;
-    DSPSplitComplex* complexData;
+    pkmSplitComplex<T> batchData;   // frame-interleaved, batchLanes rows
+    T *batchScratch;
+    int batchLanes;
+    
+    pkmWorkspace workspace;         // 2-D row and column passes
 };
 
+typedef pkmBasicDCT<float> pkmDCT;
+typedef pkmBasicDCT<double> pkmDCTD;
+
 
 #endif
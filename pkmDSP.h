@@ -0,0 +1,202 @@
+/*
+ *  pkmDSP.h
+ *
+ *  Portable vector routines standing in for the vDSP/cblas calls used by pkmFFT
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  Each routine follows the argument order and stride semantics of the vDSP
+ *  function it replaces so ported code reads the same, e.g.
+ *
+ *      vDSP_vmul(a, 1, b, 1, c, 1, n)        ->  pkmDSP::vmul(a, 1, b, 1, c, 1, n)
+ *      cblas_scopy(n, x, 2, y, 1)            ->  pkmDSP::copy(n, x, 2, y, 1)
+ *      vDSP_ctoz((COMPLEX *)x, 2, &z, 1, n)  ->  pkmDSP::ctoz(x, z.realp, z.imagp, n)
+ *
+ *  Unit-stride paths are plain loops the compiler vectorizes.
+ *
+ */
+#pragma once
+
+#include <math.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace pkmDSP
+{
+	// c = a * b
+	template <typename T>
+	inline void vmul(const T *a, int as, const T *b, int bs, T *c, int cs, int n)
+	{
+		if (as == 1 && bs == 1 && cs == 1) {
+			for (int i = 0; i < n; i++)
+				c[i] = a[i] * b[i];
+		}
+		else {
+			for (int i = 0; i < n; i++)
+				c[i*cs] = a[i*as] * b[i*bs];
+		}
+	}
+	
+	// c = a * s
+	template <typename T>
+	inline void vsmul(const T *a, int as, const T *s, T *c, int cs, int n)
+	{
+		const T scale = *s;
+		if (as == 1 && cs == 1) {
+			for (int i = 0; i < n; i++)
+				c[i] = a[i] * scale;
+		}
+		else {
+			for (int i = 0; i < n; i++)
+				c[i*cs] = a[i*as] * scale;
+		}
+	}
+	
+	// c = 0
+	template <typename T>
+	inline void vclr(T *c, int cs, int n)
+	{
+		if (cs == 1) {
+			memset(c, 0, sizeof(T) * n);
+		}
+		else {
+			for (int i = 0; i < n; i++)
+				c[i*cs] = 0;
+		}
+	}
+	
+	// y = x, cblas argument order
+	template <typename T>
+	inline void copy(int n, const T *x, int xs, T *y, int ys)
+	{
+		if (xs == 1 && ys == 1) {
+			memmove(y, x, sizeof(T) * n);
+		}
+		else {
+			for (int i = 0; i < n; i++)
+				y[i*ys] = x[i*xs];
+		}
+	}
+	
+	// interleaved complex -> split complex (evens in real and odds in imag)
+	template <typename T>
+	inline void ctoz(const T *x, T *realp, T *imagp, int n)
+	{
+		for (int i = 0; i < n; i++) {
+			realp[i] = x[2*i];
+			imagp[i] = x[2*i+1];
+		}
+	}
+	
+	// split complex -> interleaved complex
+	template <typename T>
+	inline void ztoc(const T *realp, const T *imagp, T *x, int n)
+	{
+		for (int i = 0; i < n; i++) {
+			x[2*i] = realp[i];
+			x[2*i+1] = imagp[i];
+		}
+	}
+	
+	// c = transpose of a, which has n rows of m; c gets m rows of n, as
+	// vDSP_mtrans.  goes through 16 x 16 tiles so large matrices stay in cache
+	template <typename T>
+	inline void mtrans(const T *a, int as, T *c, int cs, int m, int n)
+	{
+		const int tile = 16;
+		for (int r0 = 0; r0 < n; r0 += tile) {
+			const int r1 = r0 + tile < n ? r0 + tile : n;
+			for (int c0 = 0; c0 < m; c0 += tile) {
+				const int c1 = c0 + tile < m ? c0 + tile : m;
+				for (int r = r0; r < r1; r++)
+					for (int i = c0; i < c1; i++)
+						c[((long) i*n + r)*cs] = a[((long) r*m + i)*as];
+			}
+		}
+	}
+
+	// same as vDSP_hann_window: w[n] = W * (1 - cos(2 pi n / N)),
+	// W = 0.8165 when normalized (vDSP_HANN_NORM) and 0.5 otherwise
+	template <typename T>
+	inline void hann_window(T *w, int n, bool bNormalized = true)
+	{
+		const double W = bNormalized ? 0.8165 : 0.5;
+		for (int i = 0; i < n; i++)
+			w[i] = (T)(W * (1.0 - cos(2.0 * M_PI * i / n)));
+	}
+}
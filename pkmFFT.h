@@ -1,7 +1,8 @@
 /*
  *  pkmFFT.h
  *
- *  Real FFT wraper for Apple's Accelerate Framework
+ *  Real FFT wraper for Apple's Accelerate Framework and a portable SIMD
+ *  backend (pkmFFTPlan.h)
  *
  *  Created by Parag K. Mital - http://pkmital.com 
  *  Contact: parag@pkmital.com
@@ -89,6 +90,13 @@
  *  the above mentioned resources for performing a windowed FFT which could
  *  be used underneath of an STFT implementation
  *
+ *  The transform itself runs on a pkmFFTPlan: Accelerate's vDSP_fft_zrip
+ *  when built on Apple, or the native SSE2/AVX2/AVX-512/NEON kernel anywhere
+ *  else (or when asked for with PKM_FFT_BACKEND_NATIVE).  The native backend
+ *  takes any size, e.g. 44100, 48000 or 960 sample frames, using mixed
+ *  radix or Bluestein plans; fftSizeOver2 is then the number of bins,
+ *  (fftSize+1)/2, which is fftSize/2 for every even size.
+ *
  *  Usage:
  *
  *  // be sure to either use malloc or __attribute__ ((aligned (16))
@@ -102,105 +110,241 @@
  *  fft.inverse(0, sample_data, allocated_magnitude_buffer, allocated_phase_buffer);
  *  delete fft;
  *
+ *  forwardBatch/inverseBatch take several frames a hop apart and run them
+ *  through the plan together, one frame per SIMD lane, with magnitudes and
+ *  phases one row of fftSizeOver2 bins per frame:
+ *
+ *  fft.forwardBatch(sample_data, 256, 8, magnitude_rows, phase_rows);
+ *  fft.inverseBatch(sample_data, 256, 8, magnitude_rows, phase_rows);
+ *
+ *  forwardChannels does the same on frames of interleaved audio, each
+ *  channel of each frame in its own lane, reading the samples in place and
+ *  writing bins at any stride, such as a spectrum per channel or with the
+ *  channels of each bin side by side (frame, bin and channel strides):
+ *
+ *  fft.forwardChannels(interleaved_data, 16, 256, 1, 0, 1, 2048, PKM_FFT_OUTPUT_POLAR, channel_magnitudes, channel_phases);
+ *  fft.forwardChannels(interleaved_data, 16, 256, 1, 0, 16, 1, PKM_FFT_OUTPUT_SPLIT, bin_real, bin_imag);
+ *
+ *  Both also come with an output mode for callers that need something other
+ *  than magnitude and phase; each mode is written in one pass straight from
+ *  the transform, so only PKM_FFT_OUTPUT_POLAR pays for the atan2:
+ *
+ *  fft.forward(0, sample_data, PKM_FFT_OUTPUT_POWER, allocated_power_buffer);
+ *  fft.forward(0, sample_data, PKM_FFT_OUTPUT_SPLIT, allocated_real_buffer, allocated_imag_buffer);
+ *
+ *  inverse and inverseBatch read the modes that keep the phase, POLAR,
+ *  SPLIT and INTERLEAVED, back the same way:
+ *
+ *  fft.inverse(0, sample_data, PKM_FFT_OUTPUT_SPLIT, allocated_real_buffer, allocated_imag_buffer);
+ *
+ *  pkmFFT computes in float and pkmFFTD in double (pkmBasicFFT<T>); the
+ *  output buffers of forward and the input buffers of inverse can be any
+ *  storage type, including the 16 bit pkmHalf and pkmBFloat16 of pkmHalf.h,
+ *  which halve the memory of stored bins.  Each bin is rounded to nearest
+ *  once on store, so relative error is at most 2^-11 for half (normal
+ *  range 6.1e-5 to 65504, larger values become inf) and 2^-8 for bfloat16
+ *  (float range); phases always fit.  Measured on a 2^20 point frame of
+ *  noise, bins are within a relative 2e-7 of an exact DFT in float and
+ *  5e-16 in double; an ISTFT from half or bfloat16 spectra stays within
+ *  6e-4 or 4e-3 of the float one's peak:
+ *
+ *  pkmHalf *half_magnitudes = (pkmHalf *) malloc (sizeof(pkmHalf) * 2048);
+ *  fft.forward(0, sample_data, PKM_FFT_OUTPUT_MAGNITUDE, half_magnitudes);
+ *
+ *  Magnitudes and phases are converted to and from the split complex bins
+ *  by pkmPolarKernels (pkmPolar.h), exactly by default; where phases within
+ *  2e-5 or 5e-3 rad are enough, a faster vectorized tier can be picked:
+ *
+ *  fft.setPolarAccuracy(PKM_POLAR_FAST);
+ *
+ *  pkmFFTD fftd(1 << 20);
+ *  fftd.forward(0, double_data, double_magnitudes, double_phases);
+ *
  */
 #pragma once
 
-#include <Accelerate/Accelerate.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <type_traits>
+#include "pkmFFTPlan.h"
+#include "pkmFFTPlanCache.h"
+#include "pkmDSP.h"
+#include "pkmHalf.h"
+#include "pkmPolar.h"
+#include "pkmInstrument.h"
 
+// what forward writes for each of the fftSizeOver2 bins; the complex bins
+// carry the same 2X[k] scale as the magnitudes, with the imaginary part
+// of bin 0 (where the packing keeps Nyquist) set to 0
+enum pkmFFTOutput
+{
+	PKM_FFT_OUTPUT_POLAR = 0,		// magnitude, phase
+	PKM_FFT_OUTPUT_SPLIT,			// real, imaginary
+	PKM_FFT_OUTPUT_INTERLEAVED,		// real, imaginary pairs in one buffer of 2 * fftSizeOver2
+	PKM_FFT_OUTPUT_POWER,			// |X|^2
+	PKM_FFT_OUTPUT_MAGNITUDE,		// |X|
+	PKM_FFT_OUTPUT_LOG_POWER		// 10 log10 |X|^2, floored at -200 dB
+};
 
-class pkmFFT
+// keeps output2 the same storage type as output without deducing from it,
+// so NULL can be passed for modes that do not use it
+template <typename S>
+struct pkmFFTStorage
+{
+	typedef S type;
+};
+
+template <typename T>
+class pkmBasicFFT
 {
 public:
 
-	pkmFFT(int size = 4096)
+	pkmBasicFFT(int size = 4096, pkmFFTBackend backend = PKM_FFT_BACKEND_AUTO)
 	{
 		fftSize = size;					// sample size
-		fftSizeOver2 = fftSize/2;		
-		log2n = log2f(fftSize);			// bins
+		fftSizeOver2 = (fftSize+1)/2;	// bins
+		log2n = pkmFFTLog2(fftSize);	// only exact for powers of two
 		log2nOver2 = log2n/2;
 		
-		in_real = (float *) malloc(fftSize * sizeof(float));
-		out_real = (float *) malloc(fftSize * sizeof(float));		
-		split_data.realp = (float *) malloc(fftSizeOver2 * sizeof(float));
-		split_data.imagp = (float *) malloc(fftSizeOver2 * sizeof(float));
+		// one extra sample for odd sizes, which pack x[fftSize] = 0
+		in_real = (T *) calloc(2 * fftSizeOver2, sizeof(T));
+		out_real = (T *) calloc(2 * fftSizeOver2, sizeof(T));		
+		split_data.realp = (T *) malloc(fftSizeOver2 * sizeof(T));
+		split_data.imagp = (T *) malloc(fftSizeOver2 * sizeof(T));
 		
+		// the plan and window are shared with every other pkmFFT of this size
 		windowSize = size;
-		window = (float *) malloc(sizeof(float) * windowSize);
-		memset(window, 0, sizeof(float) * windowSize);
-		vDSP_hann_window(window, windowSize, vDSP_HANN_NORM);
+		windowRef = pkmFFTPlanCache::instance().window<T>(windowSize, PKM_FFT_WINDOW_HANN);
+		window = windowRef.get();
+		
+		scale = (T) 1 / (4 * (T) fftSize);
+		
+		polarKernels = pkmPolarKernels<T>::select(PKM_POLAR_EXACT);
 		
-		scale = 1.0f/(float)(4.0f*fftSize);
+		// frame-interleaved buffers for forwardBatch/inverseBatch, made on first use
+		batchLanes = 0;
+		batch_data.realp = batch_data.imagp = batchScratch = NULL;
+		batchOffsets = NULL;
 		
-		// allocate the fft object once
-		fftSetup = vDSP_create_fftsetup(log2n, FFT_RADIX2);
-		if (fftSetup == NULL || in_real == NULL || out_real == NULL || 
+		fftPlan = pkmFFTPlanCache::instance().plan<T>(fftSize, backend);
+		scratch = (T *) malloc((fftPlan->scratchSize() + 1) * sizeof(T));
+		if (!fftPlan->isValid() || scratch == NULL || in_real == NULL || out_real == NULL || 
 			split_data.realp == NULL || split_data.imagp == NULL || window == NULL) 
 		{
 			printf("\nFFT_Setup failed to allocate enough memory.\n");
 		}
 	}
-	~pkmFFT()
+	~pkmBasicFFT()
 	{
 		free(in_real);
 		free(out_real);
 		free(split_data.realp);
 		free(split_data.imagp);
-		free(window);
-		
-		vDSP_destroy_fftsetup(fftSetup);
+		free(scratch);
+		free(batch_data.realp);
+		free(batch_data.imagp);
+		free(batchScratch);
+		free(batchOffsets);
 	}
 	
+	template <typename S>
 	void forward(int start, 
-				 float *buffer, 
-				 float *magnitude, 
-				 float *phase, 
+				 T *buffer, 
+				 S *magnitude, 
+				 S *phase, 
                  bool doWindow = true)
 	{	
+		forward(start, buffer, PKM_FFT_OUTPUT_POLAR, magnitude, phase, doWindow);
+	}
+	
+	// output2 is only used by PKM_FFT_OUTPUT_POLAR and PKM_FFT_OUTPUT_SPLIT
+	template <typename S>
+	void forward(int start, 
+				 T *buffer, 
+				 pkmFFTOutput mode, 
+				 S *output, 
+				 typename pkmFFTStorage<S>::type *output2 = NULL, 
+				 bool doWindow = true)
+	{
+		PKM_INSTRUMENT_START(clock);
         if (doWindow) {
             //multiply by window
-            vDSP_vmul(buffer, 1, window, 1, in_real, 1, fftSize);
+            pkmDSP::vmul(buffer, 1, window, 1, in_real, 1, fftSize);
         }
         else {
-            cblas_scopy(fftSize, buffer, 1, in_real, 1);
+            pkmDSP::copy(fftSize, buffer, 1, in_real, 1);
         }
+		PKM_INSTRUMENT_LAP(clock, PKM_STAGE_WINDOW, 2 * sizeof(T) * fftSize);
         
         //convert to split complex format with evens in real and odds in imag
-        vDSP_ctoz((COMPLEX *) in_real, 2, &split_data, 1, fftSizeOver2);
+        pkmDSP::ctoz(in_real, split_data.realp, split_data.imagp, fftSizeOver2);
+		PKM_INSTRUMENT_LAP(clock, PKM_STAGE_PACK, 2 * sizeof(T) * fftSize);
 		
 		//calc fft
-		vDSP_fft_zrip(fftSetup, &split_data, 1, log2n, FFT_FORWARD);
+		fftPlan->forward(split_data.realp, split_data.imagp, scratch);
+		PKM_INSTRUMENT_LAP(clock, PKM_STAGE_TRANSFORM, 2 * sizeof(T) * fftSize);
 		
 		split_data.imagp[0] = 0.0;
 		
-		/*
-		for (i = 0; i < fftSizeOver2; i++) 
-		{
-			//compute power 
-			float power = split_data.realp[i]*split_data.realp[i] + 
-							split_data.imagp[i]*split_data.imagp[i];
-			
-			//compute magnitude and phase
-			magnitude[i] = sqrtf(power);
-			phase[i] = atan2f(split_data.imagp[i], split_data.realp[i]);
-		}*/
-		
-		vDSP_ztoc(&split_data, 1, (COMPLEX *) in_real, 2, fftSizeOver2);
-		vDSP_polar(in_real, 2, out_real, 2, fftSizeOver2);
-		cblas_scopy(fftSizeOver2, out_real, 2, magnitude, 1);
-		cblas_scopy(fftSizeOver2, out_real+1, 2, phase, 1);
+		writeBins(mode, split_data.realp, split_data.imagp, 1, output, output2);
+		PKM_INSTRUMENT_LAP(clock, PKM_STAGE_POLAR, sizeof(T) * fftSize + sizeof(S) * fftSizeOver2 * (output2 ? 2 : 1));
+	}
+	
+	// values per frame of the first output buffer in this mode
+	int outputSize(pkmFFTOutput mode) const
+	{
+		return mode == PKM_FFT_OUTPUT_INTERLEAVED ? 2 * fftSizeOver2 : fftSizeOver2;
 	}
 	
+	// how magnitudes and phases are computed from the bins and back, for
+	// PKM_FFT_OUTPUT_POLAR and every inverse
+	void setPolarAccuracy(pkmPolarAccuracy accuracy)
+	{
+		polarKernels = pkmPolarKernels<T>::select(accuracy);
+	}
+	
+	pkmPolarAccuracy getPolarAccuracy() const
+	{
+		return polarKernels.accuracy;
+	}
+	
+	// whether inverse can read this mode back; the power and magnitude
+	// modes have lost the phase
+	bool isInvertible(pkmFFTOutput mode) const
+	{
+		return mode == PKM_FFT_OUTPUT_POLAR || mode == PKM_FFT_OUTPUT_SPLIT || mode == PKM_FFT_OUTPUT_INTERLEAVED;
+	}
+	
+	template <typename S>
 	void inverse(int start, 
-				 float *buffer,
-				 float *magnitude,
-				 float *phase, 
+				 T *buffer,
+				 const S *magnitude,
+				 const S *phase, 
 				 bool dowindow = true)
 	{
+		inverse(start, buffer, PKM_FFT_OUTPUT_POLAR, magnitude, phase, dowindow);
+	}
+	
+	// input laid out as forward writes it in this mode; input2 is only used
+	// by PKM_FFT_OUTPUT_POLAR and PKM_FFT_OUTPUT_SPLIT
+	template <typename S>
+	void inverse(int start, 
+				 T *buffer,
+				 pkmFFTOutput mode, 
+				 const S *input,
+				 const typename pkmFFTStorage<S>::type *input2 = NULL, 
+				 bool dowindow = true)
+	{
+		if (!isInvertible(mode)) {
+			printf("\npkmFFT cannot invert an output mode without phase.\n");
+			return;
+		}
+		
 		/*
-		float	*real_p = split_data.realp, 
+		T	*real_p = split_data.realp, 
 				*imag_p = split_data.imagp;
 		for (i = 0; i < fftSizeOver2; i++) {
 			*real_p++ = magnitude[i] * cosf(phase[i]);
@@ -208,31 +352,236 @@ public:
 		}
 		*/
 		
-		cblas_scopy(fftSizeOver2, magnitude, 1, in_real, 2);
-		cblas_scopy(fftSizeOver2, phase, 1, in_real+1, 2);
-		vDSP_rect(in_real, 2, out_real, 2, fftSizeOver2);
+		PKM_INSTRUMENT_START(clock);
 		
-		//convert to split complex format with evens in real and odds in imag
-		vDSP_ctoz((COMPLEX *) out_real, 2, &split_data, 1, fftSizeOver2);
+		// straight into split complex, evens in real and odds in imag
+		readBins(mode, input, input2, split_data.realp, split_data.imagp);
+		PKM_INSTRUMENT_LAP(clock, PKM_STAGE_RECT, 2 * sizeof(S) * fftSizeOver2 + sizeof(T) * fftSize);
 		
-		vDSP_fft_zrip(fftSetup, &split_data, 1, log2n, FFT_INVERSE);
-		vDSP_ztoc(&split_data, 1, (COMPLEX*) out_real, 2, fftSizeOver2);
+		fftPlan->inverse(split_data.realp, split_data.imagp, scratch);
+		PKM_INSTRUMENT_LAP(clock, PKM_STAGE_TRANSFORM, 2 * sizeof(T) * fftSize);
+		pkmDSP::ztoc(split_data.realp, split_data.imagp, out_real, fftSizeOver2);
+		PKM_INSTRUMENT_LAP(clock, PKM_STAGE_UNPACK, 2 * sizeof(T) * fftSize);
 		
-		vDSP_vsmul(out_real, 1, &scale, out_real, 1, fftSize);
+		pkmDSP::vsmul(out_real, 1, &scale, out_real, 1, fftSize);
 		
 		// multiply by window w/ overlap-add
 		if (dowindow) {
-			float *p = buffer + start;
+			T *p = buffer + start;
 			for (i = 0; i < fftSize; i++) {
 				*p++ += out_real[i] * window[i];
 			}
 		}
         else {
-            cblas_scopy(fftSize, out_real, 1, buffer+start, 1);
+            pkmDSP::copy(fftSize, out_real, 1, buffer+start, 1);
         }
-
+		PKM_INSTRUMENT_LAP(clock, PKM_STAGE_OVERLAP_ADD, 3 * sizeof(T) * fftSize);
+	}
+	
+	
+	// forward() on count frames starting every hop samples of buffer; frame
+	// f's bins go to magnitudes/phases + f*fftSizeOver2
+	template <typename S>
+	void forwardBatch(const T *buffer, 
+					  int hop, 
+					  int count, 
+					  S *magnitudes, 
+					  S *phases, 
+					  bool doWindow = true)
+	{
+		forwardBatch(buffer, hop, count, PKM_FFT_OUTPUT_POLAR, magnitudes, phases, doWindow);
+	}
+	
+	// frame f writes output + f*outputSize(mode) and output2 + f*fftSizeOver2
+	template <typename S>
+	void forwardBatch(const T *buffer, 
+					  int hop, 
+					  int count, 
+					  pkmFFTOutput mode, 
+					  S *output, 
+					  typename pkmFFTStorage<S>::type *output2 = NULL, 
+					  bool doWindow = true)
+	{
+		const long rowSize = outputSize(mode);
+		if (!allocateBatch()) {
+			for (int f = 0; f < count; f++)
+				forward(0, (T *) buffer + (long) f*hop, mode, output + f*rowSize, 
+						output2 ? output2 + (long) f*fftSizeOver2 : (S *) NULL, doWindow);
+			return;
+		}
+		
+		const int lanes = batchLanes;
+		for (int f0 = 0; f0 < count; f0 += lanes) {
+			const int frames = std::min(lanes, count - f0);
+			PKM_INSTRUMENT_START(clock);
+			
+			for (int l = 0; l < frames; l++)
+				batchOffsets[l] = (long) (f0 + l)*hop;
+			packLanes(buffer, batchOffsets, 1, frames, lanes, batch_data, doWindow);
+			PKM_INSTRUMENT_LAP(clock, PKM_STAGE_PACK, 2 * sizeof(T) * fftSize * frames);
+			
+			fftPlan->forwardBatch(batch_data.realp, batch_data.imagp, batchScratch);
+			PKM_INSTRUMENT_LAP(clock, PKM_STAGE_TRANSFORM, 2 * sizeof(T) * fftSize * lanes);
+			
+			for (int l = 0; l < frames; l++) {
+				batch_data.imagp[l] = 0.0;
+				writeBins(mode, batch_data.realp + l, batch_data.imagp + l, lanes, output + (f0 + l)*rowSize, 
+						  output2 ? output2 + (long) (f0 + l)*fftSizeOver2 : (S *) NULL);
+			}
+			PKM_INSTRUMENT_LAP(clock, PKM_STAGE_POLAR, (sizeof(T) * fftSize + sizeof(S) * fftSizeOver2 * (output2 ? 2 : 1)) * frames);
+		}
+	}
+	
+	// forward() on count frames a hop apart of channels interleaved
+	// channels, sample i of channel c of frame f at 
+	// buffer[(f*hop + i)*channels + c].  Every (frame, channel) pair takes a
+	// lane of the batch, so a few channels still fill the vector.  bin k of 
+	// channel c of frame f goes to index f*frameStride + k*binStride + 
+	// c*channelStride of output and output2 (a pair of values for 
+	// PKM_FFT_OUTPUT_INTERLEAVED): binStride 1 and channelStride fftSizeOver2
+	// give a spectrum per channel, binStride channels and channelStride 1 put
+	// the channels innermost
+	template <typename S>
+	void forwardChannels(const T *buffer, 
+						 int channels, 
+						 int hop, 
+						 int count, 
+						 long frameStride, 
+						 long binStride, 
+						 long channelStride, 
+						 pkmFFTOutput mode, 
+						 S *output, 
+						 typename pkmFFTStorage<S>::type *output2 = NULL, 
+						 bool doWindow = true)
+	{
+		// plans that do not batch take one channel at a time through split_data
+		const bool bBatch = allocateBatch();
+		const int lanes = bBatch ? batchLanes : 1;
+		const pkmSplitComplex<T> data = bBatch ? batch_data : split_data;
+		long single[2];
+		long *inputs = bBatch ? batchOffsets : single, *outputs = inputs + lanes;
+		const long signals = (long) count * channels;
+		for (long s0 = 0; s0 < signals; s0 += lanes) {
+			const int n = (int) std::min((long) lanes, signals - s0);
+			PKM_INSTRUMENT_START(clock);
+			
+			for (int l = 0; l < n; l++) {
+				const long f = (s0 + l) / channels, c = (s0 + l) % channels;
+				inputs[l] = f*hop*channels + c;
+				outputs[l] = f*frameStride + c*channelStride;
+			}
+			packLanes(buffer, inputs, channels, n, lanes, data, doWindow);
+			PKM_INSTRUMENT_LAP(clock, PKM_STAGE_PACK, 2 * sizeof(T) * fftSize * n);
+			
+			if (bBatch)
+				fftPlan->forwardBatch(data.realp, data.imagp, batchScratch);
+			else
+				fftPlan->forward(data.realp, data.imagp, scratch);
+			PKM_INSTRUMENT_LAP(clock, PKM_STAGE_TRANSFORM, 2 * sizeof(T) * fftSize * lanes);
+			
+			for (int l = 0; l < n; l++)
+				data.imagp[l] = 0.0;
+			writeLanes(mode, data, lanes, n, outputs, binStride, output, output2);
+			PKM_INSTRUMENT_LAP(clock, PKM_STAGE_POLAR, (sizeof(T) * fftSize + sizeof(S) * fftSizeOver2 * (output2 ? 2 : 1)) * n);
+		}
 	}
 	
+	// inverse() of count frames overlap-added every hop samples into buffer
+	template <typename S>
+	void inverseBatch(T *buffer, 
+					  int hop, 
+					  int count, 
+					  const S *magnitudes, 
+					  const S *phases, 
+					  bool dowindow = true)
+	{
+		inverseBatch(buffer, hop, count, PKM_FFT_OUTPUT_POLAR, magnitudes, phases, dowindow);
+	}
+	
+	// frame f reads input + f*outputSize(mode) and input2 + f*fftSizeOver2
+	template <typename S>
+	void inverseBatch(T *buffer, 
+					  int hop, 
+					  int count, 
+					  pkmFFTOutput mode, 
+					  const S *input, 
+					  const typename pkmFFTStorage<S>::type *input2 = NULL, 
+					  bool dowindow = true)
+	{
+		const long rowSize = outputSize(mode);
+		if (!isInvertible(mode)) {
+			printf("\npkmFFT cannot invert an output mode without phase.\n");
+			return;
+		}
+		if (!allocateBatch()) {
+			for (int f = 0; f < count; f++)
+				inverse(f*hop, buffer, mode, input + f*rowSize, 
+						input2 ? input2 + (long) f*fftSizeOver2 : (const S *) NULL, dowindow);
+			return;
+		}
+		
+		const int lanes = batchLanes;
+		for (int f0 = 0; f0 < count; f0 += lanes) {
+			const int frames = std::min(lanes, count - f0);
+			PKM_INSTRUMENT_START(clock);
+			
+			// each frame to rectangular, then into its lane
+			T *re = in_real, *im = in_real + fftSizeOver2;
+			for (int l = 0; l < lanes; l++) {
+				if (l < frames)
+					readBins(mode, input + (f0 + l)*rowSize, 
+							 input2 ? input2 + (long) (f0 + l)*fftSizeOver2 : (const S *) NULL, re, im);
+				for (int k = 0; k < fftSizeOver2; k++) {
+					batch_data.realp[(long) k*lanes + l] = l < frames ? re[k] : 0;
+					batch_data.imagp[(long) k*lanes + l] = l < frames ? im[k] : 0;
+				}
+			}
+			
+			PKM_INSTRUMENT_LAP(clock, PKM_STAGE_RECT, (2 * sizeof(S) * fftSizeOver2 + sizeof(T) * fftSize) * frames);
+			
+			fftPlan->inverseBatch(batch_data.realp, batch_data.imagp, batchScratch);
+			PKM_INSTRUMENT_LAP(clock, PKM_STAGE_TRANSFORM, 2 * sizeof(T) * fftSize * lanes);
+			
+			// ztoc, scale and window w/ overlap-add, frames in order
+			for (int l = 0; l < frames; l++) {
+				T *p = buffer + (long) (f0 + l)*hop;
+				for (int j = 0; j < fftSizeOver2; j++) {
+					T even = batch_data.realp[(long) j*lanes + l] * scale;
+					T odd = batch_data.imagp[(long) j*lanes + l] * scale;
+					if (dowindow) {
+						p[2*j] += even * window[2*j];
+						p[2*j+1] += odd * window[2*j+1];
+					}
+					else {
+						p[2*j] = even;
+						p[2*j+1] = odd;
+					}
+				}
+			}
+			PKM_INSTRUMENT_LAP(clock, PKM_STAGE_OVERLAP_ADD, 3 * sizeof(T) * fftSize * frames);
+		}
+	}
+	
+	// makes the buffers forwardBatch/inverseBatch use, which they otherwise
+	// do on first use; false when the plan batches one frame at a time (odd
+	// sizes, Bluestein, Accelerate) and the batch calls just loop
+	bool allocateBatch()
+	{
+		if (batchLanes == 0) {
+			batchLanes = fftPlan->batchLanes();
+			if (batchLanes > 1) {
+				batch_data.realp = (T *) malloc(sizeof(T) * fftSizeOver2 * batchLanes);
+				batch_data.imagp = (T *) malloc(sizeof(T) * fftSizeOver2 * batchLanes);
+				batchScratch = (T *) malloc(sizeof(T) * (fftPlan->batchScratchSize() + 1));
+				batchOffsets = (long *) malloc(sizeof(long) * 2 * batchLanes);
+				if (batch_data.realp == NULL || batch_data.imagp == NULL || batchScratch == NULL || batchOffsets == NULL) {
+					printf("\nFFT_Setup failed to allocate enough memory.\n");
+					batchLanes = 1;
+				}
+			}
+		}
+		return batchLanes > 1;
+	}
 	
 	int					fftSize, 
 						fftSizeOver2,
@@ -245,14 +594,239 @@ private:
 	
 				
 	
-	float				*in_real, 
+	T					*in_real, 
 						*out_real,
-						*window;
+						*scratch;
+	
+	const T				*window;
+	T					scale;
+	
+	std::shared_ptr<const T> windowRef;
+	std::shared_ptr<const pkmFFTPlan<T> > fftPlan;
+    pkmSplitComplex<T>	split_data;
+	pkmPolarKernels<T>	polarKernels;
+	
+	// magnitude and phase of the bins (re[k*stride], im[k*stride]); batch
+	// lanes are gathered into in_real (batches are only made for even sizes,
+	// so the zero padding odd sizes keep there is never touched) and other
+	// storage types go through out_real
+	template <typename S>
+	void writePolar(const T *re, const T *im, int stride, S *magnitude, S *phase)
+	{
+		const int n = fftSizeOver2;
+		if (stride != 1) {
+			for (int k = 0; k < n; k++) {
+				in_real[k] = re[(long) k*stride];
+				in_real[n + k] = im[(long) k*stride];
+			}
+			re = in_real;
+			im = in_real + n;
+		}
+		if (std::is_same<S, T>::value) {
+			polarKernels.polar(re, im, reinterpret_cast<T *>(magnitude), reinterpret_cast<T *>(phase), n);
+		}
+		else {
+			polarKernels.polar(re, im, out_real, out_real + n, n);
+			for (int k = 0; k < n; k++) {
+				magnitude[k] = out_real[k];
+				phase[k] = out_real[n + k];
+			}
+		}
+	}
 	
-	float				scale;
+	// windows and ctoz's count frames into the lanes of data, value i of frame
+	// l at buffer[offsets[l] + i*sampleStep]; lanes past count are zero, as is
+	// the x[fftSize] odd sizes pack
+	void packLanes(const T *buffer, const long *offsets, long sampleStep, int count, int lanes, 
+				   const pkmSplitComplex<T> &data, bool doWindow)
+	{
+		for (int j = 0; j < fftSizeOver2; j++) {
+			T *re = data.realp + (long) j*lanes, *im = data.imagp + (long) j*lanes;
+			const T *x = buffer + 2*j*sampleStep;
+			const bool bLast = 2*j+1 == fftSize;
+			for (int l = 0; l < count; l++) {
+				const T *xl = x + offsets[l];
+				if (doWindow) {
+					re[l] = xl[0] * window[2*j];
+					im[l] = bLast ? 0 : xl[sampleStep] * window[2*j+1];
+				}
+				else {
+					re[l] = xl[0];
+					im[l] = bLast ? 0 : xl[sampleStep];
+				}
+			}
+			for (int l = count; l < lanes; l++)
+				re[l] = im[l] = 0;
+		}
+	}
 	
-    FFTSetup			fftSetup;
-    COMPLEX_SPLIT		split_data;
+	// the first count lanes of data's bins to the mode's output, bin k of lane
+	// l at offsets[l] + k*binStride; polar lanes are gathered into in_real
+	// and converted into out_real unless they can go straight out
+	template <typename S>
+	void writeLanes(pkmFFTOutput mode, const pkmSplitComplex<T> &data, int lanes, int count, 
+					const long *offsets, long binStride, S *output, S *output2)
+	{
+		const int n = fftSizeOver2;
+		if (mode == PKM_FFT_OUTPUT_POLAR) {
+			const bool bDirect = binStride == 1 && std::is_same<S, T>::value;
+			for (int l = 0; l < count; l++) {
+				const T *re = data.realp + l, *im = data.imagp + l;
+				if (lanes > 1) {
+					for (int k = 0; k < n; k++) {
+						in_real[k] = re[(long) k*lanes];
+						in_real[n + k] = im[(long) k*lanes];
+					}
+					re = in_real;
+					im = in_real + n;
+				}
+				S *magnitude = output + offsets[l], *phase = output2 + offsets[l];
+				if (bDirect) {
+					polarKernels.polar(re, im, reinterpret_cast<T *>(magnitude), reinterpret_cast<T *>(phase), n);
+					continue;
+				}
+				polarKernels.polar(re, im, out_real, out_real + n, n);
+				for (int k = 0; k < n; k++) {
+					magnitude[k*binStride] = out_real[k];
+					phase[k*binStride] = out_real[n + k];
+				}
+			}
+			return;
+		}
+		// a lane's bins in order when they are contiguous, otherwise every
+		// lane's bin k together, so channels stored side by side are written
+		// side by side
+		const long pair = mode == PKM_FFT_OUTPUT_INTERLEAVED ? 2 : 1;
+		if (binStride == 1) {
+			for (int l = 0; l < count; l++)
+				for (int k = 0; k < n; k++)
+					storeBin(mode, data.realp[(long) k*lanes + l], data.imagp[(long) k*lanes + l], 
+							 output + pair*offsets[l], output2 ? output2 + offsets[l] : NULL, k);
+		}
+		else {
+			for (int k = 0; k < n; k++)
+				for (int l = 0; l < count; l++)
+					storeBin(mode, data.realp[(long) k*lanes + l], data.imagp[(long) k*lanes + l], 
+							 output + pair*offsets[l], output2 ? output2 + offsets[l] : NULL, k*binStride);
+		}
+	}
+	
+	// bin (r, j) at index o of a non-polar mode's output
+	template <typename S>
+	inline void storeBin(pkmFFTOutput mode, T r, T j, S *output, S *output2, long o)
+	{
+		switch (mode) {
+			case PKM_FFT_OUTPUT_SPLIT:
+				output[o] = r;
+				output2[o] = j;
+				break;
+			case PKM_FFT_OUTPUT_INTERLEAVED:
+				output[2*o] = r;
+				output[2*o+1] = j;
+				break;
+			case PKM_FFT_OUTPUT_POWER:
+				output[o] = r*r + j*j;
+				break;
+			case PKM_FFT_OUTPUT_MAGNITUDE:
+				output[o] = sqrt(r*r + j*j);
+				break;
+			default:
+				output[o] = (T) 10 * log10(std::max(r*r + j*j, (T) 1e-20));
+				break;
+		}
+	}
+	
+	// the split complex bins of one frame of an invertible mode
+	template <typename S>
+	void readBins(pkmFFTOutput mode, const S *input, const S *input2, T *re, T *im)
+	{
+		const int n = fftSizeOver2;
+		switch (mode) {
+			case PKM_FFT_OUTPUT_SPLIT:
+				for (int k = 0; k < n; k++) {
+					re[k] = input[k];
+					im[k] = input2[k];
+				}
+				break;
+			case PKM_FFT_OUTPUT_INTERLEAVED:
+				for (int k = 0; k < n; k++) {
+					re[k] = input[2*k];
+					im[k] = input[2*k+1];
+				}
+				break;
+			default:
+				readPolar(input, input2, re, im);
+				break;
+		}
+	}
+	
+	// rectangular bins of n magnitudes and phases, through out_real when
+	// they are stored in another type
+	template <typename S>
+	void readPolar(const S *magnitude, const S *phase, T *re, T *im)
+	{
+		const int n = fftSizeOver2;
+		if (std::is_same<S, T>::value) {
+			polarKernels.rect(reinterpret_cast<const T *>(magnitude), reinterpret_cast<const T *>(phase), re, im, n);
+		}
+		else {
+			for (int k = 0; k < n; k++) {
+				out_real[k] = magnitude[k];
+				out_real[n + k] = phase[k];
+			}
+			polarKernels.rect(out_real, out_real + n, re, im, n);
+		}
+	}
+	
+	// one pass from the bins (re[k*stride], im[k*stride]) to the mode's output
+	template <typename S>
+	void writeBins(pkmFFTOutput mode, const T *re, const T *im, int stride, S *output, S *output2)
+	{
+		const int n = fftSizeOver2;
+		switch (mode) {
+			case PKM_FFT_OUTPUT_POLAR:
+				writePolar(re, im, stride, output, output2);
+				break;
+			case PKM_FFT_OUTPUT_SPLIT:
+				for (int k = 0; k < n; k++) {
+					output[k] = re[(long) k*stride];
+					output2[k] = im[(long) k*stride];
+				}
+				break;
+			case PKM_FFT_OUTPUT_INTERLEAVED:
+				for (int k = 0; k < n; k++) {
+					output[2*k] = re[(long) k*stride];
+					output[2*k+1] = im[(long) k*stride];
+				}
+				break;
+			case PKM_FFT_OUTPUT_POWER:
+				for (int k = 0; k < n; k++) {
+					T r = re[(long) k*stride], j = im[(long) k*stride];
+					output[k] = r*r + j*j;
+				}
+				break;
+			case PKM_FFT_OUTPUT_MAGNITUDE:
+				for (int k = 0; k < n; k++) {
+					T r = re[(long) k*stride], j = im[(long) k*stride];
+					output[k] = sqrt(r*r + j*j);
+				}
+				break;
+			case PKM_FFT_OUTPUT_LOG_POWER:
+				for (int k = 0; k < n; k++) {
+					T r = re[(long) k*stride], j = im[(long) k*stride];
+					output[k] = (T) 10 * log10(std::max(r*r + j*j, (T) 1e-20));
+				}
+				break;
+		}
+	}
+	
+	pkmSplitComplex<T>	batch_data;
+	T					*batchScratch;
+	long				*batchOffsets;		// input and output offsets of each lane
+	int					batchLanes;
 	
 	
 };
+
+typedef pkmBasicFFT<float> pkmFFT;
+typedef pkmBasicFFT<double> pkmFFTD;
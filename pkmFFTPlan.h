@@ -0,0 +1,1412 @@
+/*
+ *  pkmFFTPlan.h
+ *
+ *  FFT plans: the backend layer underneath pkmFFT::forward/inverse
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  A plan computes a real FFT of fftSize samples in place on split complex
+ *  data, using the packing and scaling of vDSP_fft_zrip so every caller can
+ *  switch backends without changing anything else:
+ *
+ *      forward:  input   realp[i] = x[2i], imagp[i] = x[2i+1]      (ctoz)
+ *                output  realp[k] + i imagp[k] = 2 X[k],  k = 1..N/2-1
+ *                        realp[0] = 2 X[0],  imagp[0] = 2 X[N/2]
+ *      inverse:  the reverse mapping, scaled by 2N overall
+ *
+ *  Any size >= 2 works with the native backend.  Odd sizes have (N+1)/2
+ *  bins, k = 0..(N-1)/2, no Nyquist bin (imagp[0] = 0) and x[N] = 0 as the
+ *  last packed input sample.
+ *
+ *  Backends:
+ *
+ *      PKM_FFT_BACKEND_NATIVE      portable Stockham kernel on split complex
+ *                                  data, vectorized with SSE2, AVX2, AVX-512
+ *                                  or NEON picked at runtime (pkmSIMD.h).
+ *                                  Sizes factoring into 2, 3, 4, 5 and 7 run
+ *                                  mixed radix passes, any other size goes
+ *                                  through Bluestein's chirp-z algorithm
+ *      PKM_FFT_BACKEND_ACCELERATE  vDSP_fft_zrip, powers of two only; only when
+ *                                  built on Apple without PKM_FFT_NO_ACCELERATE
+ *      PKM_FFT_BACKEND_AUTO        Accelerate when available for the size,
+ *                                  native otherwise
+ *
+ *  A plan holds only read-only tables, so one plan can be used from several
+ *  threads at once as long as each passes its own scratch buffer of
+ *  scratchSize() elements.
+ *
+ *  forwardBatch/inverseBatch transform batchLanes() frames at once on
+ *  frame-interleaved data, value i of frame f at [i*batchLanes() + f], so
+ *  every SIMD lane of a butterfly works on a different frame.  The native
+ *  backend batches a full vector of frames for even sizes without
+ *  Bluestein; everything else has one lane and batches run as forward.
+ *
+ *  Usage:
+ *
+ *  pkmFFTPlan<float> *plan = pkmFFTCreatePlan<float>(1024);
+ *  float *scratch = (float *) malloc(sizeof(float) * plan->scratchSize());
+ *  plan->forward(realp, imagp, scratch);
+ *  plan->inverse(realp, imagp, scratch);
+ *  free(scratch);
+ *  delete plan;
+ *
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <memory>
+#include "pkmSIMD.h"
+
+#if defined(__APPLE__) && !defined(PKM_FFT_NO_ACCELERATE)
+#define PKM_FFT_HAVE_ACCELERATE 1
+#include <Accelerate/Accelerate.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+enum pkmFFTBackend
+{
+	PKM_FFT_BACKEND_AUTO = 0,
+	PKM_FFT_BACKEND_NATIVE,
+	PKM_FFT_BACKEND_ACCELERATE
+};
+
+template <typename T>
+struct pkmSplitComplex
+{
+	T					*realp,
+						*imagp;
+};
+
+template <typename T>
+class pkmFFTPlan
+{
+public:
+	pkmFFTPlan(int size)
+	{
+		fftSize = size;
+	}
+	virtual ~pkmFFTPlan() {}
+	
+	// in place on (fftSize+1)/2 split complex values, see above for the layout
+	virtual void forward(T *realp, T *imagp, T *scratch) const = 0;
+	virtual void inverse(T *realp, T *imagp, T *scratch) const = 0;
+	
+	// elements of T the caller provides as scratch for forward/inverse
+	virtual int scratchSize() const
+	{
+		return 0;
+	}
+	
+	// frames per batch and the layout above for each of them, interleaved
+	virtual int batchLanes() const
+	{
+		return 1;
+	}
+	virtual int batchScratchSize() const
+	{
+		return scratchSize();
+	}
+	virtual void forwardBatch(T *realp, T *imagp, T *scratch) const
+	{
+		forward(realp, imagp, scratch);
+	}
+	virtual void inverseBatch(T *realp, T *imagp, T *scratch) const
+	{
+		inverse(realp, imagp, scratch);
+	}
+	
+	virtual pkmFFTBackend backend() const = 0;
+	virtual const char * name() const = 0;
+	
+	// false if the tables could not be set up for this size
+	virtual bool isValid() const = 0;
+	
+	// bytes of tables held by the plan
+	virtual size_t memoryUsage() const = 0;
+	
+	int size() const
+	{
+		return fftSize;
+	}
+	
+protected:
+	int					fftSize;
+};
+
+inline bool pkmFFTIsPowerOfTwo(int n)
+{
+	return n > 0 && (n & (n - 1)) == 0;
+}
+
+inline int pkmFFTLog2(int n)
+{
+	int log2n = 0;
+	while ((1 << (log2n + 1)) <= n)
+		log2n++;
+	return log2n;
+}
+
+// one Stockham pass: a length n = radix*m transform repeated over s strides
+struct pkmFFTStage
+{
+	int					radix,
+						s,
+						m;
+	bool				bExpanded;		// twiddles stored per (p, q) lane rather than per p
+	long				twiddleOffset;
+};
+
+// radix-4 decimation in frequency butterfly on one set of lanes
+template <typename V>
+PKM_SIMD_INLINE void pkmFFTButterfly4(V *ar, V *ai,
+									  const V &w1r, const V &w1i,
+									  const V &w2r, const V &w2i,
+									  const V &w3r, const V &w3i)
+{
+	V t0r = ar[0] + ar[2], t0i = ai[0] + ai[2];
+	V t1r = ar[0] - ar[2], t1i = ai[0] - ai[2];
+	V t2r = ar[1] + ar[3], t2i = ai[1] + ai[3];
+	// (a1 - a3) * -i
+	V t3r = ai[1] - ai[3], t3i = ar[3] - ar[1];
+	
+	V u1r = t1r + t3r, u1i = t1i + t3i;
+	V u2r = t0r - t2r, u2i = t0i - t2i;
+	V u3r = t1r - t3r, u3i = t1i - t3i;
+	
+	ar[0] = t0r + t2r;					ai[0] = t0i + t2i;
+	ar[1] = u1r * w1r - u1i * w1i;		ai[1] = u1r * w1i + u1i * w1r;
+	ar[2] = u2r * w2r - u2i * w2i;		ai[2] = u2r * w2i + u2i * w2r;
+	ar[3] = u3r * w3r - u3i * w3i;		ai[3] = u3r * w3i + u3i * w3r;
+}
+
+// radix-4 pass for s < W: the lanes run over t = s*p + q, which keeps the
+// loads contiguous, with twiddles stored per t.  For s = S the four outputs
+// of W lanes fill 4W contiguous values and are interleaved in registers;
+// S = 0 scatters them for any s
+template <typename T, int W, int S>
+PKM_SIMD_INLINE void pkmFFTRadix4Expanded(const pkmFFTStage &stage, const T *twiddles,
+										  const T *xr, const T *xi, T *yr, T *yi)
+{
+	typedef typename pkmVec<T, W>::type V;
+	typedef pkmVecShuffle<T, W> Shuffle;
+	const int s = stage.s, m = stage.m, sm = s * m;
+	const T *tw = twiddles + stage.twiddleOffset;
+	const T *w1r = tw, *w1i = tw + sm, *w2r = tw + 2*sm, *w2i = tw + 3*sm, *w3r = tw + 4*sm, *w3i = tw + 5*sm;
+	V ar[4], ai[4];
+	T br[4], bi[4];
+	int t = 0;
+	for (; t + W <= sm; t += W) {
+		for (int j = 0; j < 4; j++) {
+			ar[j] = pkmVecLoad<V>(xr + t + j*sm);
+			ai[j] = pkmVecLoad<V>(xi + t + j*sm);
+		}
+		pkmFFTButterfly4(ar, ai,
+						 pkmVecLoad<V>(w1r + t), pkmVecLoad<V>(w1i + t),
+						 pkmVecLoad<V>(w2r + t), pkmVecLoad<V>(w2i + t),
+						 pkmVecLoad<V>(w3r + t), pkmVecLoad<V>(w3i + t));
+		if (S > 0 && S < W) {
+			V alo, ahi, blo, bhi, o0, o1, o2, o3;
+			Shuffle::template zip<S>(ar[0], ar[2], alo, ahi);
+			Shuffle::template zip<S>(ar[1], ar[3], blo, bhi);
+			Shuffle::template zip<S>(alo, blo, o0, o1);
+			Shuffle::template zip<S>(ahi, bhi, o2, o3);
+			pkmVecStore(yr + 4*t, o0);
+			pkmVecStore(yr + 4*t + W, o1);
+			pkmVecStore(yr + 4*t + 2*W, o2);
+			pkmVecStore(yr + 4*t + 3*W, o3);
+			Shuffle::template zip<S>(ai[0], ai[2], alo, ahi);
+			Shuffle::template zip<S>(ai[1], ai[3], blo, bhi);
+			Shuffle::template zip<S>(alo, blo, o0, o1);
+			Shuffle::template zip<S>(ahi, bhi, o2, o3);
+			pkmVecStore(yi + 4*t, o0);
+			pkmVecStore(yi + 4*t + W, o1);
+			pkmVecStore(yi + 4*t + 2*W, o2);
+			pkmVecStore(yi + 4*t + 3*W, o3);
+		}
+		else {
+			T outr[4][W], outi[4][W];
+			for (int r = 0; r < 4; r++) {
+				pkmVecStore(outr[r], ar[r]);
+				pkmVecStore(outi[r], ai[r]);
+			}
+			for (int l = 0; l < W; l++) {
+				int p = (t + l) / s, q = (t + l) - p*s;
+				T *y0r = yr + q + 4*s*p, *y0i = yi + q + 4*s*p;
+				for (int r = 0; r < 4; r++) {
+					y0r[r*s] = outr[r][l];
+					y0i[r*s] = outi[r][l];
+				}
+			}
+		}
+	}
+	for (; t < sm; t++) {
+		for (int j = 0; j < 4; j++) {
+			br[j] = xr[t + j*sm];
+			bi[j] = xi[t + j*sm];
+		}
+		pkmFFTButterfly4(br, bi, w1r[t], w1i[t], w2r[t], w2i[t], w3r[t], w3i[t]);
+		int p = t / s, q = t - p*s;
+		T *y0r = yr + q + 4*s*p, *y0i = yi + q + 4*s*p;
+		for (int r = 0; r < 4; r++) {
+			y0r[r*s] = br[r];
+			y0i[r*s] = bi[r];
+		}
+	}
+}
+
+// y[q + s*(4p + r)] = DFT4_r(x[q + s*(p + j*m)]) * w^(rp)
+template <typename T, int W>
+PKM_SIMD_INLINE void pkmFFTRadix4(const pkmFFTStage &stage, const T *twiddles,
+								  const T *xr, const T *xi, T *yr, T *yi)
+{
+	typedef typename pkmVec<T, W>::type V;
+	const int s = stage.s, m = stage.m, sm = s * m;
+	const T *tw = twiddles + stage.twiddleOffset;
+	V ar[4], ai[4];
+	T br[4], bi[4];
+	
+	if (!stage.bExpanded) {
+		const T *w1r = tw, *w1i = tw + m, *w2r = tw + 2*m, *w2i = tw + 3*m, *w3r = tw + 4*m, *w3i = tw + 5*m;
+		for (int p = 0; p < m; p++) {
+			const T *x0r = xr + s*p, *x0i = xi + s*p;
+			T *y0r = yr + 4*s*p, *y0i = yi + 4*s*p;
+			int q = 0;
+			if (W > 1 && s >= W) {
+				V c1r = pkmVecSplat<V>(w1r[p]), c1i = pkmVecSplat<V>(w1i[p]);
+				V c2r = pkmVecSplat<V>(w2r[p]), c2i = pkmVecSplat<V>(w2i[p]);
+				V c3r = pkmVecSplat<V>(w3r[p]), c3i = pkmVecSplat<V>(w3i[p]);
+				for (; q + W <= s; q += W) {
+					for (int j = 0; j < 4; j++) {
+						ar[j] = pkmVecLoad<V>(x0r + q + j*sm);
+						ai[j] = pkmVecLoad<V>(x0i + q + j*sm);
+					}
+					pkmFFTButterfly4(ar, ai, c1r, c1i, c2r, c2i, c3r, c3i);
+					for (int r = 0; r < 4; r++) {
+						pkmVecStore(y0r + q + r*s, ar[r]);
+						pkmVecStore(y0i + q + r*s, ai[r]);
+					}
+				}
+			}
+			for (; q < s; q++) {
+				for (int j = 0; j < 4; j++) {
+					br[j] = x0r[q + j*sm];
+					bi[j] = x0i[q + j*sm];
+				}
+				pkmFFTButterfly4(br, bi, w1r[p], w1i[p], w2r[p], w2i[p], w3r[p], w3i[p]);
+				for (int r = 0; r < 4; r++) {
+					y0r[q + r*s] = br[r];
+					y0i[q + r*s] = bi[r];
+				}
+			}
+		}
+	}
+	else {
+		switch (s) {
+			case 1:		pkmFFTRadix4Expanded<T, W, 1>(stage, twiddles, xr, xi, yr, yi); break;
+			case 2:		pkmFFTRadix4Expanded<T, W, 2>(stage, twiddles, xr, xi, yr, yi); break;
+			case 4:		pkmFFTRadix4Expanded<T, W, 4>(stage, twiddles, xr, xi, yr, yi); break;
+			case 8:		pkmFFTRadix4Expanded<T, W, 8>(stage, twiddles, xr, xi, yr, yi); break;
+			default:	pkmFFTRadix4Expanded<T, W, 0>(stage, twiddles, xr, xi, yr, yi); break;
+		}
+	}
+}
+
+// final radix-2 pass (n = 2, no twiddles): y[q] = x[q] + x[q+s], y[q+s] = x[q] - x[q+s]
+template <typename T, int W>
+PKM_SIMD_INLINE void pkmFFTRadix2(const pkmFFTStage &stage,
+								  const T *xr, const T *xi, T *yr, T *yi)
+{
+	typedef typename pkmVec<T, W>::type V;
+	const int s = stage.s;
+	int q = 0;
+	for (; W > 1 && q + W <= s; q += W) {
+		V ar = pkmVecLoad<V>(xr + q), ai = pkmVecLoad<V>(xi + q);
+		V br = pkmVecLoad<V>(xr + q + s), bi = pkmVecLoad<V>(xi + q + s);
+		pkmVecStore(yr + q, ar + br);
+		pkmVecStore(yi + q, ai + bi);
+		pkmVecStore(yr + q + s, ar - br);
+		pkmVecStore(yi + q + s, ai - bi);
+	}
+	for (; q < s; q++) {
+		T ar = xr[q], ai = xi[q], br = xr[q + s], bi = xi[q + s];
+		yr[q] = ar + br;
+		yi[q] = ai + bi;
+		yr[q + s] = ar - br;
+		yi[q + s] = ai - bi;
+	}
+}
+
+// radix-R pass for R = 2 (with twiddles), 3, 5 and 7, vectorized over q
+// when s >= W and over t = s*p + q (twiddles per t, scattered stores)
+// otherwise.  Odd radices pair inputs j and R-j:
+//
+//     y[r]   = A_r + B_r,   A_r = a0 + sum_j (a_j + a_{R-j}) cos(2 pi jr/R)
+//     y[R-r] = A_r - B_r,   B_r = -i sum_j (a_j - a_{R-j}) sin(2 pi jr/R)
+template <typename V, int R>
+PKM_SIMD_INLINE void pkmFFTButterflyOdd(V *ar, V *ai, const V *vc, const V *vs)
+{
+	if (R == 2) {
+		V br = ar[0] - ar[1], bi = ai[0] - ai[1];
+		ar[0] = ar[0] + ar[1];
+		ai[0] = ai[0] + ai[1];
+		ar[1] = br;
+		ai[1] = bi;
+		return;
+	}
+	const int H = (R - 1) / 2;
+	V pr[H + 1], pi[H + 1], mr[H + 1], mi[H + 1];
+	V y0r = ar[0], y0i = ai[0];
+	for (int j = 1; j <= H; j++) {
+		pr[j] = ar[j] + ar[R - j];
+		pi[j] = ai[j] + ai[R - j];
+		mr[j] = ar[j] - ar[R - j];
+		mi[j] = ai[j] - ai[R - j];
+		y0r += pr[j];
+		y0i += pi[j];
+	}
+	for (int r = 1; r <= H; r++) {
+		V Ar = ar[0], Ai = ai[0], Br = V(), Bi = V();
+		for (int j = 1; j <= H; j++) {
+			const int k = (j * r) % R;
+			Ar += pr[j] * vc[k];
+			Ai += pi[j] * vc[k];
+			Br += mi[j] * vs[k];
+			Bi -= mr[j] * vs[k];
+		}
+		ar[r] = Ar + Br;
+		ai[r] = Ai + Bi;
+		ar[R - r] = Ar - Br;
+		ai[R - r] = Ai - Bi;
+	}
+	ar[0] = y0r;
+	ai[0] = y0i;
+}
+
+template <typename T, int W, int R>
+PKM_SIMD_INLINE void pkmFFTRadixGeneric(const pkmFFTStage &stage, const T *twiddles,
+										const T *xr, const T *xi, T *yr, T *yi)
+{
+	typedef typename pkmVec<T, W>::type V;
+	const int s = stage.s, m = stage.m, sm = s * m;
+	const int stride = stage.bExpanded ? sm : m;
+	const T *tw = twiddles + stage.twiddleOffset;
+	T cs[R], sn[R];
+	V vc[R], vs[R];
+	for (int k = 0; k < R; k++) {
+		cs[k] = (T) cos(2.0 * M_PI * k / R);
+		sn[k] = (T) sin(2.0 * M_PI * k / R);
+		vc[k] = pkmVecSplat<V>(cs[k]);
+		vs[k] = pkmVecSplat<V>(sn[k]);
+	}
+	V ar[R], ai[R];
+	T br[R], bi[R];
+	
+	if (!stage.bExpanded) {
+		for (int p = 0; p < m; p++) {
+			const T *x0r = xr + s*p, *x0i = xi + s*p;
+			T *y0r = yr + R*s*p, *y0i = yi + R*s*p;
+			int q = 0;
+			if (W > 1 && s >= W) {
+				V wr[R], wi[R];
+				for (int r = 1; r < R; r++) {
+					wr[r] = pkmVecSplat<V>(tw[(2*r-2)*stride + p]);
+					wi[r] = pkmVecSplat<V>(tw[(2*r-1)*stride + p]);
+				}
+				for (; q + W <= s; q += W) {
+					for (int j = 0; j < R; j++) {
+						ar[j] = pkmVecLoad<V>(x0r + q + j*sm);
+						ai[j] = pkmVecLoad<V>(x0i + q + j*sm);
+					}
+					pkmFFTButterflyOdd<V, R>(ar, ai, vc, vs);
+					pkmVecStore(y0r + q, ar[0]);
+					pkmVecStore(y0i + q, ai[0]);
+					for (int r = 1; r < R; r++) {
+						pkmVecStore(y0r + q + r*s, ar[r] * wr[r] - ai[r] * wi[r]);
+						pkmVecStore(y0i + q + r*s, ar[r] * wi[r] + ai[r] * wr[r]);
+					}
+				}
+			}
+			for (; q < s; q++) {
+				for (int j = 0; j < R; j++) {
+					br[j] = x0r[q + j*sm];
+					bi[j] = x0i[q + j*sm];
+				}
+				pkmFFTButterflyOdd<T, R>(br, bi, cs, sn);
+				y0r[q] = br[0];
+				y0i[q] = bi[0];
+				for (int r = 1; r < R; r++) {
+					T wr = tw[(2*r-2)*stride + p], wi = tw[(2*r-1)*stride + p];
+					y0r[q + r*s] = br[r] * wr - bi[r] * wi;
+					y0i[q + r*s] = br[r] * wi + bi[r] * wr;
+				}
+			}
+		}
+	}
+	else {
+		T outr[R][W], outi[R][W];
+		int t = 0;
+		for (; t + W <= sm; t += W) {
+			for (int j = 0; j < R; j++) {
+				ar[j] = pkmVecLoad<V>(xr + t + j*sm);
+				ai[j] = pkmVecLoad<V>(xi + t + j*sm);
+			}
+			pkmFFTButterflyOdd<V, R>(ar, ai, vc, vs);
+			pkmVecStore(outr[0], ar[0]);
+			pkmVecStore(outi[0], ai[0]);
+			for (int r = 1; r < R; r++) {
+				V wr = pkmVecLoad<V>(tw + (2*r-2)*stride + t), wi = pkmVecLoad<V>(tw + (2*r-1)*stride + t);
+				pkmVecStore(outr[r], ar[r] * wr - ai[r] * wi);
+				pkmVecStore(outi[r], ar[r] * wi + ai[r] * wr);
+			}
+			for (int l = 0; l < W; l++) {
+				int p = (t + l) / s, q = (t + l) - p*s;
+				T *y0r = yr + q + R*s*p, *y0i = yi + q + R*s*p;
+				for (int r = 0; r < R; r++) {
+					y0r[r*s] = outr[r][l];
+					y0i[r*s] = outi[r][l];
+				}
+			}
+		}
+		for (; t < sm; t++) {
+			for (int j = 0; j < R; j++) {
+				br[j] = xr[t + j*sm];
+				bi[j] = xi[t + j*sm];
+			}
+			pkmFFTButterflyOdd<T, R>(br, bi, cs, sn);
+			int p = t / s, q = t - p*s;
+			T *y0r = yr + q + R*s*p, *y0i = yi + q + R*s*p;
+			y0r[0] = br[0];
+			y0i[0] = bi[0];
+			for (int r = 1; r < R; r++) {
+				T wr = tw[(2*r-2)*stride + t], wi = tw[(2*r-1)*stride + t];
+				y0r[r*s] = br[r] * wr - bi[r] * wi;
+				y0i[r*s] = br[r] * wi + bi[r] * wr;
+			}
+		}
+	}
+}
+
+// combines bins k and h-k, k = 1..h/2, between the half size complex
+// transform of the even/odd samples and the spectrum of the real signal:
+//
+//     forward:  2X[k]   = e - i w^k d                    e = Z[k] + conj(Z[h-k])
+//     inverse:  4Z[k]   = e + i conj(w^k) d              d = Z[k] - conj(Z[h-k])
+//
+// and the matching expressions for h-k, w = exp(-2 pi i / N)
+template <typename T, int W, bool bInverse>
+PKM_SIMD_INLINE void pkmFFTRealSplit(T *realp, T *imagp, const T *wr, const T *wi, int h)
+{
+	typedef typename pkmVec<T, W>::type V;
+	typedef pkmVecShuffle<T, W> Shuffle;
+	int k = 1;
+	for (; W > 1 && 2*(k + W - 1) < h; k += W) {
+		const int j = h - k - W + 1;
+		V ar = pkmVecLoad<V>(realp + k), ai = pkmVecLoad<V>(imagp + k);
+		V br = Shuffle::reverse(pkmVecLoad<V>(realp + j)), bi = Shuffle::reverse(pkmVecLoad<V>(imagp + j));
+		V cr = pkmVecLoad<V>(wr + k), ci = pkmVecLoad<V>(wi + k);
+		V er = ar + br, ei = ai - bi;
+		V dr = ar - br, di = ai + bi;
+		if (bInverse) {
+			V pr = cr * dr + ci * di, pi = cr * di - ci * dr;
+			pkmVecStore(realp + k, er - pi);
+			pkmVecStore(imagp + k, ei + pr);
+			pkmVecStore(realp + j, Shuffle::reverse(er + pi));
+			pkmVecStore(imagp + j, Shuffle::reverse(pr - ei));
+		}
+		else {
+			V pr = cr * dr - ci * di, pi = cr * di + ci * dr;
+			pkmVecStore(realp + k, er + pi);
+			pkmVecStore(imagp + k, ei - pr);
+			pkmVecStore(realp + j, Shuffle::reverse(er - pi));
+			pkmVecStore(imagp + j, Shuffle::reverse(-ei - pr));
+		}
+	}
+	for (; k <= h/2; k++) {
+		T ar = realp[k], ai = imagp[k], br = realp[h-k], bi = imagp[h-k];
+		T er = ar + br, ei = ai - bi;
+		T dr = ar - br, di = ai + bi;
+		if (bInverse) {
+			T pr = wr[k] * dr + wi[k] * di, pi = wr[k] * di - wi[k] * dr;
+			realp[k] = er - pi;
+			imagp[k] = ei + pr;
+			realp[h-k] = er + pi;
+			imagp[h-k] = pr - ei;
+		}
+		else {
+			T pr = wr[k] * dr - wi[k] * di, pi = wr[k] * di + wi[k] * dr;
+			realp[k] = er + pi;
+			imagp[k] = ei - pr;
+			realp[h-k] = er - pi;
+			imagp[h-k] = -ei - pr;
+		}
+	}
+}
+
+// one Stockham pass of any supported radix
+template <typename T, int W>
+PKM_SIMD_INLINE void pkmFFTPassKernel(const pkmFFTStage &stage, const T *twiddles,
+									  const T *xr, const T *xi, T *yr, T *yi)
+{
+	switch (stage.radix) {
+		case 4:		pkmFFTRadix4<T, W>(stage, twiddles, xr, xi, yr, yi); break;
+		case 2:
+			if (stage.m == 1)
+				pkmFFTRadix2<T, W>(stage, xr, xi, yr, yi);
+			else
+				pkmFFTRadixGeneric<T, W, 2>(stage, twiddles, xr, xi, yr, yi);
+			break;
+		case 3:		pkmFFTRadixGeneric<T, W, 3>(stage, twiddles, xr, xi, yr, yi); break;
+		case 5:		pkmFFTRadixGeneric<T, W, 5>(stage, twiddles, xr, xi, yr, yi); break;
+		case 7:		pkmFFTRadixGeneric<T, W, 7>(stage, twiddles, xr, xi, yr, yi); break;
+	}
+}
+
+// (re, im) *= (br, bi)
+template <typename T, int W>
+PKM_SIMD_INLINE void pkmFFTMultiplyKernel(T *re, T *im, const T *br, const T *bi, int n)
+{
+	typedef typename pkmVec<T, W>::type V;
+	int k = 0;
+	for (; W > 1 && k + W <= n; k += W) {
+		V xr = pkmVecLoad<V>(re + k), xi = pkmVecLoad<V>(im + k);
+		V yr = pkmVecLoad<V>(br + k), yi = pkmVecLoad<V>(bi + k);
+		pkmVecStore(re + k, xr * yr - xi * yi);
+		pkmVecStore(im + k, xr * yi + xi * yr);
+	}
+	for (; k < n; k++) {
+		T xr = re[k], xi = im[k];
+		re[k] = xr * br[k] - xi * bi[k];
+		im[k] = xr * bi[k] + xi * br[k];
+	}
+}
+
+// a pass on frame-interleaved batches: every vector holds the same value of
+// W frames, so any stride works and the twiddles of one lane tables are splat
+template <typename T, int W, int R>
+PKM_SIMD_INLINE void pkmFFTBatchRadix(const pkmFFTStage &stage, const T *twiddles,
+									  const T *xr, const T *xi, T *yr, T *yi)
+{
+	typedef typename pkmVec<T, W>::type V;
+	const int s = stage.s, m = stage.m, sm = s * m;
+	const bool bTwiddled = !(R == 2 && m == 1);
+	const T *tw = twiddles + stage.twiddleOffset;
+	V vc[R], vs[R], wr[R], wi[R], ar[R], ai[R];
+	for (int k = 0; k < R; k++) {
+		vc[k] = pkmVecSplat<V>((T) cos(2.0 * M_PI * k / R));
+		vs[k] = pkmVecSplat<V>((T) sin(2.0 * M_PI * k / R));
+		wr[k] = pkmVecSplat<V>((T) 1);
+		wi[k] = V();
+	}
+	for (int p = 0; p < m; p++) {
+		for (int r = 1; r < R && bTwiddled; r++) {
+			wr[r] = pkmVecSplat<V>(tw[(2*r-2)*m + p]);
+			wi[r] = pkmVecSplat<V>(tw[(2*r-1)*m + p]);
+		}
+		for (int q = 0; q < s; q++) {
+			const T *x0r = xr + (long)(q + s*p) * W, *x0i = xi + (long)(q + s*p) * W;
+			T *y0r = yr + (long)(q + R*s*p) * W, *y0i = yi + (long)(q + R*s*p) * W;
+			for (int j = 0; j < R; j++) {
+				ar[j] = pkmVecLoad<V>(x0r + (long)j * sm * W);
+				ai[j] = pkmVecLoad<V>(x0i + (long)j * sm * W);
+			}
+			if (R == 4) {
+				pkmFFTButterfly4(ar, ai, wr[1], wi[1], wr[2], wi[2], wr[3], wi[3]);
+				for (int r = 0; r < R; r++) {
+					pkmVecStore(y0r + (long)r * s * W, ar[r]);
+					pkmVecStore(y0i + (long)r * s * W, ai[r]);
+				}
+				continue;
+			}
+			pkmFFTButterflyOdd<V, R>(ar, ai, vc, vs);
+			pkmVecStore(y0r, ar[0]);
+			pkmVecStore(y0i, ai[0]);
+			for (int r = 1; r < R; r++) {
+				if (bTwiddled) {
+					pkmVecStore(y0r + (long)r * s * W, ar[r] * wr[r] - ai[r] * wi[r]);
+					pkmVecStore(y0i + (long)r * s * W, ar[r] * wi[r] + ai[r] * wr[r]);
+				}
+				else {
+					pkmVecStore(y0r + (long)r * s * W, ar[r]);
+					pkmVecStore(y0i + (long)r * s * W, ai[r]);
+				}
+			}
+		}
+	}
+}
+
+template <typename T, int W>
+PKM_SIMD_INLINE void pkmFFTBatchPassKernel(const pkmFFTStage &stage, const T *twiddles,
+										   const T *xr, const T *xi, T *yr, T *yi)
+{
+	switch (stage.radix) {
+		case 4:		pkmFFTBatchRadix<T, W, 4>(stage, twiddles, xr, xi, yr, yi); break;
+		case 2:		pkmFFTBatchRadix<T, W, 2>(stage, twiddles, xr, xi, yr, yi); break;
+		case 3:		pkmFFTBatchRadix<T, W, 3>(stage, twiddles, xr, xi, yr, yi); break;
+		case 5:		pkmFFTBatchRadix<T, W, 5>(stage, twiddles, xr, xi, yr, yi); break;
+		case 7:		pkmFFTBatchRadix<T, W, 7>(stage, twiddles, xr, xi, yr, yi); break;
+	}
+}
+
+// pkmFFTRealSplit on frame-interleaved batches, bin 0 left to the caller
+template <typename T, int W, bool bInverse>
+PKM_SIMD_INLINE void pkmFFTBatchRealSplit(T *realp, T *imagp, const T *wr, const T *wi, int h)
+{
+	typedef typename pkmVec<T, W>::type V;
+	for (int k = 1; k <= h/2; k++) {
+		T *rk = realp + (long)k * W, *ik = imagp + (long)k * W;
+		T *rj = realp + (long)(h - k) * W, *ij = imagp + (long)(h - k) * W;
+		V ar = pkmVecLoad<V>(rk), ai = pkmVecLoad<V>(ik);
+		V br = pkmVecLoad<V>(rj), bi = pkmVecLoad<V>(ij);
+		V cr = pkmVecSplat<V>(wr[k]), ci = pkmVecSplat<V>(wi[k]);
+		V er = ar + br, ei = ai - bi;
+		V dr = ar - br, di = ai + bi;
+		if (bInverse) {
+			V pr = cr * dr + ci * di, pi = cr * di - ci * dr;
+			pkmVecStore(rk, er - pi);
+			pkmVecStore(ik, ei + pr);
+			pkmVecStore(rj, er + pi);
+			pkmVecStore(ij, pr - ei);
+		}
+		else {
+			V pr = cr * dr - ci * di, pi = cr * di + ci * dr;
+			pkmVecStore(rk, er + pi);
+			pkmVecStore(ik, ei - pr);
+			pkmVecStore(rj, er - pi);
+			pkmVecStore(ij, -ei - pr);
+		}
+	}
+}
+
+// per instruction set entry points: the kernels above are inlined into each
+// of these so they are compiled for that instruction set, and the plans
+// call them through a table picked once at setup
+#define PKM_FFT_KERNEL_ENTRY_POINTS(SUFFIX, TARGET, LANES) \
+	TARGET static void pass##SUFFIX(const pkmFFTStage &stage, const T *tw, const T *xr, const T *xi, T *yr, T *yi) \
+	{ pkmFFTPassKernel<T, LANES>(stage, tw, xr, xi, yr, yi); } \
+	TARGET static void forwardSplit##SUFFIX(T *re, T *im, const T *wr, const T *wi, int h) \
+	{ pkmFFTRealSplit<T, LANES, false>(re, im, wr, wi, h); } \
+	TARGET static void inverseSplit##SUFFIX(T *re, T *im, const T *wr, const T *wi, int h) \
+	{ pkmFFTRealSplit<T, LANES, true>(re, im, wr, wi, h); } \
+	TARGET static void multiply##SUFFIX(T *re, T *im, const T *br, const T *bi, int n) \
+	{ pkmFFTMultiplyKernel<T, LANES>(re, im, br, bi, n); } \
+	TARGET static void batchPass##SUFFIX(const pkmFFTStage &stage, const T *tw, const T *xr, const T *xi, T *yr, T *yi) \
+	{ pkmFFTBatchPassKernel<T, LANES>(stage, tw, xr, xi, yr, yi); } \
+	TARGET static void batchForwardSplit##SUFFIX(T *re, T *im, const T *wr, const T *wi, int h) \
+	{ pkmFFTBatchRealSplit<T, LANES, false>(re, im, wr, wi, h); } \
+	TARGET static void batchInverseSplit##SUFFIX(T *re, T *im, const T *wr, const T *wi, int h) \
+	{ pkmFFTBatchRealSplit<T, LANES, true>(re, im, wr, wi, h); } \
+	static void set##SUFFIX(pkmFFTNativeKernels &k) \
+	{ \
+		k.pass = pass##SUFFIX; \
+		k.forwardSplit = forwardSplit##SUFFIX; \
+		k.inverseSplit = inverseSplit##SUFFIX; \
+		k.multiply = multiply##SUFFIX; \
+		k.batchPass = batchPass##SUFFIX; \
+		k.batchForwardSplit = batchForwardSplit##SUFFIX; \
+		k.batchInverseSplit = batchInverseSplit##SUFFIX; \
+		k.lanes = LANES; \
+	}
+
+template <typename T>
+struct pkmFFTNativeKernels
+{
+	void				(*pass)(const pkmFFTStage &, const T *, const T *, const T *, T *, T *);
+	void				(*forwardSplit)(T *, T *, const T *, const T *, int);
+	void				(*inverseSplit)(T *, T *, const T *, const T *, int);
+	void				(*multiply)(T *, T *, const T *, const T *, int);
+	void				(*batchPass)(const pkmFFTStage &, const T *, const T *, const T *, T *, T *);
+	void				(*batchForwardSplit)(T *, T *, const T *, const T *, int);
+	void				(*batchInverseSplit)(T *, T *, const T *, const T *, int);
+	int					lanes;
+	
+	PKM_FFT_KERNEL_ENTRY_POINTS(Scalar, , 1)
+#if defined(PKM_SIMD_HAVE_SSE2) || defined(PKM_SIMD_HAVE_NEON)
+	PKM_FFT_KERNEL_ENTRY_POINTS(128, , 16 / sizeof(T))
+#endif
+#if defined(PKM_SIMD_HAVE_AVX2)
+	PKM_FFT_KERNEL_ENTRY_POINTS(AVX2, PKM_SIMD_TARGET("avx2,fma"), 32 / sizeof(T))
+#endif
+#if defined(PKM_SIMD_HAVE_AVX512)
+	PKM_FFT_KERNEL_ENTRY_POINTS(AVX512, PKM_SIMD_TARGET("avx512f,avx2,fma"), 64 / sizeof(T))
+#endif
+	
+	static pkmFFTNativeKernels select(pkmSIMDISA isa)
+	{
+		pkmFFTNativeKernels k;
+		setScalar(k);
+		switch (isa) {
+#if defined(PKM_SIMD_HAVE_SSE2)
+			case PKM_ISA_SSE2:		set128(k); break;
+#endif
+#if defined(PKM_SIMD_HAVE_NEON)
+			case PKM_ISA_NEON:		set128(k); break;
+#endif
+#if defined(PKM_SIMD_HAVE_AVX2)
+			case PKM_ISA_AVX2:		setAVX2(k); break;
+#endif
+#if defined(PKM_SIMD_HAVE_AVX512)
+			case PKM_ISA_AVX512:	setAVX512(k); break;
+#endif
+			default:				break;
+		}
+		return k;
+	}
+};
+
+#undef PKM_FFT_KERNEL_ENTRY_POINTS
+
+// tables of one complex transform of n points: Stockham passes over the
+// factors 4, 2, 3, 5 and 7 of n, or when n has a larger prime factor,
+// Bluestein's chirp-z algorithm around a power of two transform
+template <typename T>
+struct pkmFFTComplexTables
+{
+	int					n,
+						numStages;
+	pkmFFTStage			*stages;
+	T					*twiddles;
+	
+	int					bluesteinSize;		// 0 unless Bluestein
+	T					*chirp,				// exp(-i pi k^2 / n), k < n: re | im
+						*chirpSpectrum;		// fft of the conjugate chirp / bluesteinSize: re | im
+	pkmFFTComplexTables<T> *bluestein;
+	
+	size_t				bytes;				// everything above, including bluestein's tables
+};
+
+// everything a native plan runs on
+template <typename T>
+struct pkmFFTNativeTables
+{
+	int					fftSize;
+	pkmFFTNativeKernels<T> kernels;
+	pkmFFTComplexTables<T> complex;			// fftSize/2 points, or fftSize when odd
+	pkmFFTComplexTables<T> batch;			// fftSize/2 points laid out for one lane, or empty
+	T					*realTwiddles;		// real <-> half size complex, k = 0..N/4: cos | sin
+};
+
+// unnormalized forward complex fft over the Stockham passes, result in (re, im)
+template <typename T>
+void pkmFFTStockham(const pkmFFTNativeKernels<T> &kernels, const pkmFFTComplexTables<T> &tables,
+					T *re, T *im, T *scratch)
+{
+	const int n = tables.n;
+	T *xr = re, *xi = im, *yr = scratch, *yi = scratch + n;
+	for (int i = 0; i < tables.numStages; i++) {
+		kernels.pass(tables.stages[i], tables.twiddles, xr, xi, yr, yi);
+		T *tr = xr, *ti = xi;
+		xr = yr; xi = yi;
+		yr = tr; yi = ti;
+	}
+	if (xr != re) {
+		memcpy(re, xr, sizeof(T) * n);
+		memcpy(im, xi, sizeof(T) * n);
+	}
+}
+
+// pkmFFTStockham on kernels.lanes frame-interleaved transforms
+template <typename T>
+void pkmFFTStockhamBatch(const pkmFFTNativeKernels<T> &kernels, const pkmFFTComplexTables<T> &tables,
+						 T *re, T *im, T *scratch)
+{
+	const long n = (long) tables.n * kernels.lanes;
+	T *xr = re, *xi = im, *yr = scratch, *yi = scratch + n;
+	for (int i = 0; i < tables.numStages; i++) {
+		kernels.batchPass(tables.stages[i], tables.twiddles, xr, xi, yr, yi);
+		T *tr = xr, *ti = xi;
+		xr = yr; xi = yi;
+		yr = tr; yi = ti;
+	}
+	if (xr != re) {
+		memcpy(re, xr, sizeof(T) * n);
+		memcpy(im, xi, sizeof(T) * n);
+	}
+}
+
+// X[k] = w[k] sum_j (x[j] w[j]) conj(w[k-j]),  w[k] = exp(-i pi k^2 / n),
+// the sum being a circular convolution of bluesteinSize points
+template <typename T>
+void pkmFFTBluestein(const pkmFFTNativeKernels<T> &kernels, const pkmFFTComplexTables<T> &tables,
+					 T *re, T *im, T *scratch)
+{
+	const int n = tables.n, M = tables.bluesteinSize;
+	const T *cr = tables.chirp, *ci = tables.chirp + n;
+	T *ar = scratch, *ai = scratch + M;
+	
+	memcpy(ar, re, sizeof(T) * n);
+	memcpy(ai, im, sizeof(T) * n);
+	kernels.multiply(ar, ai, cr, ci, n);
+	memset(ar + n, 0, sizeof(T) * (M - n));
+	memset(ai + n, 0, sizeof(T) * (M - n));
+	
+	pkmFFTStockham(kernels, *tables.bluestein, ar, ai, scratch + 2*M);
+	kernels.multiply(ar, ai, tables.chirpSpectrum, tables.chirpSpectrum + M, M);
+	// inverse by swapping real and imaginary parts
+	pkmFFTStockham(kernels, *tables.bluestein, ai, ar, scratch + 2*M);
+	
+	memcpy(re, ar, sizeof(T) * n);
+	memcpy(im, ai, sizeof(T) * n);
+	kernels.multiply(re, im, cr, ci, n);
+}
+
+// unnormalized forward complex fft of tables.n points, result in (re, im)
+template <typename T>
+void pkmFFTComplex(const pkmFFTNativeKernels<T> &kernels, const pkmFFTComplexTables<T> &tables,
+				   T *re, T *im, T *scratch)
+{
+	if (tables.bluesteinSize)
+		pkmFFTBluestein(kernels, tables, re, im, scratch);
+	else
+		pkmFFTStockham(kernels, tables, re, im, scratch);
+}
+
+inline int pkmFFTLargestPrimeFactor(int n)
+{
+	int largest = 1;
+	for (int f = 2; f * f <= n; f++) {
+		while (n % f == 0) {
+			largest = f;
+			n /= f;
+		}
+	}
+	return n > 1 ? n : largest;
+}
+
+template <typename T>
+void pkmFFTFreeComplexTables(pkmFFTComplexTables<T> &tables)
+{
+	free(tables.stages);
+	free(tables.twiddles);
+	free(tables.chirp);
+	free(tables.chirpSpectrum);
+	if (tables.bluestein) {
+		pkmFFTFreeComplexTables(*tables.bluestein);
+		free(tables.bluestein);
+	}
+	memset(&tables, 0, sizeof(tables));
+}
+
+// elements of T needed as scratch by pkmFFTComplexKernel
+template <typename T>
+long pkmFFTComplexScratchSize(const pkmFFTComplexTables<T> &tables)
+{
+	return tables.bluesteinSize ? 4L * tables.bluesteinSize : 2L * tables.n;
+}
+
+// lanes is the vector width the tables are laid out for
+template <typename T>
+bool pkmFFTBuildComplexTables(pkmFFTComplexTables<T> &tables, int n, int lanes)
+{
+	memset(&tables, 0, sizeof(tables));
+	tables.n = n;
+	if (n < 1)
+		return false;
+	
+	if (pkmFFTLargestPrimeFactor(n) > 7) {
+		// chirp-z: a circular convolution of at least 2n-1 points
+		int M = 1;
+		while (M < 2*n - 1)
+			M *= 2;
+		tables.bluesteinSize = M;
+		tables.bluestein = (pkmFFTComplexTables<T> *) malloc(sizeof(pkmFFTComplexTables<T>));
+		tables.chirp = (T *) malloc(sizeof(T) * 2 * n);
+		tables.chirpSpectrum = (T *) calloc(2 * M, sizeof(T));
+		T *work = (T *) malloc(sizeof(T) * 2 * M);
+		if (tables.bluestein == NULL || tables.chirp == NULL || tables.chirpSpectrum == NULL || work == NULL ||
+			!pkmFFTBuildComplexTables(*tables.bluestein, M, lanes)) {
+			free(work);
+			return false;
+		}
+		tables.bytes = sizeof(pkmFFTComplexTables<T>) + tables.bluestein->bytes + sizeof(T) * (2*n + 2*M);
+		T *fr = tables.chirpSpectrum, *fi = tables.chirpSpectrum + M;
+		for (int k = 0; k < n; k++) {
+			// k^2 mod 2n keeps the angle accurate for large k
+			double theta = -M_PI * (double)(((long long)k * k) % (2LL * n)) / n;
+			tables.chirp[k] = (T) cos(theta);
+			tables.chirp[n + k] = (T) sin(theta);
+			fr[k] = (T) (cos(theta) / M);
+			fi[k] = (T) (-sin(theta) / M);
+			if (k) {
+				fr[M - k] = fr[k];
+				fi[M - k] = fi[k];
+			}
+		}
+		pkmFFTStockham(pkmFFTNativeKernels<T>::select(PKM_ISA_SCALAR), *tables.bluestein, fr, fi, work);
+		free(work);
+		return true;
+	}
+	
+	// radix-4 passes first, then 3, 5, 7 and a final untwiddled radix-2
+	int radices[32], numRadices = 0, rest = n;
+	while (rest % 4 == 0) {
+		radices[numRadices++] = 4;
+		rest /= 4;
+	}
+	for (int r = 3; r <= 7; r += 2) {
+		while (rest % r == 0) {
+			radices[numRadices++] = r;
+			rest /= r;
+		}
+	}
+	if (rest == 2)
+		radices[numRadices++] = 2;
+	
+	tables.numStages = numRadices;
+	tables.stages = (pkmFFTStage *) malloc(sizeof(pkmFFTStage) * (numRadices + 1));
+	if (tables.stages == NULL)
+		return false;
+	
+	long twiddleSize = 0;
+	int len = n, s = 1;
+	for (int i = 0; i < numRadices; i++) {
+		pkmFFTStage &stage = tables.stages[i];
+		stage.radix = radices[i];
+		stage.s = s;
+		stage.m = len / stage.radix;
+		stage.bExpanded = s < lanes && !(stage.radix == 2 && stage.m == 1);
+		stage.twiddleOffset = twiddleSize;
+		if (!(stage.radix == 2 && stage.m == 1))
+			twiddleSize += 2L * (stage.radix - 1) * stage.m * (stage.bExpanded ? s : 1);
+		len /= stage.radix;
+		s *= stage.radix;
+	}
+	
+	tables.twiddles = (T *) malloc(sizeof(T) * (twiddleSize + 1));
+	if (tables.twiddles == NULL)
+		return false;
+	tables.bytes = sizeof(pkmFFTStage) * (numRadices + 1) + sizeof(T) * (twiddleSize + 1);
+	for (int i = 0; i < numRadices; i++) {
+		const pkmFFTStage &stage = tables.stages[i];
+		if (stage.radix == 2 && stage.m == 1)
+			continue;
+		const int R = stage.radix, m = stage.m, copies = stage.bExpanded ? stage.s : 1, stride = m * copies;
+		T *tw = tables.twiddles + stage.twiddleOffset;
+		for (int p = 0; p < m; p++) {
+			for (int j = 1; j < R; j++) {
+				double theta = -2.0 * M_PI * j * p / ((double)R * m);
+				for (int c = 0; c < copies; c++) {
+					tw[(2*j-2)*stride + p*copies + c] = (T) cos(theta);
+					tw[(2*j-1)*stride + p*copies + c] = (T) sin(theta);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+template <typename T>
+void pkmFFTRealForward(const pkmFFTNativeTables<T> &tables, T *realp, T *imagp, T *scratch)
+{
+	const int N = tables.fftSize;
+	if (N & 1) {
+		// odd sizes: complex transform of the real signal itself
+		const int bins = (N + 1) / 2;
+		T *cr = scratch, *ci = scratch + N;
+		for (int i = 0; i < N; i++) {
+			cr[i] = (i & 1) ? imagp[i/2] : realp[i/2];
+			ci[i] = 0;
+		}
+		pkmFFTComplex(tables.kernels, tables.complex, cr, ci, scratch + 2*N);
+		for (int k = 0; k < bins; k++) {
+			realp[k] = 2 * cr[k];
+			imagp[k] = 2 * ci[k];
+		}
+		imagp[0] = 0;
+		return;
+	}
+	
+	const int h = N / 2;
+	pkmFFTComplex(tables.kernels, tables.complex, realp, imagp, scratch);
+	
+	T z0r = realp[0], z0i = imagp[0];
+	realp[0] = 2 * (z0r + z0i);
+	imagp[0] = 2 * (z0r - z0i);
+	tables.kernels.forwardSplit(realp, imagp, tables.realTwiddles, tables.realTwiddles + (h/2 + 1), h);
+}
+
+template <typename T>
+void pkmFFTRealInverse(const pkmFFTNativeTables<T> &tables, T *realp, T *imagp, T *scratch)
+{
+	const int N = tables.fftSize;
+	if (N & 1) {
+		// rebuild the hermitian spectrum, output packed like the input
+		const int bins = (N + 1) / 2;
+		T *cr = scratch, *ci = scratch + N;
+		cr[0] = realp[0];
+		ci[0] = 0;
+		for (int k = 1; k < bins; k++) {
+			cr[k] = cr[N-k] = realp[k];
+			ci[k] = imagp[k];
+			ci[N-k] = -imagp[k];
+		}
+		pkmFFTComplex(tables.kernels, tables.complex, ci, cr, scratch + 2*N);
+		for (int i = 0; i < N; i++) {
+			if (i & 1)
+				imagp[i/2] = cr[i];
+			else
+				realp[i/2] = cr[i];
+		}
+		imagp[bins-1] = 0;
+		return;
+	}
+	
+	const int h = N / 2;
+	T y0r = realp[0], y0i = imagp[0];
+	realp[0] = y0r + y0i;
+	imagp[0] = y0r - y0i;
+	tables.kernels.inverseSplit(realp, imagp, tables.realTwiddles, tables.realTwiddles + (h/2 + 1), h);
+	
+	// inverse through the forward transform by swapping real and imaginary parts
+	pkmFFTComplex(tables.kernels, tables.complex, imagp, realp, scratch);
+}
+
+// pkmFFTRealForward/Inverse on kernels.lanes frame-interleaved even sizes
+template <typename T>
+void pkmFFTRealForwardBatch(const pkmFFTNativeTables<T> &tables, T *realp, T *imagp, T *scratch)
+{
+	const int h = tables.fftSize / 2, lanes = tables.kernels.lanes;
+	pkmFFTStockhamBatch(tables.kernels, tables.batch, realp, imagp, scratch);
+	
+	for (int l = 0; l < lanes; l++) {
+		T z0r = realp[l], z0i = imagp[l];
+		realp[l] = 2 * (z0r + z0i);
+		imagp[l] = 2 * (z0r - z0i);
+	}
+	tables.kernels.batchForwardSplit(realp, imagp, tables.realTwiddles, tables.realTwiddles + (h/2 + 1), h);
+}
+
+template <typename T>
+void pkmFFTRealInverseBatch(const pkmFFTNativeTables<T> &tables, T *realp, T *imagp, T *scratch)
+{
+	const int h = tables.fftSize / 2, lanes = tables.kernels.lanes;
+	for (int l = 0; l < lanes; l++) {
+		T y0r = realp[l], y0i = imagp[l];
+		realp[l] = y0r + y0i;
+		imagp[l] = y0r - y0i;
+	}
+	tables.kernels.batchInverseSplit(realp, imagp, tables.realTwiddles, tables.realTwiddles + (h/2 + 1), h);
+	pkmFFTStockhamBatch(tables.kernels, tables.batch, imagp, realp, scratch);
+}
+
+template <typename T>
+class pkmFFTNativePlan : public pkmFFTPlan<T>
+{
+public:
+	pkmFFTNativePlan(int size, pkmSIMDISA isa = pkmSIMDGetISA())
+	: pkmFFTPlan<T>(size)
+	{
+		memset(&tables, 0, sizeof(tables));
+		tables.fftSize = size;
+		scratchElements = 0;
+		this->isa = isa;
+		tables.kernels = pkmFFTNativeKernels<T>::select(isa);
+		const int lanes = tables.kernels.lanes;
+		
+		// even sizes run a half size complex transform, odd sizes a full one
+		bool bValid = size >= 2 && pkmFFTBuildComplexTables(tables.complex, (size & 1) ? size : size / 2, lanes);
+		
+		const int h = size / 2;
+		if (bValid && !(size & 1)) {
+			tables.realTwiddles = (T *) malloc(sizeof(T) * 2 * (h/2 + 1));
+			bValid = tables.realTwiddles != NULL;
+			for (int k = 0; bValid && k <= h/2; k++) {
+				double theta = -2.0 * M_PI * k / size;
+				tables.realTwiddles[k] = (T) cos(theta);
+				tables.realTwiddles[h/2 + 1 + k] = (T) sin(theta);
+			}
+		}
+		
+		// frame-interleaved batches splat their twiddles from one lane tables
+		bBatch = false;
+		if (bValid && lanes > 1 && !(size & 1) && !tables.complex.bluesteinSize) {
+			bValid = pkmFFTBuildComplexTables(tables.batch, h, 1);
+			bBatch = bValid;
+		}
+		
+		if (bValid) {
+			scratchElements = (int) pkmFFTComplexScratchSize(tables.complex) + ((size & 1) ? 2 * size : 0);
+		}
+		else {
+			printf("\npkmFFTNativePlan: could not set up an fft of size %d\n", size);
+			pkmFFTFreeComplexTables(tables.complex);
+			pkmFFTFreeComplexTables(tables.batch);
+			free(tables.realTwiddles);
+			tables.realTwiddles = NULL;
+		}
+		this->bValid = bValid;
+	}
+	~pkmFFTNativePlan()
+	{
+		pkmFFTFreeComplexTables(tables.complex);
+		pkmFFTFreeComplexTables(tables.batch);
+		free(tables.realTwiddles);
+	}
+	
+	void forward(T *realp, T *imagp, T *scratch) const
+	{
+		pkmFFTRealForward(tables, realp, imagp, scratch);
+	}
+	
+	void inverse(T *realp, T *imagp, T *scratch) const
+	{
+		pkmFFTRealInverse(tables, realp, imagp, scratch);
+	}
+	
+	int scratchSize() const
+	{
+		return scratchElements;
+	}
+	
+	int batchLanes() const
+	{
+		return bBatch ? tables.kernels.lanes : 1;
+	}
+	
+	int batchScratchSize() const
+	{
+		return bBatch ? this->fftSize * tables.kernels.lanes : scratchElements;
+	}
+	
+	void forwardBatch(T *realp, T *imagp, T *scratch) const
+	{
+		if (bBatch)
+			pkmFFTRealForwardBatch(tables, realp, imagp, scratch);
+		else
+			pkmFFTRealForward(tables, realp, imagp, scratch);
+	}
+	
+	void inverseBatch(T *realp, T *imagp, T *scratch) const
+	{
+		if (bBatch)
+			pkmFFTRealInverseBatch(tables, realp, imagp, scratch);
+		else
+			pkmFFTRealInverse(tables, realp, imagp, scratch);
+	}
+	
+	pkmFFTBackend backend() const
+	{
+		return PKM_FFT_BACKEND_NATIVE;
+	}
+	
+	const char * name() const
+	{
+		return pkmSIMDISAName(isa);
+	}
+	
+	bool isValid() const
+	{
+		return bValid;
+	}
+	
+	size_t memoryUsage() const
+	{
+		size_t bytes = sizeof(*this) + tables.complex.bytes + tables.batch.bytes;
+		if (tables.realTwiddles)
+			bytes += sizeof(T) * 2 * (this->fftSize/4 + 1);
+		return bytes;
+	}
+	
+private:
+	pkmFFTNativeTables<T>	tables;
+	bool					bValid,
+							bBatch;
+	int						scratchElements;
+	pkmSIMDISA				isa;
+};
+
+#if defined(PKM_FFT_HAVE_ACCELERATE)
+inline FFTSetup pkmFFTAccelerateCreate(float *, int log2n)				{ return vDSP_create_fftsetup(log2n, FFT_RADIX2); }
+inline FFTSetupD pkmFFTAccelerateCreate(double *, int log2n)			{ return vDSP_create_fftsetupD(log2n, FFT_RADIX2); }
+inline void pkmFFTAccelerateDestroy(FFTSetup setup)					{ vDSP_destroy_fftsetup(setup); }
+inline void pkmFFTAccelerateDestroy(FFTSetupD setup)				{ vDSP_destroy_fftsetupD(setup); }
+inline void pkmFFTAccelerateRun(FFTSetup setup, float *re, float *im, int log2n, FFTDirection dir)
+{
+	DSPSplitComplex z = { re, im };
+	vDSP_fft_zrip(setup, &z, 1, log2n, dir);
+}
+inline void pkmFFTAccelerateRun(FFTSetupD setup, double *re, double *im, int log2n, FFTDirection dir)
+{
+	DSPDoubleSplitComplex z = { re, im };
+	vDSP_fft_zripD(setup, &z, 1, log2n, dir);
+}
+
+// a vDSP setup of 2^log2n points serves every power of two up to it
+template <typename T>
+struct pkmFFTAccelerateSetup
+{
+	pkmFFTAccelerateSetup(int log2n)
+	{
+		this->log2n = log2n;
+		setup = pkmFFTAccelerateCreate((T *) NULL, log2n);
+	}
+	~pkmFFTAccelerateSetup()
+	{
+		if (setup)
+			pkmFFTAccelerateDestroy(setup);
+	}
+	
+	int					log2n;
+	__typeof__(pkmFFTAccelerateCreate((T *) NULL, 0)) setup;
+};
+
+template <typename T>
+class pkmFFTAcceleratePlan : public pkmFFTPlan<T>
+{
+public:
+	// shares a setup of at least this size when given one (see pkmFFTPlanCache)
+	pkmFFTAcceleratePlan(int size, std::shared_ptr<pkmFFTAccelerateSetup<T> > shared = std::shared_ptr<pkmFFTAccelerateSetup<T> >())
+	: pkmFFTPlan<T>(size)
+	{
+		log2n = pkmFFTLog2(size);
+		if (pkmFFTIsPowerOfTwo(size)) {
+			if (shared && shared->log2n >= log2n)
+				fftSetup = shared;
+			else
+				fftSetup = std::make_shared<pkmFFTAccelerateSetup<T> >(log2n);
+		}
+		if (!isValid()) {
+			printf("\nFFT_Setup failed to allocate enough memory.\n");
+		}
+	}
+	
+	void forward(T *realp, T *imagp, T *scratch) const
+	{
+		pkmFFTAccelerateRun(fftSetup->setup, realp, imagp, log2n, FFT_FORWARD);
+	}
+	
+	void inverse(T *realp, T *imagp, T *scratch) const
+	{
+		pkmFFTAccelerateRun(fftSetup->setup, realp, imagp, log2n, FFT_INVERSE);
+	}
+	
+	pkmFFTBackend backend() const
+	{
+		return PKM_FFT_BACKEND_ACCELERATE;
+	}
+	
+	const char * name() const
+	{
+		return "accelerate";
+	}
+	
+	bool isValid() const
+	{
+		return fftSetup && fftSetup->setup != NULL;
+	}
+	
+	// vDSP keeps N/2 complex twiddles of the setup's size, which may be shared
+	size_t memoryUsage() const
+	{
+		return sizeof(*this) + (fftSetup ? sizeof(T) << fftSetup->log2n : 0);
+	}
+	
+	std::shared_ptr<pkmFFTAccelerateSetup<T> > setup() const
+	{
+		return fftSetup;
+	}
+	
+private:
+	int					log2n;
+	std::shared_ptr<pkmFFTAccelerateSetup<T> > fftSetup;
+};
+#endif
+
+inline bool pkmFFTBackendAvailable(pkmFFTBackend backend)
+{
+#if defined(PKM_FFT_HAVE_ACCELERATE)
+	return true;
+#else
+	return backend != PKM_FFT_BACKEND_ACCELERATE;
+#endif
+}
+
+// caller deletes the plan; unavailable backends fall back to the native one
+template <typename T>
+pkmFFTPlan<T> * pkmFFTCreatePlan(int size, pkmFFTBackend backend = PKM_FFT_BACKEND_AUTO)
+{
+#if defined(PKM_FFT_HAVE_ACCELERATE)
+	if (backend != PKM_FFT_BACKEND_NATIVE && pkmFFTIsPowerOfTwo(size))
+		return new pkmFFTAcceleratePlan<T>(size);
+#else
+	(void) backend;
+#endif
+	return new pkmFFTNativePlan<T>(size);
+}
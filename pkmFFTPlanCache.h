@@ -0,0 +1,315 @@
+/*
+ *  pkmFFTPlanCache.h
+ *
+ *  Process-wide, thread-safe cache of FFT plans and analysis windows
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  Plans (pkmFFTPlan.h) and windows only hold read-only tables, so every
+ *  pkmFFT, pkmSTFT and pkmDCT of the same size shares one copy instead of
+ *  building its own.  Plans are keyed by (size, backend, precision, and
+ *  for native plans the instruction set from pkmSIMDGetISA(), so a kernel
+ *  picked with pkmSIMDSetISA() gets its own plan) and windows by (size,
+ *  window type, precision); handles are reference
+ *  counted shared_ptrs, so constructing an analyzer is a lookup once the
+ *  size has been seen.  Unreferenced entries stay cached for the next
+ *  analyzer until purge() is called.
+ *
+ *  With Accelerate, one vDSP setup of the largest power of two requested so
+ *  far serves every smaller size, as vDSP allows.
+ *
+ *  Usage:
+ *
+ *  pkmFFTPlanCache &cache = pkmFFTPlanCache::instance();
+ *  std::shared_ptr<const pkmFFTPlan<float> > plan = cache.plan<float>(1024);
+ *  std::shared_ptr<const float> window = cache.window<float>(1024, PKM_FFT_WINDOW_HANN);
+ *
+ *  std::vector<pkmFFTPlanCache::Info> entries = cache.report();
+ *  printf("%lu bytes cached\n", cache.memoryUsage());
+ *  cache.purge();
+ *
+ */
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "pkmFFTPlan.h"
+#include "pkmDSP.h"
+
+enum pkmFFTWindow
+{
+	PKM_FFT_WINDOW_HANN = 0,		// vDSP_HANN_NORM, what pkmFFT has always used
+	PKM_FFT_WINDOW_HANN_DENORM,		// vDSP_HANN_DENORM, 0.5 * (1 - cos)
+	PKM_FFT_WINDOW_RECTANGULAR
+};
+
+template <typename T>
+void pkmFFTMakeWindow(T *window, int size, pkmFFTWindow type)
+{
+	switch (type) {
+		case PKM_FFT_WINDOW_HANN:			pkmDSP::hann_window(window, size, true); break;
+		case PKM_FFT_WINDOW_HANN_DENORM:	pkmDSP::hann_window(window, size, false); break;
+		default:
+			for (int i = 0; i < size; i++)
+				window[i] = 1;
+			break;
+	}
+}
+
+class pkmFFTPlanCache
+{
+public:
+	
+	// one cached plan or window
+	struct Info
+	{
+		bool			bWindow;
+		int				size,
+						precision;		// bytes per sample
+		pkmFFTBackend	backend;		// plans
+		pkmSIMDISA		isa;			// native plans
+		pkmFFTWindow	window;			// windows
+		const char		*name;
+		long			references;		// handles held outside the cache
+		size_t			bytes;
+	};
+	
+	static pkmFFTPlanCache & instance()
+	{
+		static pkmFFTPlanCache cache;
+		return cache;
+	}
+	
+	// shared plan; check isValid() for sizes the backend cannot do
+	template <typename T>
+	std::shared_ptr<const pkmFFTPlan<T> > plan(int size, pkmFFTBackend backend = PKM_FFT_BACKEND_AUTO)
+	{
+		backend = resolve(size, backend);
+		const pkmSIMDISA isa = backend == PKM_FFT_BACKEND_NATIVE ? pkmSIMDGetISA() : PKM_ISA_SCALAR;
+		Key key = { false, size, (int) sizeof(T), (int) backend, (int) isa };
+		
+		std::lock_guard<std::mutex> lock(mutex);
+		typename std::map<Key, Entry>::iterator it = entries.find(key);
+		if (it != entries.end())
+			return std::static_pointer_cast<const pkmFFTPlan<T> >(it->second.object);
+		
+		std::shared_ptr<pkmFFTPlan<T> > plan(create<T>(size, backend, isa));
+		Entry entry;
+		entry.object = plan;
+		entry.name = plan->name();
+		entry.bytes = plan->memoryUsage();
+		entries[key] = entry;
+		return plan;
+	}
+	
+	// shared window of size samples
+	template <typename T>
+	std::shared_ptr<const T> window(int size, pkmFFTWindow type = PKM_FFT_WINDOW_HANN)
+	{
+		Key key = { true, size, (int) sizeof(T), (int) type, 0 };
+		
+		std::lock_guard<std::mutex> lock(mutex);
+		typename std::map<Key, Entry>::iterator it = entries.find(key);
+		if (it != entries.end())
+			return std::static_pointer_cast<const T>(it->second.object);
+		
+		std::shared_ptr<T> window((T *) malloc(sizeof(T) * size), free);
+		pkmFFTMakeWindow(window.get(), size, type);
+		Entry entry;
+		entry.object = window;
+		entry.name = "window";
+		entry.bytes = sizeof(T) * size;
+		entries[key] = entry;
+		return window;
+	}
+	
+	// drop entries nobody holds a handle to
+	void purge()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (std::map<Key, Entry>::iterator it = entries.begin(); it != entries.end(); ) {
+			if (it->second.object.use_count() == 1)
+				entries.erase(it++);
+			else
+				++it;
+		}
+	}
+	
+	std::vector<Info> report()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<Info> infos;
+		for (std::map<Key, Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+			Info info;
+			info.bWindow = it->first.bWindow;
+			info.size = it->first.size;
+			info.precision = it->first.precision;
+			info.backend = info.bWindow ? PKM_FFT_BACKEND_AUTO : (pkmFFTBackend) it->first.type;
+			info.window = info.bWindow ? (pkmFFTWindow) it->first.type : PKM_FFT_WINDOW_HANN;
+			info.isa = (pkmSIMDISA) it->first.isa;
+			info.name = it->second.name;
+			info.references = it->second.object.use_count() - 1;
+			info.bytes = it->second.bytes;
+			infos.push_back(info);
+		}
+		return infos;
+	}
+	
+	// bytes held by all cached plans and windows
+	size_t memoryUsage()
+	{
+		std::vector<Info> infos = report();
+		size_t bytes = 0;
+		for (size_t i = 0; i < infos.size(); i++)
+			bytes += infos[i].bytes;
+		return bytes;
+	}
+	
+private:
+	
+	struct Key
+	{
+		bool			bWindow;
+		int				size,
+						precision,
+						type,			// backend or window
+						isa;			// native plans, else 0
+		
+		bool operator<(const Key &other) const
+		{
+			if (bWindow != other.bWindow)		return bWindow < other.bWindow;
+			if (size != other.size)				return size < other.size;
+			if (precision != other.precision)	return precision < other.precision;
+			if (type != other.type)				return type < other.type;
+			return isa < other.isa;
+		}
+	};
+	
+	struct Entry
+	{
+		std::shared_ptr<const void> object;
+		const char		*name;
+		size_t			bytes;
+	};
+	
+	pkmFFTPlanCache() {}
+	pkmFFTPlanCache(const pkmFFTPlanCache &);
+	pkmFFTPlanCache & operator=(const pkmFFTPlanCache &);
+	
+	// which backend AUTO ends up with, so both share an entry
+	static pkmFFTBackend resolve(int size, pkmFFTBackend backend)
+	{
+#if defined(PKM_FFT_HAVE_ACCELERATE)
+		if (backend != PKM_FFT_BACKEND_NATIVE && pkmFFTIsPowerOfTwo(size))
+			return PKM_FFT_BACKEND_ACCELERATE;
+#else
+		(void) size;
+		(void) backend;
+#endif
+		return PKM_FFT_BACKEND_NATIVE;
+	}
+	
+	// called with the mutex held
+	template <typename T>
+	pkmFFTPlan<T> * create(int size, pkmFFTBackend backend, pkmSIMDISA isa)
+	{
+#if defined(PKM_FFT_HAVE_ACCELERATE)
+		if (backend == PKM_FFT_BACKEND_ACCELERATE) {
+			std::shared_ptr<pkmFFTAccelerateSetup<T> > &largest = largestSetup<T>();
+			pkmFFTAcceleratePlan<T> *plan = new pkmFFTAcceleratePlan<T>(size, largest);
+			if (plan->isValid() && (!largest || plan->setup()->log2n > largest->log2n))
+				largest = plan->setup();
+			return plan;
+		}
+#else
+		(void) backend;
+#endif
+		return new pkmFFTNativePlan<T>(size, isa);
+	}
+	
+#if defined(PKM_FFT_HAVE_ACCELERATE)
+	template <typename T>
+	static std::shared_ptr<pkmFFTAccelerateSetup<T> > & largestSetup()
+	{
+		static std::shared_ptr<pkmFFTAccelerateSetup<T> > setup;
+		return setup;
+	}
+#endif
+	
+	std::mutex			mutex;
+	std::map<Key, Entry> entries;
+};
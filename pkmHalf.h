@@ -0,0 +1,193 @@
+/*
+ *  pkmHalf.h
+ *
+ *  16 bit floating point storage types: IEEE half and bfloat16
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  pkmHalf and pkmBFloat16 only store values: they convert from float with
+ *  round to nearest even and back to float exactly, so spectra can be
+ *  computed in float and kept at half the size.  Any output buffer of
+ *  pkmFFT/pkmSTFT may use them in place of float.
+ *
+ *      pkmHalf         11 bit significand, relative error <= 2^-11 (4.9e-4)
+ *                      from 6.1e-5 to 65504; larger values become inf, so
+ *                      magnitudes of long frames should be scaled or stored
+ *                      as log power
+ *      pkmBFloat16     8 bit significand, relative error <= 2^-8 (3.9e-3)
+ *                      over the normal float range
+ *
+ *  Usage:
+ *
+ *  pkmHalf h = 0.1f;
+ *  float f = h;
+ *
+ */
+#pragma once
+
+#include <string.h>
+#include <stdint.h>
+
+struct pkmHalf
+{
+	uint16_t			bits;
+	
+	pkmHalf() {}
+	pkmHalf(float f)
+	{
+		uint32_t x;
+		memcpy(&x, &f, sizeof(x));
+		uint32_t sign = (x >> 16) & 0x8000, mag = x & 0x7fffffff;
+		if (mag >= 0x7f800000) {
+			// inf stays inf, nan stays a quiet nan
+			bits = (uint16_t) (sign | 0x7c00 | (mag > 0x7f800000 ? 0x200 : 0));
+		}
+		else if (mag >= 0x477ff000) {
+			// rounds past 65504
+			bits = (uint16_t) (sign | 0x7c00);
+		}
+		else if (mag < 0x38800000) {
+			// subnormal half: align to 2^-24 units and round to nearest even
+			int shift = 126 - (int) (mag >> 23);
+			if (shift > 24) {
+				bits = (uint16_t) sign;
+				return;
+			}
+			uint32_t m = (mag & 0x7fffff) | 0x800000;
+			uint32_t half = m >> (shift - 1), rest = m & ((1u << (shift - 1)) - 1);
+			uint32_t h = half >> 1;
+			if ((half & 1) && (rest || (h & 1)))
+				h++;
+			bits = (uint16_t) (sign | h);
+		}
+		else {
+			// rebias the exponent, round the 13 dropped bits to nearest even
+			uint32_t h = (mag - 0x38000000) >> 13, rest = mag & 0x1fff;
+			if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+				h++;
+			bits = (uint16_t) (sign | h);
+		}
+	}
+	
+	operator float() const
+	{
+		uint32_t sign = (uint32_t) (bits & 0x8000) << 16, exponent = (bits >> 10) & 0x1f, m = bits & 0x3ff, x;
+		if (exponent == 0x1f) {
+			x = sign | 0x7f800000 | (m << 13);
+		}
+		else if (exponent) {
+			x = sign | ((exponent + 112) << 23) | (m << 13);
+		}
+		else if (m) {
+			// subnormal: normalise into float's range
+			exponent = 113;
+			while (!(m & 0x400)) {
+				m <<= 1;
+				exponent--;
+			}
+			x = sign | (exponent << 23) | ((m & 0x3ff) << 13);
+		}
+		else {
+			x = sign;
+		}
+		float f;
+		memcpy(&f, &x, sizeof(f));
+		return f;
+	}
+};
+
+struct pkmBFloat16
+{
+	uint16_t			bits;
+	
+	pkmBFloat16() {}
+	pkmBFloat16(float f)
+	{
+		uint32_t x;
+		memcpy(&x, &f, sizeof(x));
+		if ((x & 0x7fffffff) > 0x7f800000)
+			bits = (uint16_t) ((x >> 16) | 0x40);
+		else
+			bits = (uint16_t) ((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+	}
+	
+	operator float() const
+	{
+		uint32_t x = (uint32_t) bits << 16;
+		float f;
+		memcpy(&f, &x, sizeof(f));
+		return f;
+	}
+};
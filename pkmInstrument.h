@@ -0,0 +1,358 @@
+/*
+ *  pkmInstrument.h
+ *
+ *  Per-stage counters for the FFT, STFT and DCT hot paths
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  Built with -DPKM_INSTRUMENT, pkmFFT, pkmSTFT and pkmDCT count the time
+ *  (in cpu ticks), calls and bytes moved of each stage of their hot paths:
+ *
+ *      PKM_STAGE_WINDOW        windowing before the forward transform
+ *      PKM_STAGE_PACK          real samples into split complex (ctoz); the
+ *                              batch paths window while packing, so their
+ *                              windowing is counted here
+ *      PKM_STAGE_TRANSFORM     the FFT plan
+ *      PKM_STAGE_POLAR         split complex bins to the output, in polar
+ *                              or any other output mode
+ *      PKM_STAGE_RECT          polar bins back to rectangular
+ *      PKM_STAGE_UNPACK        split complex to real samples (ztoc); the
+ *                              batch inverse unpacks while overlap-adding
+ *      PKM_STAGE_OVERLAP_ADD   scaling, synthesis window and overlap-add
+ *      PKM_STAGE_STFT_PAD      pkmSTFT's padded copy and allocations
+ *      PKM_STAGE_STFT_OVERLAP_ADD  ISTFT summing frames into the signal
+ *      PKM_STAGE_DCT_MIRROR    pkmDCT's even/odd reordering and its inverse
+ *                              (with the lane packing in the batch paths)
+ *      PKM_STAGE_DCT_TWIDDLE   pkmDCT's pre and post twiddles
+ *
+ *  Without PKM_INSTRUMENT the macros compile to nothing and the counters
+ *  stay zero.  When enabled, each thread adds to its own counters, so a
+ *  stage costs two reads of the tick counter and no shared writes; a
+ *  snapshot sums every thread's.  Ticks are rdtsc on x86, the virtual
+ *  counter on ARM64 and nanoseconds elsewhere; getSeconds() converts them.
+ *
+ *  Usage:
+ *
+ *  pkmInstrument::reset();
+ *  stft.STFT(sample_data, buffer_size, magnitudes, phases);
+ *  pkmInstrumentSnapshot s = pkmInstrument::snapshot();
+ *  for (int i = 0; i < PKM_STAGE_COUNT; i++)
+ *      printf("%s: %llu calls, %.3f ms, %llu bytes\n", pkmInstrument::stageName((pkmStage) i),
+ *             (unsigned long long) s.calls[i], s.getSeconds((pkmStage) i) * 1e3, (unsigned long long) s.bytes[i]);
+ *
+ *  Instrumenting a sequence of stages:
+ *
+ *  PKM_INSTRUMENT_START(clock);
+ *  pack(...);
+ *  PKM_INSTRUMENT_LAP(clock, PKM_STAGE_PACK, bytes);		// time since START
+ *  transform(...);
+ *  PKM_INSTRUMENT_LAP(clock, PKM_STAGE_TRANSFORM, bytes);	// time since the last LAP
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifdef PKM_INSTRUMENT
+#define PKM_INSTRUMENT_START(clock)					uint64_t clock = pkmInstrument::now()
+#define PKM_INSTRUMENT_LAP(clock, stage, bytes)		pkmInstrument::lap(clock, stage, bytes)
+#else
+#define PKM_INSTRUMENT_START(clock)					((void) 0)
+#define PKM_INSTRUMENT_LAP(clock, stage, bytes)		((void) 0)
+#endif
+
+enum pkmStage
+{
+	PKM_STAGE_WINDOW = 0,
+	PKM_STAGE_PACK,
+	PKM_STAGE_TRANSFORM,
+	PKM_STAGE_POLAR,
+	PKM_STAGE_RECT,
+	PKM_STAGE_UNPACK,
+	PKM_STAGE_OVERLAP_ADD,
+	PKM_STAGE_STFT_PAD,
+	PKM_STAGE_STFT_OVERLAP_ADD,
+	PKM_STAGE_DCT_MIRROR,
+	PKM_STAGE_DCT_TWIDDLE,
+	PKM_STAGE_COUNT
+};
+
+// every thread's counters summed, less those at the last reset()
+struct pkmInstrumentSnapshot
+{
+	uint64_t			calls[PKM_STAGE_COUNT],
+						ticks[PKM_STAGE_COUNT],
+						bytes[PKM_STAGE_COUNT];
+	double				ticksPerSecond;
+	
+	double getSeconds(pkmStage stage) const
+	{
+		return ticks[stage] / ticksPerSecond;
+	}
+};
+
+class pkmInstrument
+{
+public:
+	
+	static bool isEnabled()
+	{
+#ifdef PKM_INSTRUMENT
+		return true;
+#else
+		return false;
+#endif
+	}
+	
+	static uint64_t now()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#elif defined(__aarch64__)
+		uint64_t t;
+		__asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (t));
+		return t;
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+	
+	static const char * stageName(pkmStage stage)
+	{
+		static const char *names[PKM_STAGE_COUNT] = {
+			"window", "pack", "transform", "polar", "rect", "unpack", "overlap_add",
+			"stft_pad", "stft_overlap_add", "dct_mirror", "dct_twiddle"
+		};
+		return stage >= 0 && stage < PKM_STAGE_COUNT ? names[stage] : "unknown";
+	}
+	
+	// charges the ticks since start to stage and restarts start
+	static void lap(uint64_t &start, pkmStage stage, uint64_t bytes)
+	{
+		uint64_t t = now();
+		add(stage, t - start, bytes);
+		start = t;
+	}
+	
+	static void add(pkmStage stage, uint64_t ticks, uint64_t bytes)
+	{
+		Counters &c = *local().counters;
+		increment(c.calls[stage], 1);
+		increment(c.ticks[stage], ticks);
+		increment(c.bytes[stage], bytes);
+	}
+	
+	static pkmInstrumentSnapshot snapshot()
+	{
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		pkmInstrumentSnapshot s = total(r);
+		for (int i = 0; i < PKM_STAGE_COUNT; i++) {
+			s.calls[i] -= r.baseline.calls[i];
+			s.ticks[i] -= r.baseline.ticks[i];
+			s.bytes[i] -= r.baseline.bytes[i];
+		}
+		s.ticksPerSecond = ticksPerSecond();
+		return s;
+	}
+	
+	// later snapshots count from here
+	static void reset()
+	{
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.baseline = total(r);
+	}
+	
+	// measured once against the steady clock
+	static double ticksPerSecond()
+	{
+		static const double rate = calibrate();
+		return rate;
+	}
+	
+private:
+	
+	struct Counters
+	{
+		std::atomic<uint64_t>	calls[PKM_STAGE_COUNT],
+								ticks[PKM_STAGE_COUNT],
+								bytes[PKM_STAGE_COUNT];
+		Counters()
+		{
+			for (int i = 0; i < PKM_STAGE_COUNT; i++)
+				calls[i] = ticks[i] = bytes[i] = 0;
+		}
+	};
+	
+	struct Registry
+	{
+		std::mutex				mutex;
+		std::vector<Counters *>	threads;
+		pkmInstrumentSnapshot	retired,		// threads that have exited
+								baseline;
+		Registry()
+		{
+			memset(&retired, 0, sizeof(retired));
+			memset(&baseline, 0, sizeof(baseline));
+		}
+	};
+	
+	// a thread's counters, folded into the registry when the thread exits
+	struct Local
+	{
+		Counters				*counters;
+		Local()
+		{
+			counters = new Counters();
+			Registry &r = registry();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			r.threads.push_back(counters);
+		}
+		~Local()
+		{
+			Registry &r = registry();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			for (int i = 0; i < PKM_STAGE_COUNT; i++) {
+				r.retired.calls[i] += counters->calls[i].load(std::memory_order_relaxed);
+				r.retired.ticks[i] += counters->ticks[i].load(std::memory_order_relaxed);
+				r.retired.bytes[i] += counters->bytes[i].load(std::memory_order_relaxed);
+			}
+			for (size_t i = 0; i < r.threads.size(); i++) {
+				if (r.threads[i] == counters) {
+					r.threads.erase(r.threads.begin() + i);
+					break;
+				}
+			}
+			delete counters;
+		}
+	};
+	
+	static Registry & registry()
+	{
+		static Registry r;
+		return r;
+	}
+	
+	static Local & local()
+	{
+		static thread_local Local l;
+		return l;
+	}
+	
+	// only the owning thread writes, so a relaxed load and store suffice and
+	// snapshots from other threads still read whole values
+	static void increment(std::atomic<uint64_t> &counter, uint64_t n)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+	
+	// call with the registry locked
+	static pkmInstrumentSnapshot total(Registry &r)
+	{
+		pkmInstrumentSnapshot s = r.retired;
+		for (size_t t = 0; t < r.threads.size(); t++) {
+			for (int i = 0; i < PKM_STAGE_COUNT; i++) {
+				s.calls[i] += r.threads[t]->calls[i].load(std::memory_order_relaxed);
+				s.ticks[i] += r.threads[t]->ticks[i].load(std::memory_order_relaxed);
+				s.bytes[i] += r.threads[t]->bytes[i].load(std::memory_order_relaxed);
+			}
+		}
+		return s;
+	}
+	
+	static double calibrate()
+	{
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		uint64_t ticks = now();
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		uint64_t elapsedTicks = now() - ticks;
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return elapsed > 0 ? elapsedTicks / elapsed : 1e9;
+#else
+		return 1e9;
+#endif
+	}
+};
@@ -0,0 +1,364 @@
+/*
+ *  pkmLockFree.h
+ *
+ *  Wait-free single producer, single consumer buffers for handing samples and frames between threads
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  Three buffers for passing data between exactly one producer thread and
+ *  one consumer thread without locks or allocation after construction.
+ *  Every call finishes in a bounded number of steps whatever the other
+ *  thread is doing (wait-free), so either side can be an audio callback:
+ *
+ *      pkmSPSCRing<T>          a ring of values copied in and out in blocks;
+ *                              write takes what fits and read what is there
+ *      pkmSPSCFrameQueue<T>    a queue of fixed-size frames filled and read
+ *                              in place, each with a position stamp
+ *      pkmTripleBuffer<T>      the newest of a stream of frames; the
+ *                              producer never waits for the consumer and the
+ *                              consumer skips any frames it was too slow for
+ *
+ *  The ring and queue keep a monotonic write and read count, each on its
+ *  own cache line, published with release stores and read with acquire
+ *  loads.  The triple buffer swaps slot indices through one atomic word.
+ *  Values are moved with memcpy, so T must be trivially copyable.
+ *
+ *  Usage:
+ *
+ *  pkmSPSCRing<float> ring(8192);
+ *  ring.write(input, numSamples);          // producer, returns how many fit
+ *  ring.read(block, 512);                  // consumer, returns how many came
+ *
+ *  pkmTripleBuffer<float> latest(257);
+ *  float *frame = latest.writeFrame();     // producer fills it, then
+ *  latest.publish(position);
+ *  if (latest.update())                    // consumer, true when newer
+ *      draw(latest.readFrame());
+ *
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <stdint.h>
+
+// a counter alone on its cache line, so the producer's and consumer's
+// counters never share one
+struct pkmSPSCIndex
+{
+	std::atomic<uint64_t> value;
+	char				padding[64 - sizeof(std::atomic<uint64_t>)];
+};
+
+template <typename T>
+class pkmSPSCRing
+{
+public:
+	
+	pkmSPSCRing(int capacity)
+	{
+		writeIndex.value.store(0);
+		readIndex.value.store(0);
+		size = capacity > 0 ? capacity : 1;
+		data = (T *) calloc(size, sizeof(T));
+		if (data == NULL) {
+			printf("\npkmSPSCRing failed to allocate enough memory.\n");
+			size = 0;
+		}
+	}
+	~pkmSPSCRing()
+	{
+		free(data);
+	}
+	
+	// producer: copies in as many of count values as fit, returns how many
+	int write(const T *values, int count)
+	{
+		const uint64_t w = writeIndex.value.load(std::memory_order_relaxed);
+		const uint64_t r = readIndex.value.load(std::memory_order_acquire);
+		const int n = count < size - (int) (w - r) ? count : size - (int) (w - r);
+		if (n <= 0)
+			return 0;
+		const int start = (int) (w % size), first = n < size - start ? n : size - start;
+		memcpy(data + start, values, sizeof(T) * first);
+		memcpy(data, values + first, sizeof(T) * (n - first));
+		writeIndex.value.store(w + n, std::memory_order_release);
+		return n;
+	}
+	
+	// consumer: copies out up to count values, returns how many
+	int read(T *values, int count)
+	{
+		const uint64_t r = readIndex.value.load(std::memory_order_relaxed);
+		const uint64_t w = writeIndex.value.load(std::memory_order_acquire);
+		const int n = count < (int) (w - r) ? count : (int) (w - r);
+		if (n <= 0)
+			return 0;
+		const int start = (int) (r % size), first = n < size - start ? n : size - start;
+		memcpy(values, data + start, sizeof(T) * first);
+		memcpy(values + first, data, sizeof(T) * (n - first));
+		readIndex.value.store(r + n, std::memory_order_release);
+		return n;
+	}
+	
+	// values the consumer can read; exact on the consumer's thread, a lower
+	// bound anywhere else
+	int readAvailable() const
+	{
+		return (int) (writeIndex.value.load(std::memory_order_acquire) - readIndex.value.load(std::memory_order_acquire));
+	}
+	
+	// room the producer can write into; exact on the producer's thread
+	int writeAvailable() const
+	{
+		return size - readAvailable();
+	}
+	
+	int getCapacity() const
+	{
+		return size;
+	}
+	
+private:
+	
+	pkmSPSCIndex		writeIndex,
+						readIndex;
+	T					*data;
+	int					size;
+};
+
+template <typename T>
+class pkmSPSCFrameQueue
+{
+public:
+	
+	pkmSPSCFrameQueue(int frameSize, int maxFrames)
+	{
+		writeIndex.value.store(0);
+		readIndex.value.store(0);
+		size = frameSize;
+		slots = maxFrames > 0 ? maxFrames : 1;
+		data = (T *) calloc((size_t) size * slots, sizeof(T));
+		positions = (long long *) calloc(slots, sizeof(long long));
+		if (data == NULL || positions == NULL) {
+			printf("\npkmSPSCFrameQueue failed to allocate enough memory.\n");
+			slots = 0;
+		}
+	}
+	~pkmSPSCFrameQueue()
+	{
+		free(data);
+		free(positions);
+	}
+	
+	// producer: the next slot to fill, NULL while the queue is full
+	T * writeFrame()
+	{
+		const uint64_t w = writeIndex.value.load(std::memory_order_relaxed);
+		if (w - readIndex.value.load(std::memory_order_acquire) >= (uint64_t) slots)
+			return NULL;
+		return data + (long) (w % slots) * size;
+	}
+	
+	// producer: makes the slot writeFrame() gave readable
+	void publish(long long position)
+	{
+		const uint64_t w = writeIndex.value.load(std::memory_order_relaxed);
+		positions[w % slots] = position;
+		writeIndex.value.store(w + 1, std::memory_order_release);
+	}
+	
+	// consumer: the oldest frame, NULL while the queue is empty; it stays
+	// valid until release()
+	const T * readFrame() const
+	{
+		const uint64_t r = readIndex.value.load(std::memory_order_relaxed);
+		if (writeIndex.value.load(std::memory_order_acquire) == r)
+			return NULL;
+		return data + (long) (r % slots) * size;
+	}
+	
+	// consumer: the position the oldest frame was published with
+	long long readPosition() const
+	{
+		return positions[readIndex.value.load(std::memory_order_relaxed) % slots];
+	}
+	
+	// consumer: hands the oldest frame's slot back to the producer
+	void release()
+	{
+		const uint64_t r = readIndex.value.load(std::memory_order_relaxed);
+		readIndex.value.store(r + 1, std::memory_order_release);
+	}
+	
+	int framesAvailable() const
+	{
+		return (int) (writeIndex.value.load(std::memory_order_acquire) - readIndex.value.load(std::memory_order_acquire));
+	}
+	
+	int getFrameSize() const
+	{
+		return size;
+	}
+	
+private:
+	
+	pkmSPSCIndex		writeIndex,
+						readIndex;
+	T					*data;
+	long long			*positions;
+	int					size,
+						slots;
+};
+
+template <typename T>
+class pkmTripleBuffer
+{
+public:
+	
+	// frames start as zeros with position -1
+	pkmTripleBuffer(int frameSize)
+	{
+		size = frameSize;
+		data = (T *) calloc((size_t) size * 3, sizeof(T));
+		if (data == NULL) {
+			printf("\npkmTripleBuffer failed to allocate enough memory.\n");
+		}
+		for (int i = 0; i < 3; i++)
+			positions[i] = -1;
+		front = 0;
+		middle.store(1);
+		back = 2;
+	}
+	~pkmTripleBuffer()
+	{
+		free(data);
+	}
+	
+	// producer: the slot to fill next
+	T * writeFrame()
+	{
+		return data + (long) back * size;
+	}
+	
+	// producer: swaps the filled slot in as the newest frame
+	void publish(long long position)
+	{
+		positions[back] = position;
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & SLOT;
+	}
+	
+	// consumer: takes the newest frame if one was published since the last
+	// update; false leaves readFrame() as it was
+	bool update()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & FRESH))
+			return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & SLOT;
+		return true;
+	}
+	
+	// consumer: the frame update() took, valid until the next update()
+	const T * readFrame() const
+	{
+		return data + (long) front * size;
+	}
+	
+	long long readPosition() const
+	{
+		return positions[front];
+	}
+	
+	int getFrameSize() const
+	{
+		return size;
+	}
+	
+private:
+	
+	// the middle word holds a slot index and whether it is newer than front
+	enum { SLOT = 3, FRESH = 4 };
+	
+	T					*data;
+	long long			positions[3];
+	int					size,
+						front;			// the consumer's slot
+	char				frontPadding[64];
+	int					back;			// the producer's slot
+	char				backPadding[64];
+	std::atomic<int>	middle;
+};
@@ -0,0 +1,294 @@
+/*
+ *  pkmMFCC.h
+ *
+ *  Fused MFCC extractor: power spectrum, sparse mel filterbank, log, DCT
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  pkmMFCC goes from audio straight to cepstral coefficients one frame at a
+ *  time: pkmFFT's power spectrum of the Hann windowed frame, numFilters
+ *  triangular mel filters, the natural log, and the first numCoefficients
+ *  of an orthonormal DCT-II (pkmDCT).  No magnitude or phase matrix is
+ *  built; the only spectrum held is one block of framesPerBatch frames.
+ *
+ *  The filterbank is built once by the constructor and stored sparsely, as
+ *  each filter's first bin and its run of non-zero weights, so applying it
+ *  costs one short dot product per filter instead of a dense bins x
+ *  filters product.  Filters are HTK style triangles with unit peaks,
+ *  spaced evenly on mel(f) = 2595 log10(1 + f/700) between minFrequency and
+ *  maxFrequency (0 means sampleRate / 2).  Powers carry pkmFFT's 2X[k]
+ *  scale, which only offsets coefficient 0.
+ *
+ *  Nothing is allocated after the constructor.
+ *
+ *  Usage:
+ *
+ *  pkmMFCC mfcc(1024, 44100);                  // 40 filters, 13 coefficients
+ *  float coefficients[13];
+ *  mfcc.compute(frame, coefficients);          // fftSize samples
+ *
+ *  // every hopSize samples of a buffer, one row of 13 per frame
+ *  int frames = mfcc.getNumFrames(buffer_size);
+ *  float *rows = (float *) malloc (sizeof(float) * frames * 13);
+ *  mfcc.compute(buffer, buffer_size, rows);
+ *
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "pkmFFT.h"
+#include "pkmDCT.h"
+
+template <typename T>
+class pkmBasicMFCC
+{
+public:
+	
+	pkmBasicMFCC(int size, 
+				 int sampleRate = 44100, 
+				 int numFilters = 40, 
+				 int numCoefficients = 13, 
+				 int hop = 0, 
+				 float minFrequency = 0, 
+				 float maxFrequency = 0)
+	{
+		fftSize = size;
+		hopSize = hop ? hop : fftSize/4;
+		filters = numFilters;
+		coefficients = std::min(numCoefficients, numFilters);
+		framesPerBatch = 16;
+		
+		// the batch buffers too, which forwardBatch would otherwise make on
+		// the first multi-frame compute()
+		FFT = new pkmBasicFFT<T>(fftSize);
+		FFT->allocateBatch();
+		fftBins = FFT->fftSizeOver2;
+		
+		dct.setup(2 * filters);
+		
+		power = (T *) malloc(sizeof(T) * fftBins * framesPerBatch);
+		melEnergies = (T *) malloc(sizeof(T) * filters * framesPerBatch);
+		
+		makeFilterbank(sampleRate, minFrequency, maxFrequency > 0 ? maxFrequency : sampleRate / 2.0f);
+	}
+	
+	~pkmBasicMFCC()
+	{
+		delete FFT;
+		free(power);
+		free(melEnergies);
+	}
+	
+	// coefficients of one frame of fftSize samples
+	template <typename S>
+	void compute(const T *frame, S *result)
+	{
+		FFT->forward(0, (T *) frame, PKM_FFT_OUTPUT_POWER, power);
+		applyFilterbank(power, melEnergies);
+		dct.dctII_1D(melEnergies, result, coefficients);
+	}
+	
+	// coefficients of getNumFrames(bufSize) frames every hopSize samples,
+	// numCoefficients per row of result; returns the number of frames
+	template <typename S>
+	int compute(const T *buffer, int bufSize, S *result)
+	{
+		const int numFrames = getNumFrames(bufSize);
+		for (int f0 = 0; f0 < numFrames; f0 += framesPerBatch) {
+			const int frames = std::min(framesPerBatch, numFrames - f0);
+			FFT->forwardBatch(buffer + (long) f0*hopSize, hopSize, frames, PKM_FFT_OUTPUT_POWER, power);
+			for (int f = 0; f < frames; f++)
+				applyFilterbank(power + (long) f*fftBins, melEnergies + (long) f*filters);
+			dct.dctII_batch(melEnergies, result + (long) f0*coefficients, frames, coefficients);
+		}
+		return numFrames;
+	}
+	
+	// whole frames in bufSize samples; there is no padding
+	int getNumFrames(int bufSize) const
+	{
+		return bufSize < fftSize ? 0 : (bufSize - fftSize)/hopSize + 1;
+	}
+	
+	int getNumCoefficients() const
+	{
+		return coefficients;
+	}
+	
+	int getNumFilters() const
+	{
+		return filters;
+	}
+	
+	int getHopSize() const
+	{
+		return hopSize;
+	}
+	
+	// filter m weights bins [getFilterStart(m), + getFilterLength(m))
+	int getFilterStart(int m) const
+	{
+		return filterStart[m];
+	}
+	
+	int getFilterLength(int m) const
+	{
+		return filterOffset[m+1] - filterOffset[m];
+	}
+	
+	const T * getFilterWeights(int m) const
+	{
+		return &filterWeights[filterOffset[m]];
+	}
+	
+private:
+	
+	static double hzToMel(double f)
+	{
+		return 2595.0 * log10(1.0 + f / 700.0);
+	}
+	
+	static double melToHz(double m)
+	{
+		return 700.0 * (pow(10.0, m / 2595.0) - 1.0);
+	}
+	
+	// triangles over filters + 2 mel spaced edges; only the bins inside
+	// each triangle are kept
+	void makeFilterbank(int sampleRate, double minFrequency, double maxFrequency)
+	{
+		std::vector<double> edges(filters + 2);
+		const double lo = hzToMel(minFrequency), hi = hzToMel(maxFrequency);
+		for (int m = 0; m < filters + 2; m++)
+			edges[m] = melToHz(lo + (hi - lo) * m / (filters + 1));
+		
+		const double binWidth = (double) sampleRate / fftSize;
+		filterStart.resize(filters);
+		filterOffset.resize(filters + 1);
+		filterWeights.clear();
+		for (int m = 0; m < filters; m++) {
+			const double left = edges[m], center = edges[m+1], right = edges[m+2];
+			filterOffset[m] = (int) filterWeights.size();
+			filterStart[m] = 0;
+			for (int k = 0; k < fftBins; k++) {
+				const double f = k * binWidth;
+				if (f <= left || f >= right)
+					continue;
+				if (filterWeights.size() == (size_t) filterOffset[m])
+					filterStart[m] = k;
+				filterWeights.push_back((T) (f <= center ? (f - left) / (center - left) : (right - f) / (right - center)));
+			}
+		}
+		filterOffset[filters] = (int) filterWeights.size();
+	}
+	
+	// log of each filter's energy, floored so silence stays finite
+	void applyFilterbank(const T *spectrum, T *energies)
+	{
+		const T *w = filterWeights.data();
+		for (int m = 0; m < filters; m++) {
+			const T *p = spectrum + filterStart[m];
+			const int n = filterOffset[m+1] - filterOffset[m];
+			T sum = 0;
+			for (int i = 0; i < n; i++)
+				sum += w[i] * p[i];
+			w += n;
+			energies[m] = log(std::max(sum, (T) 1e-20));
+		}
+	}
+	
+	pkmBasicFFT<T>		*FFT;
+	pkmBasicDCT<T>		dct;
+	
+	std::vector<int>	filterStart,
+						filterOffset;		// into filterWeights, filters + 1
+	std::vector<T>		filterWeights;
+	
+	T					*power,				// framesPerBatch x fftBins
+						*melEnergies;		// framesPerBatch x filters
+	
+	int					fftSize,
+						fftBins,
+						hopSize,
+						filters,
+						coefficients,
+						framesPerBatch;
+};
+
+typedef pkmBasicMFCC<float> pkmMFCC;
+typedef pkmBasicMFCC<double> pkmMFCCD;
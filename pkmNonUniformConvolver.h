@@ -0,0 +1,435 @@
+/*
+ *  pkmNonUniformConvolver.h
+ *
+ *  Zero-latency non-uniformly partitioned convolution
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  pkmNonUniformConvolver runs long impulse responses at small block sizes.
+ *  The IR is cut into segments whose partitions double in size (Gardner's
+ *  scheme): the head, IR [0, 3B) for blocks of B samples, is a
+ *  pkmConvolver of B point partitions run on the audio thread; after it,
+ *  each segment has two partitions of N = 2B, 4B, ... up to
+ *  maxPartitionSize, and the last segment takes the rest of the IR in
+ *  partitions of that size.
+ *
+ *  Segment s with partitions of N starts at IR offset 2N - B, which gives
+ *  its FFTs a full period of N samples: the N input samples collected by
+ *  the audio thread become a job for a background worker, and the result
+ *  is not needed until N samples later.  The worker always runs the queued
+ *  job with the earliest deadline, so small segments go before large ones.
+ *  The audio thread never runs a job or waits for one: should the worker
+ *  fall behind, a segment whose job is not done by its deadline plays its
+ *  previous result again for that period and drops that period's input,
+ *  while the late job carries on.  Output degrades until the segment's
+ *  IR has passed but costs the audio thread nothing extra; 
+ *  getMissedDeadlines() counts these periods.
+ *
+ *  Per block the audio thread does one head convolution plus a copy in
+ *  and an add out of B samples per segment; the work of the tail is spread
+ *  over the worker.  Output lines up with input, with no latency beyond
+ *  the block.  One convolver handles numChannels channels with one worker
+ *  thread and shared IR spectra; process() never allocates or locks, and
+ *  only signals the worker when it is asleep with nothing queued.
+ *
+ *  Usage:
+ *
+ *  pkmNonUniformConvolver reverb(impulse_response, 5 * 48000, 32, 64);
+ *
+ *  // audio callback, 32 samples per channel
+ *  for (int c = 0; c < 64; c++)
+ *      reverb.process(c, inputs[c], outputs[c]);
+ *
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "pkmConvolver.h"
+#include "pkmDSP.h"
+
+template <typename T>
+class pkmBasicNonUniformConvolver
+{
+public:
+	
+	pkmBasicNonUniformConvolver(const T *ir, 
+								int irLength, 
+								int blockSize = 32, 
+								int numChannels = 1, 
+								int maxPartitionSize = 8192)
+	{
+		this->blockSize = blockSize;
+		channels = numChannels;
+		
+		const int headLength = std::min(irLength, 3 * blockSize);
+		headConvolver = new pkmBasicConvolver<T>(ir, headLength, blockSize, channels);
+		
+		// each segment starts where the last ended, at 2N - B
+		int offset = 3 * blockSize, size = 2 * blockSize;
+		while (offset < irLength) {
+			const bool bLast = 2 * size > maxPartitionSize;
+			const int length = bLast ? irLength - offset : std::min(irLength - offset, 2 * size);
+			
+			Segment *segment = new Segment;
+			segment->size = size;
+			segment->convolver = new pkmBasicConvolver<T>(ir + offset, length, size, channels);
+			segment->jobs = new Job[channels];
+			for (int c = 0; c < channels; c++) {
+				Job &job = segment->jobs[c];
+				job.input[0] = (T *) calloc(size, sizeof(T));
+				job.input[1] = (T *) calloc(size, sizeof(T));
+				job.output[0] = (T *) calloc(size, sizeof(T));
+				job.output[1] = (T *) calloc(size, sizeof(T));
+				job.state = JOB_IDLE;
+				job.deadline = 0;
+			}
+			segments.push_back(segment);
+			
+			offset += length;
+			size *= 2;
+		}
+		
+		samples = (long long *) calloc(channels, sizeof(long long));
+		pending = 0;
+		missed = 0;
+		bSleeping = false;
+		reset();
+		
+		bRunning = true;
+		if (!segments.empty())
+			worker = std::thread(&pkmBasicNonUniformConvolver::workerLoop, this);
+	}
+	
+	~pkmBasicNonUniformConvolver()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			bRunning = false;
+		}
+		wake.notify_one();
+		if (worker.joinable())
+			worker.join();
+		
+		for (size_t s = 0; s < segments.size(); s++) {
+			for (int c = 0; c < channels; c++) {
+				Job &job = segments[s]->jobs[c];
+				free(job.input[0]);
+				free(job.input[1]);
+				free(job.output[0]);
+				free(job.output[1]);
+			}
+			delete [] segments[s]->jobs;
+			delete segments[s]->convolver;
+			delete segments[s];
+		}
+		delete headConvolver;
+		free(samples);
+	}
+	
+	// blockSize samples of channel in, blockSize samples out; output may
+	// be the same buffer as input.  call from one thread per channel
+	void process(int channel, const T *input, T *output)
+	{
+		// the head reads all of input before writing output, so copy the
+		// block first for the segments
+		for (size_t s = 0; s < segments.size(); s++) {
+			Job &job = segments[s]->jobs[channel];
+			pkmDSP::copy(blockSize, input, 1, job.input[job.fill] + job.collected, 1);
+		}
+		
+		headConvolver->process(channel, input, output);
+		samples[channel] += blockSize;
+		
+		for (size_t s = 0; s < segments.size(); s++) {
+			Segment &segment = *segments[s];
+			Job &job = segment.jobs[channel];
+			job.collected += blockSize;
+			
+			// a period is complete: the last job's output is due now and
+			// the new input becomes the next job
+			if (job.collected == segment.size) {
+				job.collected = 0;
+				job.position = 0;
+				const int state = job.state.load(std::memory_order_acquire);
+				if (state == JOB_QUEUED || state == JOB_RUNNING) {
+					// late: play the last result again, drop this input
+					missed.fetch_add(1, std::memory_order_relaxed);
+				}
+				else {
+					if (state == JOB_DONE)
+						job.playing = job.computed;
+					job.computed = job.fill;
+					job.fill ^= 1;
+					job.deadline.store(samples[channel] + segment.size, std::memory_order_relaxed);
+					job.state.store(JOB_QUEUED, std::memory_order_release);
+					pending.fetch_add(1);
+					
+					// a sleeping worker is woken at most once, a busy one never
+					if (bSleeping.load() && bSleeping.exchange(false))
+						wake.notify_one();
+				}
+			}
+			
+			if (job.playing >= 0) {
+				const T *y = job.output[job.playing] + job.position;
+				for (int i = 0; i < blockSize; i++)
+					output[i] += y[i];
+				job.position += blockSize;
+			}
+		}
+	}
+	
+	// every channel at once
+	void process(const T * const *inputs, T * const *outputs)
+	{
+		for (int c = 0; c < channels; c++)
+			process(c, inputs[c], outputs[c]);
+	}
+	
+	// clears every channel, as if fed silence; not while process() runs,
+	// and it waits for any job the worker is running
+	void reset()
+	{
+		for (size_t s = 0; s < segments.size(); s++) {
+			for (int c = 0; c < channels; c++) {
+				Job &job = segments[s]->jobs[c];
+				cancel(job);
+				job.fill = 0;
+				job.computed = 0;
+				job.playing = -1;
+				job.collected = 0;
+				job.position = 0;
+			}
+			segments[s]->convolver->reset();
+		}
+		headConvolver->reset();
+		for (int c = 0; c < channels; c++)
+			samples[c] = 0;
+	}
+	
+	int getBlockSize() const
+	{
+		return blockSize;
+	}
+	
+	int getNumChannels() const
+	{
+		return channels;
+	}
+	
+	// partition size of segment 0 (the head) through getNumSegments() - 1
+	int getNumSegments() const
+	{
+		return 1 + (int) segments.size();
+	}
+	
+	int getSegmentPartitionSize(int s) const
+	{
+		return s == 0 ? blockSize : segments[s-1]->size;
+	}
+	
+	// periods a segment replayed its last result because the worker was
+	// late with the job due
+	long getMissedDeadlines() const
+	{
+		return missed.load(std::memory_order_relaxed);
+	}
+	
+private:
+	
+	enum
+	{
+		JOB_IDLE = 0,
+		JOB_QUEUED,
+		JOB_RUNNING,
+		JOB_DONE
+	};
+	
+	// one segment of one channel: input collects into input[fill] while
+	// the worker turns input[computed] into output[computed] and the audio
+	// thread plays output[playing]
+	struct Job
+	{
+		T					*input[2],
+							*output[2];
+		std::atomic<int>	state;
+		std::atomic<long long> deadline;	// in the channel's samples; read by the worker's scan
+		int					fill,
+							computed,
+							playing,
+							collected,
+							position;
+	};
+	
+	struct Segment
+	{
+		int						size;
+		pkmBasicConvolver<T>	*convolver;
+		Job						*jobs;		// one per channel
+	};
+	
+	void run(Segment &segment, int channel)
+	{
+		Job &job = segment.jobs[channel];
+		segment.convolver->process(channel, job.input[job.computed], job.output[job.computed]);
+		job.state.store(JOB_DONE, std::memory_order_release);
+	}
+	
+	// takes a queued job back from the worker, or waits for a running one
+	void cancel(Job &job)
+	{
+		int expected = JOB_QUEUED;
+		if (job.state.compare_exchange_strong(expected, JOB_IDLE, std::memory_order_acquire))
+			pending.fetch_sub(1, std::memory_order_relaxed);
+		else if (expected == JOB_RUNNING)
+			while (job.state.load(std::memory_order_acquire) != JOB_DONE)
+				std::this_thread::yield();
+		job.state.store(JOB_IDLE, std::memory_order_relaxed);
+	}
+	
+	// earliest deadline first over every queued job
+	void workerLoop()
+	{
+		for (;;) {
+			{
+				// the audio thread posts without the lock, so a wakeup can
+				// be missed; the timeout bounds how late that makes a job.
+				// bSleeping is set before pending is read and read after
+				// pending is raised, so one side always sees the other
+				std::unique_lock<std::mutex> lock(mutex);
+				bSleeping.store(true);
+				while (bRunning && pending.load() == 0)
+					wake.wait_for(lock, std::chrono::milliseconds(1));
+				bSleeping.store(false);
+				if (!bRunning)
+					return;
+			}
+			
+			for (;;) {
+				Segment *best = NULL;
+				int bestChannel = 0;
+				long long bestDeadline = 0;
+				for (size_t s = 0; s < segments.size(); s++) {
+					for (int c = 0; c < channels; c++) {
+						Job &job = segments[s]->jobs[c];
+						if (job.state.load(std::memory_order_acquire) != JOB_QUEUED)
+							continue;
+						const long long deadline = job.deadline.load(std::memory_order_relaxed);
+						if (best == NULL || deadline < bestDeadline) {
+							best = segments[s];
+							bestChannel = c;
+							bestDeadline = deadline;
+						}
+					}
+				}
+				if (best == NULL)
+					break;
+				
+				int expected = JOB_QUEUED;
+				if (best->jobs[bestChannel].state.compare_exchange_strong(expected, JOB_RUNNING, std::memory_order_acquire)) {
+					pending.fetch_sub(1, std::memory_order_relaxed);
+					run(*best, bestChannel);
+				}
+			}
+		}
+	}
+	
+	pkmBasicNonUniformConvolver(const pkmBasicNonUniformConvolver &);
+	pkmBasicNonUniformConvolver & operator=(const pkmBasicNonUniformConvolver &);
+	
+	pkmBasicConvolver<T>		*headConvolver;
+	std::vector<Segment *>		segments;			// after the head
+	long long					*samples;			// processed per channel
+	
+	std::thread					worker;
+	std::mutex					mutex;
+	std::condition_variable		wake;
+	std::atomic<long>			pending,			// jobs queued and not yet taken
+								missed;
+	std::atomic<bool>			bSleeping;			// worker waiting with nothing queued
+	bool						bRunning;
+	
+	int							blockSize,
+								channels;
+};
+
+typedef pkmBasicNonUniformConvolver<float> pkmNonUniformConvolver;
+typedef pkmBasicNonUniformConvolver<double> pkmNonUniformConvolverD;
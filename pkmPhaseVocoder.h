@@ -0,0 +1,520 @@
+/*
+ *  pkmPhaseVocoder.h
+ *
+ *  Streaming phase vocoder for time stretching and pitch shifting
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  pkmPhaseVocoder stretches and pitch shifts a stream: push() input as it
+ *  arrives and pull() output as it is needed.  Frames are analysed every
+ *  analysis hop and overlap-added every synthesis hop, where
+ *
+ *      synthesis hop   fixed (fftSize/4 by default), so the window-sum
+ *                      normalization never changes
+ *      analysis hop    synthesis hop / (stretch * pitch), carried as a
+ *                      fraction so the average rate is exact
+ *
+ *  Each bin's phase advances by its instantaneous frequency, estimated
+ *  from the actual analysis hop between the last two frames, over the
+ *  synthesis hop.  setTimeStretch() and setPitchShift() therefore take
+ *  effect at the next frame without a discontinuity and may change every
+ *  block.  With identity phase locking (Laroche and Dolson), only spectral
+ *  peaks are advanced; the other bins keep their analysed phase offset
+ *  from the peak of their region, which keeps partials coherent and
+ *  removes most of the phasiness of a plain vocoder.
+ *
+ *  Pitch shifting stretches by the pitch ratio and resamples the result
+ *  with cubic interpolation, so the duration is kept.  Shifts up alias
+ *  whatever ends up above the Nyquist frequency.
+ *
+ *  The phase advance and wrapping are branch-free loops over the bins that
+ *  the compiler vectorizes; expected phase advances are wrapped in integer
+ *  arithmetic so they stay exact for long hops.  All buffers are allocated
+ *  by the constructor and the shared FFT plan comes from pkmFFTPlanCache,
+ *  so push/pull never allocate or lock, and a voice costs about
+ *  (12 fftSize + maxInput) values of memory; run as many as the core
+ *  has time for.
+ *
+ *  The stream starts from silence: with stretch and pitch 1 the output of
+ *  pull() is the input delayed by getLatency() = fftSize - hop samples.
+ *  Output is only made a hop at a time, so process() runs a fixed hop plus
+ *  8 samples (the resampler's lookahead) further behind, and its output is
+ *  the input delayed by getProcessLatency() for any block size, with no
+ *  gaps, at stretch 1 and a fixed pitch shift down to a ratio of 0.375.
+ *  Changing the pitch mid-stream can briefly leave a block short.
+ *
+ *  Usage:
+ *
+ *  pkmPhaseVocoder vocoder(2048, 512);
+ *  vocoder.setPitchShift(pow(2.0, 3 / 12.0));		// up 3 semitones
+ *
+ *  // audio callback
+ *  vocoder.process(input, output, numSamples);		// push, pull, silence if short
+ *
+ *  // or offline, stretching to 1.5 times the length
+ *  vocoder.setTimeStretch(1.5);
+ *  vocoder.push(input, numSamples);
+ *  int produced = vocoder.pull(output, maxOutput);
+ *
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "pkmFFT.h"
+#include "pkmFFTPlanCache.h"
+
+template <typename T>
+class pkmBasicPhaseVocoder
+{
+public:
+	
+	// maxInput is how many samples may wait in the input queue, 8 fftSize
+	// by default
+	pkmBasicPhaseVocoder(int size = 2048, int hop = 0, int maxInput = 0)
+	: FFT(size)
+	{
+		fftSize = size;
+		fftBins = FFT.fftSizeOver2;
+		synthesisHop = hop > 0 ? std::min(hop, fftSize) : fftSize / 4;
+		inputCapacity = (maxInput > 0 ? maxInput : 8 * fftSize) + fftSize;
+		synthCapacity = 2 * synthesisHop + 8;
+		
+		input = (T *) malloc(sizeof(T) * inputCapacity);
+		frame = (T *) malloc(sizeof(T) * fftSize);
+		accumulator = (T *) malloc(sizeof(T) * fftSize);
+		gain = (T *) malloc(sizeof(T) * fftSize);
+		synth = (T *) malloc(sizeof(T) * synthCapacity);
+		magnitudes = (T *) malloc(sizeof(T) * fftBins);
+		phases = (T *) malloc(sizeof(T) * fftBins);
+		previousPhases = (T *) malloc(sizeof(T) * fftBins);
+		synthesisPhases = (T *) malloc(sizeof(T) * fftBins);
+		advances = (T *) malloc(sizeof(T) * fftBins);
+		expected = (T *) malloc(sizeof(T) * fftBins);
+		synthesisAdvance = (T *) malloc(sizeof(T) * fftBins);
+		peaks = (int *) malloc(sizeof(int) * (fftBins + 1));
+		if (input == NULL || frame == NULL || accumulator == NULL || gain == NULL || synth == NULL ||
+			magnitudes == NULL || phases == NULL || previousPhases == NULL || synthesisPhases == NULL || 
+			advances == NULL || expected == NULL || synthesisAdvance == NULL || peaks == NULL) {
+			printf("\npkmPhaseVocoder failed to allocate enough memory.\n");
+			return;
+		}
+		
+		// what bin k turns through in a synthesis hop, 2 pi (k hop mod N) / N
+		for (int k = 0; k < fftBins; k++)
+			synthesisAdvance[k] = (T) (2.0 * M_PI * (((long) k * synthesisHop) % fftSize) / fftSize);
+		setSynthesisGain();
+		
+		stretch = 1;
+		pitch = 1;
+		bPhaseLocking = true;
+		reset();
+	}
+	~pkmBasicPhaseVocoder()
+	{
+		free(input);
+		free(frame);
+		free(accumulator);
+		free(gain);
+		free(synth);
+		free(magnitudes);
+		free(phases);
+		free(previousPhases);
+		free(synthesisPhases);
+		free(advances);
+		free(expected);
+		free(synthesisAdvance);
+		free(peaks);
+	}
+	
+	// back to silence with nothing queued; stretch and pitch are kept
+	void reset()
+	{
+		// the stream starts with fftSize - hop samples of silence, as
+		// pkmStreamingSTFT, so the first frame ends hop samples in
+		inputCount = fftSize - synthesisHop;
+		memset(input, 0, sizeof(T) * inputCount);
+		analysisPosition = 0;
+		lastFrameStart = 0;
+		bFirstFrame = true;
+		memset(accumulator, 0, sizeof(T) * fftSize);
+		accumulatorPos = 0;
+		
+		// the resampler reads synth[1] first, with synth[0] as the sample before
+		memset(synth, 0, sizeof(T) * synthCapacity);
+		synthCount = 1;
+		readPosition = 1;
+		processSilence = synthesisHop + processMargin;
+	}
+	
+	// output length / input length, between hop / fftSize and hop together
+	// with the pitch shift; takes effect from the next frame
+	void setTimeStretch(double ratio)
+	{
+		stretch = ratio > 0 ? ratio : 1;
+	}
+	
+	// frequency ratio, 2^(semitones / 12)
+	void setPitchShift(double ratio)
+	{
+		pitch = ratio > 0 ? ratio : 1;
+	}
+	
+	void setPhaseLocking(bool bLock)
+	{
+		bPhaseLocking = bLock;
+	}
+	
+	double getTimeStretch() const
+	{
+		return stretch;
+	}
+	
+	double getPitchShift() const
+	{
+		return pitch;
+	}
+	
+	// queues up to count samples; returns how many fitted
+	int push(const T *samples, int count)
+	{
+		// drop what no frame will read again
+		const long consumed = (long) analysisPosition;
+		if (inputCount + count > inputCapacity && consumed > 0) {
+			memmove(input, input + consumed, sizeof(T) * (inputCount - consumed));
+			inputCount -= (int) consumed;
+			analysisPosition -= consumed;
+			lastFrameStart -= consumed;
+		}
+		int n = std::min(count, inputCapacity - inputCount);
+		memcpy(input + inputCount, samples, sizeof(T) * n);
+		inputCount += n;
+		return n;
+	}
+	
+	// writes up to count samples, as many as the queued input allows
+	int pull(T *output, int count)
+	{
+		int produced = 0;
+		while (produced < count) {
+			if (pitch == 1 && readPosition == floor(readPosition)) {
+				// no resampling: copy straight out
+				int i = (int) readPosition;
+				int n = std::min(count - produced, synthCount - i);
+				if (n > 0) {
+					memcpy(output + produced, synth + i, sizeof(T) * n);
+					produced += n;
+					readPosition += n;
+					continue;
+				}
+			}
+			else {
+				// cubic Hermite through synth[i - 1 .. i + 2]
+				int i = (int) readPosition;
+				if (i + 2 < synthCount) {
+					const T t = (T) (readPosition - i);
+					const T y0 = synth[i - 1], y1 = synth[i], y2 = synth[i + 1], y3 = synth[i + 2];
+					const T c1 = (T) 0.5 * (y2 - y0);
+					const T c2 = y0 - (T) 2.5 * y1 + (T) 2 * y2 - (T) 0.5 * y3;
+					const T c3 = (T) 0.5 * (y3 - y0) + (T) 1.5 * (y1 - y2);
+					output[produced++] = ((c3 * t + c2) * t + c1) * t + y1;
+					readPosition += pitch;
+					continue;
+				}
+			}
+			if (!synthesize())
+				break;
+		}
+		return produced;
+	}
+	
+	// push and pull the same count, for effects at a fixed rate (stretch 1).
+	// the stream starts with getProcessLatency() - getLatency() samples of
+	// silence, so pull() always has the rest of a block ready; only a
+	// stretch below 1 or a pitch change can still leave it short, and that
+	// is silence too
+	void process(const T *samples, T *output, int count)
+	{
+		push(samples, count);
+		const int silent = std::min(count, processSilence);
+		memset(output, 0, sizeof(T) * silent);
+		processSilence -= silent;
+		int produced = silent + pull(output + silent, count - silent);
+		memset(output + produced, 0, sizeof(T) * (count - produced));
+	}
+	
+	// input samples queued but not yet analysed past
+	int getInputAvailable() const
+	{
+		return inputCount - (int) analysisPosition;
+	}
+	
+	// delay of pull() behind push() at stretch and pitch 1
+	int getLatency() const
+	{
+		return fftSize - synthesisHop;
+	}
+	
+	// delay of process(), whatever its block size: a hop and the
+	// resampler's lookahead more than getLatency()
+	int getProcessLatency() const
+	{
+		return getLatency() + synthesisHop + processMargin;
+	}
+	
+	int getHopSize() const
+	{
+		return synthesisHop;
+	}
+	
+	int getBins() const
+	{
+		return fftBins;
+	}
+	
+private:
+	
+	// pkmStreamingISTFT's weighting: the synthesis Hann window over the
+	// overlapping window products at the synthesis hop
+	void setSynthesisGain()
+	{
+		std::shared_ptr<const T> hann = pkmFFTPlanCache::instance().window<T>(fftSize, PKM_FFT_WINDOW_HANN);
+		const T *w = hann.get();
+		double peak = 0;
+		for (int i = 0; i < fftSize; i++) {
+			double sum = 0;
+			for (int j = i % synthesisHop; j < fftSize; j += synthesisHop)
+				sum += (double) w[j] * w[j];
+			gain[i] = (T) sum;
+			peak = std::max(peak, sum);
+		}
+		for (int i = 0; i < fftSize; i++)
+			gain[i] = gain[i] > 1e-6 * peak ? (T) (2.0 * w[i] / gain[i]) : (T) 0;
+	}
+	
+	// x wrapped to [-pi, pi]; no branches, so loops of it vectorize
+	static inline T wrap(T x)
+	{
+		const T r = x * (T) (0.5 / M_PI);
+		const int n = (int) (r + (r < 0 ? (T) -0.5 : (T) 0.5));
+		return x - (T) (2.0 * M_PI) * n;
+	}
+	
+	// analyses the next frame and adds a synthesis hop of samples to synth;
+	// false if the input does not reach that far yet
+	bool synthesize()
+	{
+		const long start = (long) analysisPosition;
+		if (start + fftSize > inputCount)
+			return false;
+		
+		FFT.forward(0, input + start, magnitudes, phases);
+		
+		if (bFirstFrame) {
+			memcpy(synthesisPhases, phases, sizeof(T) * fftBins);
+			bFirstFrame = false;
+		}
+		else {
+			advancePhases((int) (start - lastFrameStart));
+		}
+		memcpy(previousPhases, phases, sizeof(T) * fftBins);
+		lastFrameStart = start;
+		
+		double hop = synthesisHop / (stretch * pitch);
+		analysisPosition += std::min(std::max(hop, 1.0), (double) fftSize);
+		
+		overlapAdd();
+		return true;
+	}
+	
+	void advancePhases(int analysisHop)
+	{
+		// expected advance 2 pi (k hop mod N) / N, stepped in integers
+		const T toRadians = (T) (2.0 * M_PI / fftSize);
+		const int step = analysisHop % fftSize;
+		for (int k = 0, e = 0; k < fftBins; k++) {
+			expected[k] = toRadians * e;
+			e += step;
+			if (e >= fftSize)
+				e -= fftSize;
+		}
+		
+		// deviation from the bin frequency over the analysis hop, scaled to
+		// the synthesis hop
+		const T ratio = analysisHop > 0 ? (T) synthesisHop / analysisHop : (T) 0;
+		for (int k = 0; k < fftBins; k++) {
+			const T deviation = wrap(phases[k] - previousPhases[k] - expected[k]);
+			advances[k] = wrap(synthesisPhases[k] + synthesisAdvance[k] + deviation * ratio);
+		}
+		
+		int numPeaks = bPhaseLocking ? findPeaks() : 0;
+		if (numPeaks == 0) {
+			memcpy(synthesisPhases, advances, sizeof(T) * fftBins);
+			return;
+		}
+		
+		// identity locking: each bin keeps its analysed offset from the peak
+		// of its region, regions split halfway between peaks
+		for (int p = 0; p < numPeaks; p++) {
+			const int peak = peaks[p];
+			const int lo = p == 0 ? 0 : (peaks[p - 1] + peak + 1) / 2;
+			const int hi = p == numPeaks - 1 ? fftBins : (peak + peaks[p + 1] + 1) / 2;
+			const T offset = advances[peak] - phases[peak];
+			for (int k = lo; k < hi; k++)
+				synthesisPhases[k] = wrap(phases[k] + offset);
+		}
+	}
+	
+	// bins louder than their two neighbours on each side
+	int findPeaks()
+	{
+		int n = 0;
+		const T *m = magnitudes;
+		for (int k = 2; k < fftBins - 2; k++) {
+			if (m[k] > m[k - 1] && m[k] >= m[k + 1] && m[k] > m[k - 2] && m[k] >= m[k + 2])
+				peaks[n++] = k;
+		}
+		return n;
+	}
+	
+	void overlapAdd()
+	{
+		FFT.inverse(0, frame, magnitudes, synthesisPhases, false);
+		
+		// accumulator is a ring starting at accumulatorPos
+		const int first = fftSize - accumulatorPos;
+		for (int i = 0; i < first; i++)
+			accumulator[accumulatorPos + i] += frame[i] * gain[i];
+		for (int i = first; i < fftSize; i++)
+			accumulator[i - first] += frame[i] * gain[i];
+		
+		// keep the sample before the read position for the resampler, then
+		// append the finished hop
+		const int drop = std::min(synthCount, std::max(0, (int) readPosition - 1));
+		if (drop > 0) {
+			memmove(synth, synth + drop, sizeof(T) * (synthCount - drop));
+			synthCount -= drop;
+			readPosition -= drop;
+		}
+		for (int i = 0; i < synthesisHop; i++) {
+			synth[synthCount++] = accumulator[accumulatorPos];
+			accumulator[accumulatorPos] = 0;
+			accumulatorPos = accumulatorPos + 1 == fftSize ? 0 : accumulatorPos + 1;
+		}
+	}
+	
+	pkmBasicFFT<T>		FFT;
+	
+	T					*input,				// queued samples from the next frame's start on
+						*frame,
+						*accumulator,
+						*gain,				// synthesis window / window-sum
+						*synth,				// overlap-added output before resampling
+						*magnitudes,
+						*phases,
+						*previousPhases,
+						*synthesisPhases,
+						*advances,
+						*expected,
+						*synthesisAdvance;
+	int					*peaks;
+	
+	double				stretch,
+						pitch,
+						analysisPosition,	// into input
+						readPosition;		// into synth
+	long				lastFrameStart;
+	bool				bFirstFrame,
+						bPhaseLocking;
+	
+	int					fftSize,
+						fftBins,
+						synthesisHop,
+						inputCapacity,
+						inputCount,
+						synthCapacity,
+						synthCount,
+						accumulatorPos,
+						processSilence;		// left to output before process() pulls
+	
+	// samples process() runs behind pull() beyond a hop; the cubic resampler
+	// reads up to 3 / pitch synth samples ahead
+	enum { processMargin = 8 };
+};
+
+typedef pkmBasicPhaseVocoder<float> pkmPhaseVocoder;
+typedef pkmBasicPhaseVocoder<double> pkmPhaseVocoderD;
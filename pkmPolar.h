@@ -0,0 +1,375 @@
+/*
+ *  pkmPolar.h
+ *
+ *  Vectorized polar <-> rectangular conversion with selectable accuracy
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  pkmPolarKernels converts split complex bins to magnitude and phase and
+ *  back, straight between the separate real and imaginary arrays the FFT
+ *  works in, in one of three accuracies:
+ *
+ *      PKM_POLAR_EXACT     sqrt, atan2, cos and sin from libm per bin, as
+ *                          vDSP_polar / vDSP_rect
+ *      PKM_POLAR_FAST      phases within 2e-5 rad, magnitudes and
+ *                          rectangular values within 5e-6 relative
+ *      PKM_POLAR_FASTEST   phases within 5e-3 rad, the rest within 3e-3
+ *                          relative, e.g. for display or features that
+ *                          are quantized anyway
+ *
+ *  The fast tiers take atan2 as an odd polynomial of min(|x|,|y|)/max(|x|,|y|)
+ *  folded into the right octant, magnitudes as s * rsqrt(s) refined by
+ *  Newton steps from the usual bit estimate, and sin/cos as polynomials
+ *  after reducing the phase to a quarter turn.  Everything is selects and
+ *  bit operations, so the kernels are written once against pkmVec and
+ *  instantiated for each instruction set of pkmSIMD.h like the FFT kernels;
+ *  they are several times faster than the libm loop.  Phases are reduced
+ *  exactly enough for |phase| < 1e5; inputs must be finite.
+ *
+ *  Usage:
+ *
+ *  pkmPolarKernels<float> k = pkmPolarKernels<float>::select(PKM_POLAR_FAST);
+ *  k.polar(real, imag, magnitudes, phases, n);
+ *  k.rect(magnitudes, phases, real, imag, n);
+ *
+ *  pkmFFT and pkmSTFT take the accuracy with setPolarAccuracy().
+ *
+ */
+#pragma once
+
+#include <math.h>
+#include "pkmSIMD.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+enum pkmPolarAccuracy
+{
+	PKM_POLAR_EXACT = 0,
+	PKM_POLAR_FAST,
+	PKM_POLAR_FASTEST
+};
+
+// lane masks and bit operations on W lanes of T; masks are all ones or zero
+#if defined(PKM_SIMD_VECTOR_EXTENSIONS)
+template <typename T, int W>
+struct pkmPolarOps
+{
+	typedef typename pkmVec<T, W>::type V;
+	typedef decltype(V() < V()) I;
+	
+	static PKM_SIMD_INLINE I less(const V &a, const V &b)
+	{
+		return a < b;
+	}
+	static PKM_SIMD_INLINE I bits(const V &v)
+	{
+		return pkmVecLoad<I>(&v);
+	}
+	static PKM_SIMD_INLINE V value(const I &i)
+	{
+		return pkmVecLoad<V>(&i);
+	}
+	static PKM_SIMD_INLINE I splat(long long i)
+	{
+		return I() + (typename pkmVecIndex<T>::type) i;
+	}
+};
+#else
+template <typename T, int W>
+struct pkmPolarOps;
+#endif
+
+template <typename T>
+struct pkmPolarOps<T, 1>
+{
+	typedef T V;
+	typedef typename pkmVecIndex<T>::type I;
+	
+	static PKM_SIMD_INLINE I less(const V &a, const V &b)
+	{
+		return -(I) (a < b);
+	}
+	static PKM_SIMD_INLINE I bits(const V &v)
+	{
+		return pkmVecLoad<I>(&v);
+	}
+	static PKM_SIMD_INLINE V value(const I &i)
+	{
+		return pkmVecLoad<V>(&i);
+	}
+	static PKM_SIMD_INLINE I splat(long long i)
+	{
+		return (I) i;
+	}
+};
+
+// the constants each type needs for the fast tiers
+template <typename T>
+struct pkmPolarConstants;
+
+template <>
+struct pkmPolarConstants<float>
+{
+	static long long rsqrtMagic()	{ return 0x5f3759dfLL; }
+	static float roundMagic()		{ return 12582912.0f; }		// 1.5 * 2^23
+	static float tiny()				{ return 1.17549435e-38f; }
+};
+
+template <>
+struct pkmPolarConstants<double>
+{
+	static long long rsqrtMagic()	{ return 0x5fe6eb50c7b537a9LL; }
+	static double roundMagic()		{ return 6755399441055744.0; }	// 1.5 * 2^52
+	static double tiny()			{ return 2.2250738585072014e-308; }
+};
+
+// W bins from re/im to magnitude/phase
+template <typename T, int W, int A>
+PKM_SIMD_INLINE void pkmPolarLanes(const T *re, const T *im, T *magnitude, T *phase)
+{
+	typedef pkmPolarOps<T, W> O;
+	typedef typename O::V V;
+	typedef typename O::I I;
+	const I sign = O::splat(1LL << (8 * sizeof(T) - 1));
+	
+	const V x = pkmVecLoad<V>(re), y = pkmVecLoad<V>(im);
+	
+	// |X| = s / sqrt(s), from the bit estimate of 1 / sqrt(s) and Newton steps
+	const V s = x*x + y*y;
+	V r = O::value(O::splat(pkmPolarConstants<T>::rsqrtMagic()) - (O::bits(s) >> 1));
+	r = r * ((T) 1.5 - (T) 0.5 * s * r * r);
+	if (A == PKM_POLAR_FAST)
+		r = r * ((T) 1.5 - (T) 0.5 * s * r * r);
+	pkmVecStore(magnitude, s * r);
+	
+	// atan of the smaller over the larger of |x| and |y|, in [0, pi/4]
+	const V ax = O::value(O::bits(x) & ~sign), ay = O::value(O::bits(y) & ~sign);
+	const I swap = O::less(ax, ay);
+	const V mn = O::value((O::bits(ax) & swap) | (O::bits(ay) & ~swap));
+	V mx = O::value((O::bits(ay) & swap) | (O::bits(ax) & ~swap));
+	const I zero = O::less(mx, pkmVecSplat<V>(pkmPolarConstants<T>::tiny()));
+	mx = O::value((O::bits(pkmVecSplat<V>((T) 1)) & zero) | (O::bits(mx) & ~zero));
+	const V z = mn / mx, z2 = z * z;
+	V a;
+	if (A == PKM_POLAR_FAST)
+		a = z * ((T) 0.9998660 + z2 * ((T) -0.3302995 + z2 * ((T) 0.1801410 + 
+			z2 * ((T) -0.0851330 + z2 * (T) 0.0208351))));
+	else
+		a = z * ((T) 0.97239411 + z2 * (T) -0.19194795);
+	
+	// unfold into the octant of (x, y)
+	a = O::value((O::bits((T) (M_PI / 2) - a) & swap) | (O::bits(a) & ~swap));
+	const I left = O::less(x, pkmVecSplat<V>((T) 0));
+	a = O::value((O::bits((T) M_PI - a) & left) | (O::bits(a) & ~left));
+	pkmVecStore(phase, O::value(O::bits(a) | (O::bits(y) & sign)));
+}
+
+// W bins from magnitude/phase to re/im
+template <typename T, int W, int A>
+PKM_SIMD_INLINE void pkmRectLanes(const T *magnitude, const T *phase, T *re, T *im)
+{
+	typedef pkmPolarOps<T, W> O;
+	typedef typename O::V V;
+	typedef typename O::I I;
+	const T roundMagic = pkmPolarConstants<T>::roundMagic();
+	
+	const V m = pkmVecLoad<V>(magnitude), p = pkmVecLoad<V>(phase);
+	
+	// p = q pi/2 + r with |r| <= pi/4; the low bits of t hold q mod 4
+	const V t = p * (T) (2.0 / M_PI) + roundMagic;
+	const I q = O::bits(t);
+	const V qf = t - roundMagic;
+	const V r = p - qf * (T) 1.5703125 - qf * (T) (M_PI / 2 - 1.5703125), r2 = r * r;
+	V s, c;
+	if (A == PKM_POLAR_FAST) {
+		s = r + r * r2 * ((T) (-1.0 / 6) + r2 * ((T) (1.0 / 120) + r2 * (T) (-1.0 / 5040)));
+		c = (T) 1 + r2 * ((T) -0.5 + r2 * ((T) (1.0 / 24) + r2 * (T) (-1.0 / 720)));
+	}
+	else {
+		s = r + r * r2 * (T) (-1.0 / 6);
+		c = (T) 1 + r2 * ((T) -0.5 + r2 * (T) (1.0 / 24));
+	}
+	
+	// odd quarters swap sin and cos; the second bit of q (q + 1) flips sin (cos)
+	const I one = O::splat(1), two = O::splat(2);
+	const I swap = O::splat(0) - (q & one);
+	const int shift = 8 * sizeof(T) - 2;
+	const V sn = O::value(((O::bits(c) & swap) | (O::bits(s) & ~swap)) ^ ((q & two) << shift));
+	const V cs = O::value(((O::bits(s) & swap) | (O::bits(c) & ~swap)) ^ (((q + one) & two) << shift));
+	pkmVecStore(re, m * cs);
+	pkmVecStore(im, m * sn);
+}
+
+template <typename T, int W, int A>
+PKM_SIMD_INLINE void pkmPolarKernel(const T *re, const T *im, T *magnitude, T *phase, int n)
+{
+	int k = 0;
+	for (; k + W <= n; k += W)
+		pkmPolarLanes<T, W, A>(re + k, im + k, magnitude + k, phase + k);
+	for (; k < n; k++)
+		pkmPolarLanes<T, 1, A>(re + k, im + k, magnitude + k, phase + k);
+}
+
+template <typename T, int W, int A>
+PKM_SIMD_INLINE void pkmRectKernel(const T *magnitude, const T *phase, T *re, T *im, int n)
+{
+	int k = 0;
+	for (; k + W <= n; k += W)
+		pkmRectLanes<T, W, A>(magnitude + k, phase + k, re + k, im + k);
+	for (; k < n; k++)
+		pkmRectLanes<T, 1, A>(magnitude + k, phase + k, re + k, im + k);
+}
+
+// one entry point per instruction set and fast tier, as the FFT kernels
+#define PKM_POLAR_KERNEL_ENTRY_POINTS(SUFFIX, TARGET, LANES) \
+	TARGET static void polarFast##SUFFIX(const T *re, const T *im, T *magnitude, T *phase, int n) \
+	{ pkmPolarKernel<T, LANES, PKM_POLAR_FAST>(re, im, magnitude, phase, n); } \
+	TARGET static void polarFastest##SUFFIX(const T *re, const T *im, T *magnitude, T *phase, int n) \
+	{ pkmPolarKernel<T, LANES, PKM_POLAR_FASTEST>(re, im, magnitude, phase, n); } \
+	TARGET static void rectFast##SUFFIX(const T *magnitude, const T *phase, T *re, T *im, int n) \
+	{ pkmRectKernel<T, LANES, PKM_POLAR_FAST>(magnitude, phase, re, im, n); } \
+	TARGET static void rectFastest##SUFFIX(const T *magnitude, const T *phase, T *re, T *im, int n) \
+	{ pkmRectKernel<T, LANES, PKM_POLAR_FASTEST>(magnitude, phase, re, im, n); } \
+	static void set##SUFFIX(pkmPolarKernels &k) \
+	{ \
+		k.polar = k.accuracy == PKM_POLAR_FAST ? polarFast##SUFFIX : polarFastest##SUFFIX; \
+		k.rect = k.accuracy == PKM_POLAR_FAST ? rectFast##SUFFIX : rectFastest##SUFFIX; \
+	}
+
+template <typename T>
+struct pkmPolarKernels
+{
+	void				(*polar)(const T *re, const T *im, T *magnitude, T *phase, int n);
+	void				(*rect)(const T *magnitude, const T *phase, T *re, T *im, int n);
+	pkmPolarAccuracy	accuracy;
+	
+	static void polarExact(const T *re, const T *im, T *magnitude, T *phase, int n)
+	{
+		for (int k = 0; k < n; k++) {
+			T r = re[k], j = im[k];
+			magnitude[k] = sqrt(r*r + j*j);
+			phase[k] = atan2(j, r);
+		}
+	}
+	static void rectExact(const T *magnitude, const T *phase, T *re, T *im, int n)
+	{
+		for (int k = 0; k < n; k++) {
+			T mag = magnitude[k], ph = phase[k];
+			re[k] = mag * cos(ph);
+			im[k] = mag * sin(ph);
+		}
+	}
+	
+	PKM_POLAR_KERNEL_ENTRY_POINTS(Scalar, , 1)
+#if defined(PKM_SIMD_HAVE_SSE2) || defined(PKM_SIMD_HAVE_NEON)
+	PKM_POLAR_KERNEL_ENTRY_POINTS(128, , 16 / sizeof(T))
+#endif
+#if defined(PKM_SIMD_HAVE_AVX2)
+	PKM_POLAR_KERNEL_ENTRY_POINTS(AVX2, PKM_SIMD_TARGET("avx2,fma"), 32 / sizeof(T))
+#endif
+#if defined(PKM_SIMD_HAVE_AVX512)
+	PKM_POLAR_KERNEL_ENTRY_POINTS(AVX512, PKM_SIMD_TARGET("avx512f,avx2,fma"), 64 / sizeof(T))
+#endif
+	
+	static pkmPolarKernels select(pkmPolarAccuracy accuracy, pkmSIMDISA isa = pkmSIMDGetISA())
+	{
+		pkmPolarKernels k;
+		k.accuracy = accuracy;
+		if (accuracy == PKM_POLAR_EXACT) {
+			k.polar = polarExact;
+			k.rect = rectExact;
+			return k;
+		}
+		setScalar(k);
+		switch (isa) {
+#if defined(PKM_SIMD_HAVE_SSE2)
+			case PKM_ISA_SSE2:		set128(k); break;
+#endif
+#if defined(PKM_SIMD_HAVE_NEON)
+			case PKM_ISA_NEON:		set128(k); break;
+#endif
+#if defined(PKM_SIMD_HAVE_AVX2)
+			case PKM_ISA_AVX2:		setAVX2(k); break;
+#endif
+#if defined(PKM_SIMD_HAVE_AVX512)
+			case PKM_ISA_AVX512:	setAVX512(k); break;
+#endif
+			default:				break;
+		}
+		return k;
+	}
+};
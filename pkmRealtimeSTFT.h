@@ -0,0 +1,364 @@
+/*
+ *  pkmRealtimeSTFT.h
+ *
+ *  STFT analysis off the audio thread, fed and read without locks
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  pkmRealtimeSTFT splits pkmStreamingSTFT across threads so an audio
+ *  callback never runs an FFT, which at 8192 or 16384 points takes longer
+ *  than a small audio block should.  The audio thread only copies samples
+ *  into a pkmSPSCRing (pkmLockFree.h); a worker thread drains the ring
+ *  through a pkmStreamingSTFT and publishes every frame twice:
+ *
+ *      pop()           a pkmSPSCFrameQueue of maxFrames frames, for one
+ *                      consumer that needs every frame, such as features
+ *      updateLatest()  a pkmTripleBuffer holding the newest frame, for one
+ *                      consumer that only wants the current state, such as
+ *                      a display
+ *
+ *  push() is wait-free and allocation free: two atomic loads, at most two
+ *  memcpys and a release store, never a lock or a system call.  The worker
+ *  is never signalled; it sleeps for the poll interval (1 ms by default)
+ *  whenever less than a hop is waiting, so a frame is published within
+ *  about a poll interval plus one FFT of its last sample arriving.  With
+ *  startWorker false no thread is made and the host calls process() from
+ *  a thread of its own instead.
+ *
+ *  Nothing blocks when a side falls behind; it is counted instead:
+ *
+ *      getOverruns()       push calls that found the ring full; the samples
+ *                          that did not fit (getDroppedSamples()) are lost,
+ *                          so frames after them skip ahead in time
+ *      getDroppedFrames()  frames the worker made while the queue was full
+ *      getUnderruns()      pop calls that found the queue empty
+ *
+ *  Frame positions count the samples that reached the analysis, as
+ *  pkmStreamingSTFT::framePosition() does; without overruns that is the
+ *  audio thread's own count.  Each side must stay on one thread: push()
+ *  on the producer's, pop() and updateLatest() each on one consumer's.
+ *
+ *  Usage:
+ *
+ *  pkmRealtimeSTFT analysis(16384, 4096);
+ *  float magnitudes[8193], phases[8193];
+ *
+ *  // audio callback
+ *  analysis.push(input, numSamples);
+ *
+ *  // feature thread
+ *  while (analysis.pop(magnitudes, phases))
+ *      process(magnitudes, phases);
+ *
+ *  // display thread
+ *  if (analysis.updateLatest())
+ *      draw(analysis.latestMagnitudes(), analysis.getBins());
+ *
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "pkmStreamingSTFT.h"
+#include "pkmLockFree.h"
+
+class pkmRealtimeSTFT
+{
+public:
+	
+	// ringSize samples between the threads (4 fftSize when 0) and maxFrames
+	// frames for pop()
+	pkmRealtimeSTFT(int size, int hop = 0, int ringSize = 0, int maxFrames = 64, bool startWorker = true)
+	{
+		stft = new pkmStreamingSTFT(size, hop, blockFrames);
+		fftBins = stft->getBins();
+		hopSize = stft->getHopSize();
+		
+		ring = new pkmSPSCRing<float>(ringSize > 0 ? ringSize : 4 * size);
+		queue = new pkmSPSCFrameQueue<float>(2 * fftBins, maxFrames);
+		latest = new pkmTripleBuffer<float>(2 * fftBins);
+		block = (float *) malloc(sizeof(float) * hopSize * blockFrames);
+		if (block == NULL) {
+			printf("\npkmRealtimeSTFT failed to allocate enough memory.\n");
+		}
+		
+		samplesPushed.store(0);
+		overruns.store(0);
+		droppedSamples.store(0);
+		droppedFrames.store(0);
+		underruns.store(0);
+		pollInterval.store(1000);
+		bRunning.store(false);
+		
+		if (startWorker)
+			start();
+	}
+	~pkmRealtimeSTFT()
+	{
+		stop();
+		delete stft;
+		delete ring;
+		delete queue;
+		delete latest;
+		free(block);
+	}
+	
+	// starts the worker thread if it is not running
+	void start()
+	{
+		if (bRunning.load())
+			return;
+		bRunning.store(true);
+		worker = std::thread(&pkmRealtimeSTFT::workerLoop, this);
+	}
+	
+	// stops the worker after its current pass; queued frames stay readable
+	void stop()
+	{
+		if (!bRunning.load())
+			return;
+		bRunning.store(false);
+		worker.join();
+	}
+	
+	// microseconds the worker sleeps when there is less than a hop to do
+	void setPollInterval(int microseconds)
+	{
+		pollInterval.store(microseconds > 0 ? microseconds : 1);
+	}
+	
+	// audio thread: returns how many of the samples fit in the ring
+	int push(const float *samples, int count)
+	{
+		const int written = ring->write(samples, count);
+		samplesPushed.fetch_add(written, std::memory_order_relaxed);
+		if (written < count) {
+			overruns.fetch_add(1, std::memory_order_relaxed);
+			droppedSamples.fetch_add(count - written, std::memory_order_relaxed);
+		}
+		return written;
+	}
+	
+	// worker: analyses everything waiting in the ring and publishes the
+	// frames; returns how many were made
+	int process()
+	{
+		int made = 0, n;
+		while ((n = ring->read(block, hopSize * blockFrames)) > 0) {
+			stft->push(block, n);
+			while (stft->framesAvailable()) {
+				// the newest-frame slot first, then a copy for the queue
+				const long long position = stft->framePosition();
+				float *frame = latest->writeFrame();
+				stft->pop(frame, frame + fftBins);
+				
+				float *slot = queue->writeFrame();
+				if (slot) {
+					memcpy(slot, frame, sizeof(float) * 2 * fftBins);
+					queue->publish(position);
+				}
+				else {
+					droppedFrames.fetch_add(1, std::memory_order_relaxed);
+				}
+				latest->publish(position);
+				made++;
+			}
+		}
+		return made;
+	}
+	
+	// feature consumer: copies out the oldest queued frame (either pointer
+	// may be NULL) and removes it; false, counted as an underrun, when empty
+	bool pop(float *magnitude = NULL, float *phase = NULL)
+	{
+		const float *frame = queue->readFrame();
+		if (frame == NULL) {
+			underruns.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		if (magnitude)
+			memcpy(magnitude, frame, sizeof(float) * fftBins);
+		if (phase)
+			memcpy(phase, frame + fftBins, sizeof(float) * fftBins);
+		queue->release();
+		return true;
+	}
+	
+	int framesAvailable() const
+	{
+		return queue->framesAvailable();
+	}
+	
+	// position of the oldest queued frame, or -1
+	long long framePosition() const
+	{
+		return queue->readFrame() ? queue->readPosition() : -1;
+	}
+	
+	// display consumer: takes the newest frame if there is one it has not
+	// seen; the latest* pointers stay valid until the next call
+	bool updateLatest()
+	{
+		return latest->update();
+	}
+	
+	const float * latestMagnitudes() const
+	{
+		return latest->readFrame();
+	}
+	
+	const float * latestPhases() const
+	{
+		return latest->readFrame() + fftBins;
+	}
+	
+	// position of the frame updateLatest() took, -1 before the first
+	long long latestPosition() const
+	{
+		return latest->readPosition();
+	}
+	
+	int getBins() const
+	{
+		return fftBins;
+	}
+	
+	int getHopSize() const
+	{
+		return hopSize;
+	}
+	
+	// samples the audio thread has got into the ring
+	long long getSamplesPushed() const
+	{
+		return samplesPushed.load(std::memory_order_relaxed);
+	}
+	
+	long long getOverruns() const
+	{
+		return overruns.load(std::memory_order_relaxed);
+	}
+	
+	long long getDroppedSamples() const
+	{
+		return droppedSamples.load(std::memory_order_relaxed);
+	}
+	
+	long long getDroppedFrames() const
+	{
+		return droppedFrames.load(std::memory_order_relaxed);
+	}
+	
+	long long getUnderruns() const
+	{
+		return underruns.load(std::memory_order_relaxed);
+	}
+	
+private:
+	
+	// hops the worker reads from the ring at once; the streaming analysis
+	// queues as many frames, so it never drops one
+	enum { blockFrames = 4 };
+	
+	void workerLoop()
+	{
+		while (bRunning.load(std::memory_order_acquire)) {
+			process();
+			if (ring->readAvailable() < hopSize)
+				std::this_thread::sleep_for(std::chrono::microseconds(pollInterval.load(std::memory_order_relaxed)));
+		}
+	}
+	
+	pkmStreamingSTFT	*stft;			// worker only
+	pkmSPSCRing<float>	*ring;
+	pkmSPSCFrameQueue<float> *queue;
+	pkmTripleBuffer<float> *latest;
+	float				*block;			// worker only
+	
+	std::atomic<long long> samplesPushed,
+						overruns,
+						droppedSamples,
+						droppedFrames,
+						underruns;
+	std::atomic<int>	pollInterval;
+	std::atomic<bool>	bRunning;
+	std::thread			worker;
+	
+	int					fftBins,
+						hopSize;
+};
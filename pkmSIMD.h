@@ -0,0 +1,336 @@
+/*
+ *  pkmSIMD.h
+ *
+ *  Runtime instruction set detection and portable SIMD vector types
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  The FFT kernels are written once against the small vector abstraction
+ *  below (GCC/Clang vector extensions) and instantiated per instruction set
+ *  inside functions carrying a target attribute.  At runtime the best
+ *  instruction set supported by the CPU (CPUID on x86) is selected:
+ *
+ *      x86/x86-64:     SSE2 (4 floats), AVX2+FMA (8 floats), AVX-512F (16 floats)
+ *      ARM/AArch64:    NEON (4 floats)
+ *      anything else:  scalar
+ *
+ *  Usage:
+ *
+ *  printf("using %s\n", pkmSIMDISAName(pkmSIMDGetISA()));
+ *  pkmSIMDSetISA(PKM_ISA_SSE2);       // e.g. to compare kernels
+ *
+ */
+#pragma once
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PKM_SIMD_X86 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+#define PKM_SIMD_ARM_NEON 1
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PKM_SIMD_VECTOR_EXTENSIONS 1
+#define PKM_SIMD_INLINE inline __attribute__((always_inline))
+#define PKM_SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PKM_SIMD_INLINE inline
+#define PKM_SIMD_TARGET(isa)
+#endif
+
+// x86 builds with vector extensions get SSE2 for free on x86-64, and AVX2 /
+// AVX-512 kernels compiled in with target attributes
+#if defined(PKM_SIMD_X86) && defined(PKM_SIMD_VECTOR_EXTENSIONS)
+#define PKM_SIMD_HAVE_SSE2 1
+#define PKM_SIMD_HAVE_AVX2 1
+#define PKM_SIMD_HAVE_AVX512 1
+#endif
+#if defined(PKM_SIMD_ARM_NEON) && defined(PKM_SIMD_VECTOR_EXTENSIONS)
+#define PKM_SIMD_HAVE_NEON 1
+#endif
+
+enum pkmSIMDISA
+{
+	PKM_ISA_SCALAR = 0,
+	PKM_ISA_SSE2,
+	PKM_ISA_NEON,
+	PKM_ISA_AVX2,
+	PKM_ISA_AVX512
+};
+
+inline const char * pkmSIMDISAName(pkmSIMDISA isa)
+{
+	switch (isa) {
+		case PKM_ISA_SSE2:		return "sse2";
+		case PKM_ISA_NEON:		return "neon";
+		case PKM_ISA_AVX2:		return "avx2";
+		case PKM_ISA_AVX512:	return "avx512";
+		default:				return "scalar";
+	}
+}
+
+// vector width in bytes of an instruction set
+inline int pkmSIMDBytes(pkmSIMDISA isa)
+{
+	switch (isa) {
+		case PKM_ISA_SSE2:
+		case PKM_ISA_NEON:		return 16;
+		case PKM_ISA_AVX2:		return 32;
+		case PKM_ISA_AVX512:	return 64;
+		default:				return 0;
+	}
+}
+
+// best instruction set supported by both this build and the running cpu
+inline pkmSIMDISA pkmSIMDDetectISA()
+{
+#if defined(PKM_SIMD_HAVE_AVX512)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return PKM_ISA_AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return PKM_ISA_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return PKM_ISA_SSE2;
+	return PKM_ISA_SCALAR;
+#elif defined(PKM_SIMD_HAVE_NEON)
+	return PKM_ISA_NEON;
+#else
+	return PKM_ISA_SCALAR;
+#endif
+}
+
+inline pkmSIMDISA & pkmSIMDCurrentISA()
+{
+	static pkmSIMDISA isa = pkmSIMDDetectISA();
+	return isa;
+}
+
+// instruction set used by kernels set up from now on
+inline pkmSIMDISA pkmSIMDGetISA()
+{
+	return pkmSIMDCurrentISA();
+}
+
+// restrict kernels set up from now on to an instruction set, e.g. to compare
+// them; requests above what the cpu supports fall back to the detected one
+inline pkmSIMDISA pkmSIMDSetISA(pkmSIMDISA isa)
+{
+	pkmSIMDISA detected = pkmSIMDDetectISA();
+	bool bSameFamily = (isa == PKM_ISA_NEON) == (detected == PKM_ISA_NEON);
+	if (isa != PKM_ISA_SCALAR && (!bSameFamily || isa > detected))
+		isa = detected;
+	pkmSIMDCurrentISA() = isa;
+	return isa;
+}
+
+// kernels are always inlined into their instruction set's entry point, so
+// the ABI of wide vectors passed by value never matters; gcc still warns
+// about it where templates get instantiated, i.e. at the end of the
+// including file
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+// W lanes of T; W == 1 is plain scalar code
+#if defined(PKM_SIMD_VECTOR_EXTENSIONS)
+template <typename T, int W>
+struct pkmVec
+{
+	typedef T type __attribute__((vector_size(sizeof(T) * W)));
+};
+#else
+template <typename T, int W>
+struct pkmVec;
+#endif
+
+template <typename T>
+struct pkmVec<T, 1>
+{
+	typedef T type;
+};
+
+template <typename V, typename T>
+PKM_SIMD_INLINE V pkmVecLoad(const T *p)
+{
+	V v;
+	memcpy(&v, p, sizeof(V));
+	return v;
+}
+
+template <typename V, typename T>
+PKM_SIMD_INLINE void pkmVecStore(T *p, const V &v)
+{
+	memcpy(p, &v, sizeof(V));
+}
+
+template <typename V, typename T>
+PKM_SIMD_INLINE V pkmVecSplat(T x)
+{
+	V v = V();
+	return v + x;
+}
+
+// same-size integer lanes, for shuffle masks
+template <typename T>
+struct pkmVecIndex;
+
+template <>
+struct pkmVecIndex<float>
+{
+	typedef int type;
+};
+
+template <>
+struct pkmVecIndex<double>
+{
+	typedef long long type;
+};
+
+// lane permutations; gcc gets __builtin_shuffle with constant masks, other
+// compilers go through memory
+template <typename T, int W>
+struct pkmVecShuffle
+{
+	typedef typename pkmVec<T, W>::type V;
+	
+	// lanes in reverse order
+	static PKM_SIMD_INLINE V reverse(const V &v)
+	{
+#if defined(PKM_SIMD_VECTOR_EXTENSIONS) && !defined(__clang__)
+		typedef typename pkmVecIndex<T>::type I;
+		typedef I M __attribute__((vector_size(sizeof(V))));
+		M mask;
+		for (int i = 0; i < W; i++)
+			mask[i] = W - 1 - i;
+		return __builtin_shuffle(v, mask);
+#else
+		T a[W], b[W];
+		memcpy(a, &v, sizeof(V));
+		for (int i = 0; i < W; i++)
+			b[i] = a[W - 1 - i];
+		return pkmVecLoad<V>(b);
+#endif
+	}
+	
+	// interleave a and b in chunks of S lanes: lo holds the first W lanes
+	// of a0 b0 a1 b1 ..., hi the last W
+	template <int S>
+	static PKM_SIMD_INLINE void zip(const V &a, const V &b, V &lo, V &hi)
+	{
+#if defined(PKM_SIMD_VECTOR_EXTENSIONS) && !defined(__clang__)
+		typedef typename pkmVecIndex<T>::type I;
+		typedef I M __attribute__((vector_size(sizeof(V))));
+		M mlo, mhi;
+		for (int i = 0; i < 2*W; i++) {
+			int chunk = i / S, src = (chunk / 2) * S + i % S + (chunk & 1) * W;
+			if (i < W)
+				mlo[i] = src;
+			else
+				mhi[i - W] = src;
+		}
+		lo = __builtin_shuffle(a, b, mlo);
+		hi = __builtin_shuffle(a, b, mhi);
+#else
+		T ta[W], tb[W], out[2*W];
+		memcpy(ta, &a, sizeof(V));
+		memcpy(tb, &b, sizeof(V));
+		for (int i = 0; i < 2*W; i++) {
+			int chunk = i / S, j = (chunk / 2) * S + i % S;
+			out[i] = (chunk & 1) ? tb[j] : ta[j];
+		}
+		lo = pkmVecLoad<V>(out);
+		hi = pkmVecLoad<V>(out + W);
+#endif
+	}
+};
+
+template <typename T>
+struct pkmVecShuffle<T, 1>
+{
+	static PKM_SIMD_INLINE T reverse(const T &v)
+	{
+		return v;
+	}
+	
+	template <int S>
+	static PKM_SIMD_INLINE void zip(const T &a, const T &b, T &lo, T &hi)
+	{
+		lo = a;
+		hi = b;
+	}
+};
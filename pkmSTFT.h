@@ -1,7 +1,8 @@
 /*
  *  pkmSTFT.h
  *
- *  STFT implementation making use of Apple's Accelerate Framework (pkmFFT)
+ *  STFT implementation making use of pkmFFT (Apple's Accelerate Framework or
+ *  the portable SIMD backend)
  *
  *  Created by Parag K. Mital - http://pkmital.com 
  *  Contact: parag@pkmital.com
@@ -92,22 +93,105 @@
  *  stft.ISTFT(sample_data, buffer_size, magnitude_matrix, phase_matrix);
  *  delete stft;
  *
+ *  STFT and ISTFT spread frames over pkmThreadPool::shared(), each worker
+ *  with its own pkmFFT scratch; results are bit-identical for any thread
+ *  count.  setNumThreads(1) keeps everything on the calling thread.
+ *
+ *  The padded copy of the signal and the workers' frame buffers live in a
+ *  pkmWorkspace that only grows, so once a pkmSTFT has seen a buffer size
+ *  (or reserve() was called for it) further calls make no heap allocations
+ *  as long as the output matrices already have numWindows x fftBins.
+ *  getAllocations() counts every allocation event so callers can check.
+ *
+ *  pkmSTFT works in float and pkmSTFTD in double (pkmBasicSTFT<T>).  Besides
+ *  pkm::Mat, STFT and ISTFT take plain arrays of getNumWindows(bufSize) x
+ *  getBins() values in any storage type, such as pkmHalf or pkmBFloat16 to
+ *  halve the size of a long spectrogram (see pkmFFT.h for their accuracy):
+ *
+ *  pkmHalf *magnitudes = (pkmHalf *) malloc (sizeof(pkmHalf) * stft.getNumWindows(buffer_size) * stft.getBins());
+ *  stft.STFT(sample_data, buffer_size, magnitudes, phases);
+ *
+ *  Spectrograms too long for memory go to a pkmSpectrogramFile: STFT writes
+ *  its frames straight into the mapped file and ISTFT reads them from it.
+ *
+ *  pkmSpectrogramFile file;
+ *  file.create("out.pkmspec", 512, 128, stft.getNumWindows(buffer_size), 44100, PKM_SPECTROGRAM_FLOAT16);
+ *  stft.STFT(sample_data, buffer_size, file);
+ *
+ *  setPolarAccuracy(PKM_POLAR_FAST) or PKM_POLAR_FASTEST trades phase
+ *  accuracy for a vectorized polar conversion in every worker (pkmPolar.h).
+ *
+ *  setLayout() picks how STFT lays out its output and ISTFT reads it back,
+ *  so consumers get the access pattern they need without a transpose:
+ *
+ *      PKM_STFT_FRAME_MAJOR    numWindows rows of fftBins magnitudes, and
+ *                              of phases (the default)
+ *      PKM_STFT_BIN_MAJOR      fftBins rows of numWindows values, so each
+ *                              bin's frames are contiguous for filters
+ *                              across time; frames are transposed into
+ *                              place in cache-sized tiles as they are made
+ *      PKM_STFT_INTERLEAVED    numWindows rows of fftBins (real, imaginary)
+ *                              pairs in the first buffer; the second is
+ *                              unused and may be NULL
+ *
+ *  stft.setLayout(PKM_STFT_BIN_MAJOR);
+ *  stft.STFT(sample_data, buffer_size, magnitudes, phases);
+ *  float *bin_k = magnitudes + k * stft.getNumWindows(buffer_size);
+ *
+ *  Spectrogram files are always frame-major.
+ *
+ *  Interleaved multichannel audio goes through STFT in one call, with each
+ *  frame's channels transformed together, one per SIMD lane of the batch
+ *  FFT, straight from the interleaved samples.  setChannelLayout() picks
+ *  where the channels go:
+ *
+ *      PKM_STFT_CHANNEL_MAJOR      a spectrogram per channel in the current
+ *                                  layout, one after another (the default)
+ *      PKM_STFT_CHANNEL_INNERMOST  the channels of each bin side by side,
+ *                                  value c of bin k of frame f at
+ *                                  (f*fftBins + k)*numChannels + c when
+ *                                  frame-major, for covariance across
+ *                                  channels and beamforming
+ *
+ *  float *magnitudes = (float *) malloc (sizeof(float) * channels * stft.getNumWindows(frames) * stft.getBins());
+ *  stft.setChannelLayout(PKM_STFT_CHANNEL_INNERMOST);
+ *  stft.STFT(interleaved_data, frames, channels, magnitudes, phases);
+ *
  */
 #pragma once
 
-#include <Accelerate/Accelerate.h>
+#include <algorithm>
 #include "pkmFFT.h"
+#include "pkmDSP.h"
+#include "pkmThreadPool.h"
+#include "pkmWorkspace.h"
+#include "pkmSpectrogramFile.h"
 #include "pkmMatrix.h"
 
-class pkmSTFT
+// how STFT lays out a spectrogram; see above
+enum pkmSTFTLayout
+{
+	PKM_STFT_FRAME_MAJOR = 0,
+	PKM_STFT_BIN_MAJOR,
+	PKM_STFT_INTERLEAVED
+};
+
+// where multichannel STFT puts each channel; see above
+enum pkmSTFTChannelLayout
+{
+	PKM_STFT_CHANNEL_MAJOR = 0,
+	PKM_STFT_CHANNEL_INNERMOST
+};
+
+template <typename T>
+class pkmBasicSTFT
 {
 public:
 
-	pkmSTFT(int size, int hop = 0)
+	pkmBasicSTFT(int size, int hop = 0)
 	{
 		fftSize = size;
 		numFFTs = 0;
-		fftBins = fftSize/2;
         if (hop == 0) {
             hopSize = fftSize/4;
         }
@@ -115,12 +199,68 @@ public:
             hopSize = hop;
 		windowSize = fftSize;
 		bufferSize = 0;
+		numThreads = 0;
+		framesPerBatch = 16;
+		allocations = 0;
+		polarAccuracy = PKM_POLAR_EXACT;
+		layout = PKM_STFT_FRAME_MAJOR;
+		channelLayout = PKM_STFT_CHANNEL_MAJOR;
+		FFT = NULL;
 		
 		initializeFFTParameters(fftSize, windowSize, hopSize);
 	}
-	~pkmSTFT()
+	~pkmBasicSTFT()
+	{
+		releaseWorkers();
+		delete FFT;
+	}
+	
+	// 0 uses every thread of pkmThreadPool::shared(), 1 runs serially
+	void setNumThreads(int n)
+	{
+		numThreads = n;
+	}
+	
+	int getNumThreads()
+	{
+		return numThreads;
+	}
+	
+	// accuracy of the magnitudes and phases of STFT and of their conversion
+	// back in ISTFT; exact by default
+	void setPolarAccuracy(pkmPolarAccuracy accuracy)
+	{
+		polarAccuracy = accuracy;
+		FFT->setPolarAccuracy(accuracy);
+		for (size_t i = 1; i < workerFFTs.size(); i++)
+			workerFFTs[i]->setPolarAccuracy(accuracy);
+	}
+	
+	pkmPolarAccuracy getPolarAccuracy()
+	{
+		return polarAccuracy;
+	}
+	
+	// layout of the spectrograms STFT writes and ISTFT reads from now on
+	void setLayout(pkmSTFTLayout newLayout)
+	{
+		layout = newLayout;
+	}
+	
+	pkmSTFTLayout getLayout()
+	{
+		return layout;
+	}
+	
+	// where multichannel STFT puts the channels from now on
+	void setChannelLayout(pkmSTFTChannelLayout newLayout)
+	{
+		channelLayout = newLayout;
+	}
+	
+	pkmSTFTChannelLayout getChannelLayout()
 	{
-		free(FFT);
+		return channelLayout;
 	}
 	
 	void initializeFFTParameters(int _fftSize, int _windowSize, int _hopSize)
@@ -129,8 +269,13 @@ public:
 		hopSize = _hopSize;
 		windowSize = _windowSize;
 		
-		// fft constructor
-		FFT = new pkmFFT(fftSize);
+		// fft constructor; its plan and window come from pkmFFTPlanCache
+		releaseWorkers();
+		delete FFT;
+		FFT = new pkmBasicFFT<T>(fftSize);
+		FFT->setPolarAccuracy(polarAccuracy);
+		fftBins = FFT->fftSizeOver2;
+		allocations++;
 		
 		numWindows = fftSize / hopSize + 1;
 	}
@@ -148,108 +293,406 @@ public:
 		int numWindows = (padBufferSize - fftSize)/hopSize + 1;
 		return numWindows;
 	}
+	
+	// does every allocation STFT and ISTFT need for buffers of bufSize up front
+	void reserve(int bufSize, int numChannels = 1)
+	{
+		int padding = ceilf((float)bufSize/(float)fftSize) * fftSize - bufSize;
+		reserveWorkspace(allocateWorkers(), (bufSize + padding) * numChannels, layout);
+	}
+	
+	// heap allocation events so far: workspace growth, worker ffts and
+	// output matrix resizes
+	long getAllocations()
+	{
+		return allocations + workspace.getAllocations();
+	}
 		
 	
-	void STFT(float *buf, int bufSize, pkm::Mat &M_magnitudes, pkm::Mat &M_phases)
+	// the matrices take the shape of the layout; M_phases is left alone
+	// when interleaved
+	void STFT(T *buf, int bufSize, pkm::Mat &M_magnitudes, pkm::Mat &M_phases)
+	{
+		numWindows = getNumWindows(bufSize);
+		int rows = layout == PKM_STFT_BIN_MAJOR ? fftBins : numWindows;
+		int cols = layout == PKM_STFT_BIN_MAJOR ? numWindows : layout == PKM_STFT_INTERLEAVED ? 2*fftBins : fftBins;
+		if (M_magnitudes.rows != rows || M_magnitudes.cols != cols) {
+			M_magnitudes.reset(rows, cols, true);
+			allocations++;
+		}
+		if (layout != PKM_STFT_INTERLEAVED && (M_phases.rows != rows || M_phases.cols != cols)) {
+			M_phases.reset(rows, cols, true);
+			allocations++;
+		}
+		STFT(buf, bufSize, M_magnitudes.data, layout == PKM_STFT_INTERLEAVED ? (float *) NULL : M_phases.data);
+	}
+	
+	// getNumWindows(bufSize) x getBins() values in the current layout,
+	// stored as S
+	template <typename S>
+	void STFT(T *buf, int bufSize, S *magnitudes, S *phases)
+	{
+		analyse(buf, bufSize, magnitudes, phases, layout);
+	}
+	
+	// numChannels channels of bufSize samples interleaved in buf, each laid
+	// out as a getNumWindows(bufSize) x getBins() spectrogram in the current
+	// layout, one after another or with the channels innermost
+	template <typename S>
+	void STFT(const T *buf, int bufSize, int numChannels, S *magnitudes, S *phases)
+	{
+		analyseChannels(buf, bufSize, numChannels, magnitudes, phases);
+	}
+	
+	// frames straight into a file made for this transform, with
+	// getNumWindows(bufSize) frames; the page cache takes them to disk
+	bool STFT(T *buf, int bufSize, pkmSpectrogramFile &file)
+	{
+		if (!file.isWritable() || !matchesFile(file, bufSize)) {
+			printf("\npkmSTFT: spectrogram file is read only or not made for this transform.\n");
+			return false;
+		}
+		switch (file.getType()) {
+			case PKM_SPECTROGRAM_FLOAT32:	analyse(buf, bufSize, file.editMagnitudes<float>(), file.editPhases<float>(), PKM_STFT_FRAME_MAJOR); break;
+			case PKM_SPECTROGRAM_FLOAT64:	analyse(buf, bufSize, file.editMagnitudes<double>(), file.editPhases<double>(), PKM_STFT_FRAME_MAJOR); break;
+			case PKM_SPECTROGRAM_FLOAT16:	analyse(buf, bufSize, file.editMagnitudes<pkmHalf>(), file.editPhases<pkmHalf>(), PKM_STFT_FRAME_MAJOR); break;
+			case PKM_SPECTROGRAM_BFLOAT16:	analyse(buf, bufSize, file.editMagnitudes<pkmBFloat16>(), file.editPhases<pkmBFloat16>(), PKM_STFT_FRAME_MAJOR); break;
+		}
+		file.setNumSamples(bufSize);
+		return true;
+	}
+	
+	int getBins()
+	{
+		return fftBins;
+	}
+	
+	int getFFTSize()
+	{
+		return fftSize;
+	}
+	
+	int getHopSize()
+	{
+		return hopSize;
+	}
+	
+	int getWindows()
+	{
+		return numWindows;
+	}
+	
+	
+	void ISTFT(T *buf, int bufSize, pkm::Mat &M_magnitudes, pkm::Mat &M_phases)
+	{
+		ISTFT(buf, bufSize, (const float *) M_magnitudes.data, (const float *) M_phases.data);
+	}
+	
+	// resynthesizes bufSize samples from the frames of a file STFT wrote
+	bool ISTFT(T *buf, int bufSize, const pkmSpectrogramFile &file)
+	{
+		if (!matchesFile(file, bufSize)) {
+			printf("\npkmSTFT: spectrogram file was not made for this transform.\n");
+			return false;
+		}
+		switch (file.getType()) {
+			case PKM_SPECTROGRAM_FLOAT32:	resynthesize(buf, bufSize, file.magnitudes<float>(), file.phases<float>(), PKM_STFT_FRAME_MAJOR); break;
+			case PKM_SPECTROGRAM_FLOAT64:	resynthesize(buf, bufSize, file.magnitudes<double>(), file.phases<double>(), PKM_STFT_FRAME_MAJOR); break;
+			case PKM_SPECTROGRAM_FLOAT16:	resynthesize(buf, bufSize, file.magnitudes<pkmHalf>(), file.phases<pkmHalf>(), PKM_STFT_FRAME_MAJOR); break;
+			case PKM_SPECTROGRAM_BFLOAT16:	resynthesize(buf, bufSize, file.magnitudes<pkmBFloat16>(), file.phases<pkmBFloat16>(), PKM_STFT_FRAME_MAJOR); break;
+		}
+		return true;
+	}
+	
+	// frames laid out as STFT writes them in the current layout,
+	// getNumWindows(bufSize) of them
+	template <typename S>
+	void ISTFT(T *buf, int bufSize, const S *magnitudes, const S *phases)
+	{
+		resynthesize(buf, bufSize, magnitudes, phases, layout);
+	}
+	
+	pkmBasicFFT<T>		*FFT;
+	
+private:
+	
+	// STFT into magnitudes/phases in frameLayout
+	template <typename S>
+	void analyse(T *buf, int bufSize, S *magnitudes, S *phases, pkmSTFTLayout frameLayout)
 	{	
 		// pad input buffer
+		PKM_INSTRUMENT_START(clock);
 		int padding = ceilf((float)bufSize/(float)fftSize) * fftSize - bufSize;
 		int shift = padding / 2;
-		float *padBuf;
+		T *padBuf;
+		padBufferSize = bufSize + padding;
+		int workers = allocateWorkers();
+		reserveWorkspace(workers, padBufferSize, frameLayout);
 		if (padding) {
 			//printf("Padding %d sample buffer with %d samples\n", bufSize, padding);
-			padBufferSize = bufSize + padding;
-			padBuf = (float *)malloc(sizeof(float)*padBufferSize);
+			padBuf = workspace.get<T>(padBufferSize);
 			// set padding to 0
 			//memset(&(padBuf[bufSize]), 0, sizeof(float)*padding);
-			vDSP_vclr(padBuf, 1, shift);
-			vDSP_vclr(padBuf + bufSize + shift, 1, shift);
+			pkmDSP::vclr(padBuf, 1, shift);
+			pkmDSP::vclr(padBuf + bufSize + shift, 1, padding - shift);
 			// copy original buffer into padded one
 			//memcpy(padBuf, buf, sizeof(float)*bufSize);	
 		
-			cblas_scopy(bufSize, buf, 1, padBuf + shift, 1);
+			pkmDSP::copy(bufSize, buf, 1, padBuf + shift, 1);
 		}
 		else {
 			padBuf = buf;
-			padBufferSize = bufSize;
 		}
+		PKM_INSTRUMENT_LAP(clock, PKM_STAGE_STFT_PAD, padding ? sizeof(T) * (bufSize + padBufferSize) : 0);
 		
-		// create output fft matrix
 		numWindows = (padBufferSize - fftSize)/hopSize + 1;
 		
-		if (M_magnitudes.rows != numWindows && M_magnitudes.cols != fftBins) {
-			M_magnitudes.reset(numWindows, fftBins, true);
-			M_phases.reset(numWindows, fftBins, true);
-		}
-		
-		// stft
-		for (int i = 0; i < numWindows; i++) {
-			
-			// get current col of freq mat
-			float *magnitudes = M_magnitudes.row(i);
-			float *phases = M_phases.row(i);
-			float *buffer = padBuf + i*hopSize;
-			
-			FFT->forward(0, buffer, magnitudes, phases);	
-			
+		// stft; frames are independent, so workers only need their own fft,
+		// and each chunk of rows is one batch
+		pkmThreadPool::shared().parallelFor(numWindows, framesPerBatch, [&](int begin, int end, int worker) {
+			pkmBasicFFT<T> *fft = workerFFTs[worker];
+			T *buffer = padBuf + begin*hopSize;
 			
-		}
-		// release padded buffer
-		if (padding) {
-			free(padBuf);
-		}
+			if (frameLayout == PKM_STFT_FRAME_MAJOR) {
+				fft->forwardBatch(buffer, hopSize, end - begin, 
+								  magnitudes + (long) begin*fftBins, 
+								  phases + (long) begin*fftBins);
+			}
+			else if (frameLayout == PKM_STFT_INTERLEAVED) {
+				fft->forwardBatch(buffer, hopSize, end - begin, PKM_FFT_OUTPUT_INTERLEAVED, 
+								  magnitudes + (long) begin*2*fftBins);
+			}
+			else {
+				// a batch at a time into the worker's tile, then into the
+				// columns of the bin rows
+				S *tileMagnitudes = (S *) workerTiles[worker];
+				S *tilePhases = tileMagnitudes + framesPerBatch*fftBins;
+				for (int i = begin; i < end; i += framesPerBatch) {
+					int frames = std::min(framesPerBatch, end - i);
+					fft->forwardBatch(padBuf + i*hopSize, hopSize, frames, tileMagnitudes, tilePhases);
+					tileToBinMajor(tileMagnitudes, magnitudes, i, frames);
+					tileToBinMajor(tilePhases, phases, i, frames);
+				}
+			}
+		}, workers);
 	}
 	
-	int getBins()
+	// STFT of interleaved channels, a frame of every channel at a time
+	template <typename S>
+	void analyseChannels(const T *buf, int bufSize, int numChannels, S *magnitudes, S *phases)
 	{
-		return fftBins;
-	}
-	
-	int getWindows()
-	{
-		return numWindows;
+		PKM_INSTRUMENT_START(clock);
+		int padding = ceilf((float)bufSize/(float)fftSize) * fftSize - bufSize;
+		int shift = padding / 2;
+		const long channels = numChannels;
+		const T *padBuf = buf;
+		padBufferSize = bufSize + padding;
+		int workers = allocateWorkers();
+		reserveWorkspace(workers, padBufferSize * numChannels, layout);
+		if (padding) {
+			T *pad = workspace.get<T>(padBufferSize * numChannels);
+			pkmDSP::vclr(pad, 1, shift * numChannels);
+			pkmDSP::vclr(pad + (bufSize + shift)*channels, 1, (padding - shift) * numChannels);
+			pkmDSP::copy(bufSize * numChannels, buf, 1, pad + shift*channels, 1);
+			padBuf = pad;
+		}
+		PKM_INSTRUMENT_LAP(clock, PKM_STAGE_STFT_PAD, padding ? sizeof(T) * (bufSize + padBufferSize) * channels : 0);
+		
+		numWindows = (padBufferSize - fftSize)/hopSize + 1;
+		
+		// where bin k of channel c of frame f goes, in bins (pairs when interleaved)
+		const long bins = fftBins, windows = numWindows;
+		long frameStride, binStride, channelStride;
+		if (channelLayout == PKM_STFT_CHANNEL_MAJOR) {
+			channelStride = windows * bins;
+			frameStride = layout == PKM_STFT_BIN_MAJOR ? 1 : bins;
+			binStride = layout == PKM_STFT_BIN_MAJOR ? windows : 1;
+		}
+		else {
+			channelStride = 1;
+			frameStride = layout == PKM_STFT_BIN_MAJOR ? channels : bins * channels;
+			binStride = layout == PKM_STFT_BIN_MAJOR ? windows * channels : channels;
+		}
+		const pkmFFTOutput mode = layout == PKM_STFT_INTERLEAVED ? PKM_FFT_OUTPUT_INTERLEAVED : PKM_FFT_OUTPUT_POLAR;
+		const long pair = layout == PKM_STFT_INTERLEAVED ? 2 : 1;
+		
+		// frames are independent, so workers only need their own fft
+		pkmThreadPool::shared().parallelFor(numWindows, framesPerBatch, [&](int begin, int end, int worker) {
+			pkmBasicFFT<T> *fft = workerFFTs[worker];
+			fft->forwardChannels(padBuf + (long) begin*hopSize*channels, numChannels, hopSize, end - begin, 
+								 frameStride, binStride, channelStride, mode, 
+								 magnitudes + pair*begin*frameStride, phases ? phases + begin*frameStride : (S *) NULL);
+		}, workers);
 	}
 	
-	
-	void ISTFT(float *buf, int bufSize, pkm::Mat &M_magnitudes, pkm::Mat &M_phases)
+	// frames laid out in frameLayout, getNumWindows(bufSize) of them
+	template <typename S>
+	void resynthesize(T *buf, int bufSize, const S *magnitudes, const S *phases, pkmSTFTLayout frameLayout)
 	{
+		PKM_INSTRUMENT_START(clock);
+		numWindows = getNumWindows(bufSize);
 		int padding = ceilf((float)bufSize/(float)fftSize) * fftSize - bufSize;
 		int shift = padding / 2;
-		float *padBuf;
+		T *padBuf;
+		padBufferSize = bufSize + padding;
+		int workers = allocateWorkers();
+		reserveWorkspace(workers, padBufferSize, frameLayout);
 		if (padding) 
 		{
 			//printf("Padding %d sample buffer with %d samples\n", bufSize, padding);
-			padBufferSize = bufSize + padding;
-			padBuf = (float *)malloc(padBufferSize*sizeof(float));
-			vDSP_vclr(padBuf, 1, padBufferSize);
+			padBuf = workspace.get<T>(padBufferSize);
+			pkmDSP::vclr(padBuf, 1, padBufferSize);
 		}
 		else {
 			padBuf = buf;
-			padBufferSize = bufSize;
 		}
+		PKM_INSTRUMENT_LAP(clock, PKM_STAGE_STFT_PAD, padding ? sizeof(T) * padBufferSize : 0);
 		
-		pkm::Mat M_istft(padBufferSize, 1, padBuf, false);
-		
-		for(int i = 0; i < numWindows; i++)
-		{
-			float *buffer = padBuf + i*hopSize;
-			float *magnitudes = M_magnitudes.row(i);
-			float *phases = M_phases.row(i);
-			
-			FFT->inverse(0, buffer, magnitudes, phases);
-		}
+		// overlap-add in tiles of whole frames.  a tile owns the samples from
+		// its first frame's start up to the next tile's, and resynthesises the
+		// earlier frames that reach into them, so every sample still sums its
+		// frames in ascending order whatever the tiling
+		int overlap = (fftSize - 1) / hopSize;
+		int framesPerTile = std::max(8 * (overlap + 1), (numWindows + 4*workers - 1) / (4*workers));
+		int numTiles = (numWindows + framesPerTile - 1) / framesPerTile;
+		pkmThreadPool::shared().parallelFor(numTiles, 1, [&](int begin, int end, int worker) {
+			pkmBasicFFT<T> *fft = workerFFTs[worker];
+			T *frame = workerFrames[worker];	// framesPerBatch frames
+			S *tileMagnitudes = (S *) workerTiles[worker];
+			S *tilePhases = tileMagnitudes + framesPerBatch*fftBins;
+			for (int tile = begin; tile < end; tile++) {
+				int firstFrame = tile * framesPerTile;
+				int lastFrame = std::min(firstFrame + framesPerTile, numWindows);
+				int lo = tile == 0 ? 0 : firstFrame*hopSize;
+				int hi = tile == numTiles - 1 ? padBufferSize : lastFrame*hopSize;
+				
+				for (int i = std::max(0, firstFrame - overlap); i < lastFrame; i += framesPerBatch)
+				{
+					// synthesise a batch of frames side by side, then add them in order
+					int frames = std::min(framesPerBatch, lastFrame - i);
+					pkmDSP::vclr(frame, 1, frames*fftSize);
+					if (frameLayout == PKM_STFT_FRAME_MAJOR) {
+						fft->inverseBatch(frame, fftSize, frames, 
+										  magnitudes + (long) i*fftBins, phases + (long) i*fftBins);
+					}
+					else if (frameLayout == PKM_STFT_INTERLEAVED) {
+						fft->inverseBatch(frame, fftSize, frames, PKM_FFT_OUTPUT_INTERLEAVED, 
+										  magnitudes + (long) i*2*fftBins);
+					}
+					else {
+						binMajorToTile(magnitudes, tileMagnitudes, i, frames);
+						binMajorToTile(phases, tilePhases, i, frames);
+						fft->inverseBatch(frame, fftSize, frames, tileMagnitudes, tilePhases);
+					}
+					
+					PKM_INSTRUMENT_START(add);
+					for (int b = i; b < i + frames; b++) {
+						const T *synthesis = frame + (b - i)*fftSize;
+						int from = std::max(b*hopSize, lo);
+						int to = std::min(b*hopSize + fftSize, hi);
+						for (int n = from; n < to; n++)
+							padBuf[n] += synthesis[n - b*hopSize];
+					}
+					PKM_INSTRUMENT_LAP(add, PKM_STAGE_STFT_OVERLAP_ADD, 3 * sizeof(T) * fftSize * frames);
+				}
+			}
+		}, workers);
 
 		//memcpy(buf, padBuf, sizeof(float)*bufSize);
-		cblas_scopy(bufSize, padBuf + shift, 1, buf, 1);
-		// release padded buffer
 		if (padding) {
-			free(padBuf);
+			PKM_INSTRUMENT_START(copy);
+			pkmDSP::copy(bufSize, padBuf + shift, 1, buf, 1);
+			PKM_INSTRUMENT_LAP(copy, PKM_STAGE_STFT_PAD, 2 * sizeof(T) * bufSize);
 		}
 	}
 	
-	pkmFFT				*FFT;
+	// makes an fft with its batch buffers for each worker; workerFFTs[0] is FFT
+	int allocateWorkers()
+	{
+		int workers = pkmThreadPool::shared().size();
+		if (numThreads > 0 && numThreads < workers)
+			workers = numThreads;
+		
+		if (workerFFTs.empty()) {
+			workerFFTs.reserve(pkmThreadPool::shared().size());
+			workerFrames.reserve(pkmThreadPool::shared().size());
+			workerFFTs.push_back(FFT);
+			FFT->allocateBatch();
+			allocations++;
+		}
+		while ((int)workerFFTs.size() < workers) {
+			workerFFTs.push_back(new pkmBasicFFT<T>(fftSize));
+			workerFFTs.back()->setPolarAccuracy(polarAccuracy);
+			workerFFTs.back()->allocateBatch();
+			allocations++;
+		}
+		return workers;
+	}
 	
-private:
+	// room for the padded signal, which the caller takes next, and
+	// framesPerBatch frames for each worker, with a tile of framesPerBatch
+	// frame-major magnitudes and phases of any storage type when bin-major
+	void reserveWorkspace(int workers, int padBufferSize, pkmSTFTLayout frameLayout)
+	{
+		size_t tileBytes = frameLayout == PKM_STFT_BIN_MAJOR ? pkmWorkspace::bytes<double>(2 * framesPerBatch * fftBins) : 0;
+		workspace.reserve(pkmWorkspace::bytes<T>(padBufferSize) + 
+						  workers * (pkmWorkspace::bytes<T>(fftSize * framesPerBatch) + tileBytes));
+		workerFrames.resize(workers);
+		workerTiles.resize(workers);
+		for (int i = 0; i < workers; i++) {
+			workerFrames[i] = workspace.get<T>(fftSize * framesPerBatch);
+			workerTiles[i] = tileBytes ? workspace.get<char>(tileBytes) : NULL;
+		}
+	}
+	
+	// frames [first, first + frames) of a frame-major tile into the columns
+	// of bin-major rows of numWindows, sixteen bins at a time so the rows
+	// being written stay in cache until their lines are full
+	template <typename S>
+	void tileToBinMajor(const S *tile, S *binMajor, int first, int frames)
+	{
+		for (int k0 = 0; k0 < fftBins; k0 += 16) {
+			const int k1 = std::min(k0 + 16, fftBins);
+			for (int f = 0; f < frames; f++)
+				for (int k = k0; k < k1; k++)
+					binMajor[(long) k*numWindows + first + f] = tile[(long) f*fftBins + k];
+		}
+	}
+	
+	template <typename S>
+	void binMajorToTile(const S *binMajor, S *tile, int first, int frames)
+	{
+		for (int k0 = 0; k0 < fftBins; k0 += 16) {
+			const int k1 = std::min(k0 + 16, fftBins);
+			for (int f = 0; f < frames; f++)
+				for (int k = k0; k < k1; k++)
+					tile[(long) f*fftBins + k] = binMajor[(long) k*numWindows + first + f];
+		}
+	}
+	
+	bool matchesFile(const pkmSpectrogramFile &file, int bufSize)
+	{
+		return file.isOpen() && file.getFFTSize() == fftSize && file.getHopSize() == hopSize &&
+			file.getWindow() == PKM_FFT_WINDOW_HANN && file.getNumFrames() == getNumWindows(bufSize);
+	}
+	
+	void releaseWorkers()
+	{
+		for (size_t i = 1; i < workerFFTs.size(); i++)
+			delete workerFFTs[i];
+		workerFFTs.clear();
+		workerFrames.clear();
+		workerTiles.clear();
+	}
+	
+	pkmWorkspace			workspace;
+	std::vector<pkmBasicFFT<T> *>	workerFFTs;
+	std::vector<T *>		workerFrames;		// in workspace
+	std::vector<char *>		workerTiles;		// in workspace, bin-major only
+	long					allocations;
+	pkmPolarAccuracy		polarAccuracy;
+	pkmSTFTLayout			layout;
+	pkmSTFTChannelLayout	channelLayout;
 	
 	
 	int				sampleRate,
@@ -260,5 +703,10 @@ private:
 						bufferSize,
 						padBufferSize,
 						windowSize,
-						numWindows;
-};
\ No newline at end of file
+						numWindows,
+						numThreads,
+						framesPerBatch;		// frames each worker transforms together
+};
+
+typedef pkmBasicSTFT<float> pkmSTFT;
+typedef pkmBasicSTFT<double> pkmSTFTD;
@@ -0,0 +1,607 @@
+/*
+ *  pkmSlidingDFT.h
+ *
+ *  Sliding DFT bank tracking selected bins sample by sample
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  pkmSlidingDFT gives the bins pkmFFT::forward would give for a handful of
+ *  chosen bins, on a frame every hop samples, for hops down to 1.  Each
+ *  frequency the bins need keeps a running sum updated in O(1) per sample
+ *  (a modulated sliding DFT):
+ *
+ *      A_j += (x[n] - x[n - N]) e^{-2 pi i j n / N},   X_j = A_j e^{2 pi i j (n + 1) / N}
+ *
+ *  The windows of pkmFFTPlanCache are cosine sums, so a windowed bin is the
+ *  three-term combination a0 X_k - a1 / 2 (X_{k-1} + X_{k+1}); a Hann
+ *  window therefore tracks bins k - 1, k and k + 1, shared between
+ *  neighbouring bins.  Frames have pkmFFT's 2X[k] scale and phase
+ *  convention, with the imaginary part of bin 0 set to 0.
+ *
+ *  The frequencies are SIMD lanes: a lane's running sum, its phasor
+ *  e^{-2 pi i j n / N} and the phasor's step stay in registers while a
+ *  block of samples goes by, so the update is a few fused multiply-adds per
+ *  sample per frequency, instantiated for each instruction set of
+ *  pkmSIMD.h.  Phasors are reset from a table every 64 samples and the
+ *  sums recomputed from the last fftSize samples every 4 fftSize samples,
+ *  so rounding never accumulates; bins stay within about 1e-5 of pkmFFT's
+ *  relative to the frame's largest in float.
+ *
+ *  When the bins asked for would cost more than transforming the whole
+ *  frame every hop (many bins and a long hop), the constructor switches to
+ *  running each frame through pkmFFT and picking the bins out; getMethod()
+ *  tells which one is in use.
+ *
+ *  As pkmStreamingSTFT, the stream starts from silence, frame t covers
+ *  samples [(t+1)*hopSize - fftSize, (t+1)*hopSize), frames wait in a queue
+ *  of maxFrames (the oldest is dropped when it is full), and everything is
+ *  allocated by the constructor.
+ *
+ *  Usage:
+ *
+ *  int bins[] = { 5, 10, 15, 20 };						// 50 Hz hum harmonics at 4096 / 44.1 kHz
+ *  pkmSlidingDFT sdft(4096, bins, 4, 1);				// a frame every sample
+ *  float magnitudes[4], phases[4];
+ *
+ *  // audio callback
+ *  sdft.push(input, numSamples);
+ *  while (sdft.pop(magnitudes, phases))
+ *      track(magnitudes, phases);
+ *
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "pkmFFT.h"
+#include "pkmFFTPlanCache.h"
+#include "pkmPolar.h"
+#include "pkmSIMD.h"
+
+enum pkmSlidingDFTMethod
+{
+	PKM_SLIDING_DFT_AUTO = 0,		// whichever costs less for the bins and hop
+	PKM_SLIDING_DFT_RECURSIVE,		// running sums per bin
+	PKM_SLIDING_DFT_FFT				// a full pkmFFT every hop
+};
+
+// A += d[t] P, P *= S over n samples, for the lanes of every chunk of W of
+// the padded count frequencies
+template <typename T, int W>
+PKM_SIMD_INLINE void pkmSlidingDFTKernel(T *ar, T *ai, T *pr, T *pi, const T *sr, const T *si, 
+										 const T *d, int n, int count)
+{
+	typedef typename pkmVec<T, W>::type V;
+	for (int j = 0; j < count; j += W) {
+		V Ar = pkmVecLoad<V>(ar + j), Ai = pkmVecLoad<V>(ai + j);
+		V Pr = pkmVecLoad<V>(pr + j), Pi = pkmVecLoad<V>(pi + j);
+		const V Sr = pkmVecLoad<V>(sr + j), Si = pkmVecLoad<V>(si + j);
+		for (int t = 0; t < n; t++) {
+			const T x = d[t];
+			Ar = Ar + x * Pr;
+			Ai = Ai + x * Pi;
+			const V r = Pr * Sr - Pi * Si;
+			Pi = Pr * Si + Pi * Sr;
+			Pr = r;
+		}
+		pkmVecStore(ar + j, Ar);
+		pkmVecStore(ai + j, Ai);
+		pkmVecStore(pr + j, Pr);
+		pkmVecStore(pi + j, Pi);
+	}
+}
+
+#define PKM_SLIDING_DFT_KERNEL_ENTRY_POINT(SUFFIX, TARGET, LANES) \
+	TARGET static void update##SUFFIX(T *ar, T *ai, T *pr, T *pi, const T *sr, const T *si, const T *d, int n, int count) \
+	{ pkmSlidingDFTKernel<T, LANES>(ar, ai, pr, pi, sr, si, d, n, count); }
+
+template <typename T>
+class pkmBasicSlidingDFT
+{
+public:
+	
+	// bins are indices into the fftSizeOver2 bins of pkmFFT(size); frames
+	// come every hop samples
+	pkmBasicSlidingDFT(int size, 
+					   const int *bins, 
+					   int numBins, 
+					   int hop = 1, 
+					   int maxFrames = 1024, 
+					   pkmFFTWindow window = PKM_FFT_WINDOW_HANN, 
+					   pkmSlidingDFTMethod method = PKM_SLIDING_DFT_AUTO)
+	{
+		fftSize = size;
+		hopSize = hop > 0 ? hop : 1;
+		queueSize = maxFrames > 0 ? maxFrames : 1;
+		FFT = NULL;
+		
+		// the bins, and the frequencies their window needs
+		const int fftBins = (fftSize + 1) / 2;
+		const double a0 = window == PKM_FFT_WINDOW_RECTANGULAR ? 1 : window == PKM_FFT_WINDOW_HANN ? 0.8165 : 0.5;
+		const double a1 = window == PKM_FFT_WINDOW_RECTANGULAR ? 0 : a0;
+		centerWeight = (T) (2 * a0);
+		sideWeight = (T) (-a1);				// 2 (a1 / 2) with pkmFFT's 2X scale
+		std::vector<int> frequencies;
+		for (int b = 0; b < numBins; b++) {
+			if (bins[b] < 0 || bins[b] >= fftBins) {
+				printf("\npkmSlidingDFT: bin %d is not one of the %d bins of a %d point fft.\n", bins[b], fftBins, fftSize);
+				continue;
+			}
+			binIndices.push_back(bins[b]);
+			frequencies.push_back(bins[b]);
+			if (a1 != 0) {
+				frequencies.push_back((bins[b] + fftSize - 1) % fftSize);
+				frequencies.push_back((bins[b] + 1) % fftSize);
+			}
+		}
+		std::sort(frequencies.begin(), frequencies.end());
+		frequencies.erase(std::unique(frequencies.begin(), frequencies.end()), frequencies.end());
+		numBinsTracked = (int) binIndices.size();
+		numFrequencies = (int) frequencies.size();
+		
+		// where each bin finds its frequencies
+		for (int b = 0; b < numBinsTracked; b++) {
+			const int k = binIndices[b];
+			center.push_back((int) (std::lower_bound(frequencies.begin(), frequencies.end(), k) - frequencies.begin()));
+			left.push_back(a1 != 0 ? (int) (std::lower_bound(frequencies.begin(), frequencies.end(), (k + fftSize - 1) % fftSize) - frequencies.begin()) : 0);
+			right.push_back(a1 != 0 ? (int) (std::lower_bound(frequencies.begin(), frequencies.end(), (k + 1) % fftSize) - frequencies.begin()) : 0);
+		}
+		
+		if (method == PKM_SLIDING_DFT_AUTO)
+			method = prefersFFT(fftSize, numFrequencies, hopSize) ? PKM_SLIDING_DFT_FFT : PKM_SLIDING_DFT_RECURSIVE;
+		this->method = method;
+		
+		// lanes padded to the widest vector; padding lanes have no step and
+		// stay at zero
+		paddedFrequencies = (numFrequencies + 15) & ~15;
+		for (int i = 0; i < 8; i++)
+			state[i] = (T *) calloc(paddedFrequencies > 0 ? paddedFrequencies : 1, sizeof(T));
+		frequencyIndex = (long *) calloc(paddedFrequencies > 0 ? paddedFrequencies : 1, sizeof(long));
+		for (int j = 0; j < numFrequencies; j++) {
+			frequencyIndex[j] = frequencies[j];
+			stepReal()[j] = (T) cos(2.0 * M_PI * frequencies[j] / fftSize);
+			stepImag()[j] = (T) -sin(2.0 * M_PI * frequencies[j] / fftSize);
+		}
+		
+		// e^{-2 pi i m / N}, for resetting the phasors
+		cosTable = (T *) malloc(sizeof(T) * fftSize);
+		sinTable = (T *) malloc(sizeof(T) * fftSize);
+		for (int m = 0; m < fftSize; m++) {
+			cosTable[m] = (T) cos(2.0 * M_PI * m / fftSize);
+			sinTable[m] = (T) -sin(2.0 * M_PI * m / fftSize);
+		}
+		
+		// every sample is written twice, so the last fftSize samples are
+		// always contiguous at ring + writePos
+		ring = (T *) calloc(2 * fftSize, sizeof(T));
+		difference = (T *) malloc(sizeof(T) * phasorPeriod);
+		queueReal = (T *) malloc(sizeof(T) * queueSize * std::max(numBinsTracked, 1));
+		queueImag = (T *) malloc(sizeof(T) * queueSize * std::max(numBinsTracked, 1));
+		positions = (long long *) malloc(sizeof(long long) * queueSize);
+		scratch = (T *) malloc(sizeof(T) * 2 * std::max(numBinsTracked, 1));
+		
+		if (this->method == PKM_SLIDING_DFT_FFT) {
+			FFT = new pkmBasicFFT<T>(fftSize);
+			windowRef = pkmFFTPlanCache::instance().window<T>(fftSize, window);
+			frame = (T *) malloc(sizeof(T) * fftSize);
+			binsReal = (T *) malloc(sizeof(T) * fftBins);
+			binsImag = (T *) malloc(sizeof(T) * fftBins);
+		}
+		else {
+			frame = binsReal = binsImag = NULL;
+		}
+		
+		bool bFailed = ring == NULL || difference == NULL || queueReal == NULL || queueImag == NULL || 
+			positions == NULL || scratch == NULL || cosTable == NULL || sinTable == NULL || frequencyIndex == NULL;
+		for (int i = 0; i < 8; i++)
+			bFailed = bFailed || state[i] == NULL;
+		if (this->method == PKM_SLIDING_DFT_FFT)
+			bFailed = bFailed || frame == NULL || binsReal == NULL || binsImag == NULL;
+		if (bFailed) {
+			printf("\npkmSlidingDFT failed to allocate enough memory.\n");
+		}
+		
+		polarKernels = pkmPolarKernels<T>::select(PKM_POLAR_EXACT);
+		update = selectKernel(pkmSIMDGetISA());
+		reset();
+	}
+	~pkmBasicSlidingDFT()
+	{
+		delete FFT;
+		for (int i = 0; i < 8; i++)
+			free(state[i]);
+		free(frequencyIndex);
+		free(cosTable);
+		free(sinTable);
+		free(ring);
+		free(difference);
+		free(queueReal);
+		free(queueImag);
+		free(positions);
+		free(scratch);
+		free(frame);
+		free(binsReal);
+		free(binsImag);
+	}
+	
+	// back to silence with an empty queue
+	void reset()
+	{
+		memset(ring, 0, sizeof(T) * 2 * fftSize);
+		memset(sumReal(), 0, sizeof(T) * paddedFrequencies);
+		memset(sumImag(), 0, sizeof(T) * paddedFrequencies);
+		resetPhasors(0);
+		writePos = 0;
+		sinceLastFrame = 0;
+		sinceRecompute = 0;
+		samplesPushed = 0;
+		droppedFrames = 0;
+		head = 0;
+		numQueued = 0;
+	}
+	
+	// whether a full fft every hop is cheaper than updating frequencies
+	// running sums every sample; measured, a frequency's update takes about
+	// as long per sample as 4 of the fft's 2.5 N log2 N flops, and the
+	// windowed copy about 4 N
+	static bool prefersFFT(int size, int frequencies, int hop)
+	{
+		return 4.0 * frequencies * hop > 2.5 * size * log2((double) size) + 4.0 * size;
+	}
+	
+	// returns the number of frames completed by these samples
+	int push(const T *samples, int count)
+	{
+		int completed = 0;
+		while (count > 0) {
+			// up to the next frame, the ring's end or the next phasor reset
+			int n = std::min(hopSize - sinceLastFrame, count);
+			n = std::min(n, fftSize - writePos);
+			n = std::min(n, phasorPeriod - writePos % phasorPeriod);
+			
+			if (method == PKM_SLIDING_DFT_RECURSIVE) {
+				for (int t = 0; t < n; t++)
+					difference[t] = samples[t] - ring[writePos + t];
+				update(sumReal(), sumImag(), phasorReal(), phasorImag(), stepReal(), stepImag(), 
+					   difference, n, paddedFrequencies);
+			}
+			memcpy(ring + writePos, samples, sizeof(T) * n);
+			memcpy(ring + writePos + fftSize, samples, sizeof(T) * n);
+			writePos = (writePos + n) % fftSize;
+			sinceRecompute += n;
+			
+			if (method == PKM_SLIDING_DFT_RECURSIVE) {
+				if (writePos % phasorPeriod == 0)
+					resetPhasors(writePos);
+				if (writePos == 0 && sinceRecompute >= recomputePeriod * fftSize)
+					recompute();
+			}
+			
+			samples += n;
+			count -= n;
+			samplesPushed += n;
+			sinceLastFrame += n;
+			if (sinceLastFrame == hopSize) {
+				analyze();
+				sinceLastFrame = 0;
+				completed++;
+			}
+		}
+		return completed;
+	}
+	
+	int framesAvailable() const
+	{
+		return numQueued;
+	}
+	
+	// getSamplesPushed() when the oldest queued frame was completed, or -1
+	long long framePosition() const
+	{
+		return numQueued ? positions[head] : -1;
+	}
+	
+	// the oldest queued frame's magnitudes and phases, one per bin in the
+	// order given to the constructor (either pointer may be NULL), and
+	// removes it; false when the queue is empty
+	bool pop(T *magnitude = NULL, T *phase = NULL)
+	{
+		if (numQueued == 0)
+			return false;
+		const long row = (long) head * numBinsTracked;
+		polarKernels.polar(queueReal + row, queueImag + row, 
+						   magnitude ? magnitude : scratch, phase ? phase : scratch + numBinsTracked, numBinsTracked);
+		head = (head + 1) % queueSize;
+		numQueued--;
+		return true;
+	}
+	
+	// the same frame as real and imaginary parts, as PKM_FFT_OUTPUT_SPLIT
+	bool popComplex(T *real, T *imag)
+	{
+		if (numQueued == 0)
+			return false;
+		const long row = (long) head * numBinsTracked;
+		memcpy(real, queueReal + row, sizeof(T) * numBinsTracked);
+		memcpy(imag, queueImag + row, sizeof(T) * numBinsTracked);
+		head = (head + 1) % queueSize;
+		numQueued--;
+		return true;
+	}
+	
+	// accuracy of pop's magnitudes and phases; see pkmPolar.h
+	void setPolarAccuracy(pkmPolarAccuracy accuracy)
+	{
+		polarKernels = pkmPolarKernels<T>::select(accuracy);
+	}
+	
+	int getNumBins() const
+	{
+		return numBinsTracked;
+	}
+	
+	// frequencies with a running sum, the bins and their window's neighbours
+	int getNumFrequencies() const
+	{
+		return numFrequencies;
+	}
+	
+	int getFFTSize() const
+	{
+		return fftSize;
+	}
+	
+	int getHopSize() const
+	{
+		return hopSize;
+	}
+	
+	pkmSlidingDFTMethod getMethod() const
+	{
+		return method;
+	}
+	
+	long long getSamplesPushed() const
+	{
+		return samplesPushed;
+	}
+	
+	long long getDroppedFrames() const
+	{
+		return droppedFrames;
+	}
+	
+private:
+	
+	typedef void (*UpdateKernel)(T *, T *, T *, T *, const T *, const T *, const T *, int, int);
+	
+	PKM_SLIDING_DFT_KERNEL_ENTRY_POINT(Scalar, , 1)
+#if defined(PKM_SIMD_HAVE_SSE2) || defined(PKM_SIMD_HAVE_NEON)
+	PKM_SLIDING_DFT_KERNEL_ENTRY_POINT(128, , 16 / sizeof(T))
+#endif
+#if defined(PKM_SIMD_HAVE_AVX2)
+	PKM_SLIDING_DFT_KERNEL_ENTRY_POINT(AVX2, PKM_SIMD_TARGET("avx2,fma"), 32 / sizeof(T))
+#endif
+#if defined(PKM_SIMD_HAVE_AVX512)
+	PKM_SLIDING_DFT_KERNEL_ENTRY_POINT(AVX512, PKM_SIMD_TARGET("avx512f,avx2,fma"), 64 / sizeof(T))
+#endif
+	
+	static UpdateKernel selectKernel(pkmSIMDISA isa)
+	{
+		switch (isa) {
+#if defined(PKM_SIMD_HAVE_SSE2)
+			case PKM_ISA_SSE2:		return update128;
+#endif
+#if defined(PKM_SIMD_HAVE_NEON)
+			case PKM_ISA_NEON:		return update128;
+#endif
+#if defined(PKM_SIMD_HAVE_AVX2)
+			case PKM_ISA_AVX2:		return updateAVX2;
+#endif
+#if defined(PKM_SIMD_HAVE_AVX512)
+			case PKM_ISA_AVX512:	return updateAVX512;
+#endif
+			default:				return updateScalar;
+		}
+	}
+	
+	// running sums, phasors and their steps, one lane per frequency
+	T * sumReal()		{ return state[0]; }
+	T * sumImag()		{ return state[1]; }
+	T * phasorReal()	{ return state[2]; }
+	T * phasorImag()	{ return state[3]; }
+	T * stepReal()		{ return state[4]; }
+	T * stepImag()		{ return state[5]; }
+	
+	// phasors of the sample at ring position m, from the table
+	void resetPhasors(int m)
+	{
+		for (int j = 0; j < numFrequencies; j++) {
+			const long i = (frequencyIndex[j] * m) % fftSize;
+			phasorReal()[j] = cosTable[i];
+			phasorImag()[j] = sinTable[i];
+		}
+	}
+	
+	// the sums from scratch over the ring, which starts at position 0 here
+	void recompute()
+	{
+		memset(sumReal(), 0, sizeof(T) * paddedFrequencies);
+		memset(sumImag(), 0, sizeof(T) * paddedFrequencies);
+		for (int m = 0; m < fftSize; m += phasorPeriod) {
+			resetPhasors(m);
+			update(sumReal(), sumImag(), phasorReal(), phasorImag(), stepReal(), stepImag(), 
+				   ring + m, std::min((int) phasorPeriod, fftSize - m), paddedFrequencies);
+		}
+		resetPhasors(0);
+		sinceRecompute = 0;
+	}
+	
+	// queues the bins of the last fftSize samples
+	void analyze()
+	{
+		if (numQueued == queueSize) {
+			head = (head + 1) % queueSize;
+			numQueued--;
+			droppedFrames++;
+		}
+		const int slot = (head + numQueued) % queueSize;
+		T *re = queueReal + (long) slot * numBinsTracked, *im = queueImag + (long) slot * numBinsTracked;
+		
+		if (method == PKM_SLIDING_DFT_FFT) {
+			// window here, so every window of pkmFFTPlanCache works
+			const T *window = windowRef.get();
+			for (int i = 0; i < fftSize; i++)
+				frame[i] = ring[writePos + i] * window[i];
+			FFT->forward(0, frame, PKM_FFT_OUTPUT_SPLIT, binsReal, binsImag, false);
+			for (int b = 0; b < numBinsTracked; b++) {
+				re[b] = binsReal[binIndices[b]];
+				im[b] = binsImag[binIndices[b]];
+			}
+		}
+		else {
+			// X_j = A_j conj(P_j), where the phasors are now at the sample
+			// after the frame's last, i.e. its first mod N
+			T *xr = state[6], *xi = state[7];
+			const T *ar = sumReal(), *ai = sumImag(), *pr = phasorReal(), *pi = phasorImag();
+			for (int j = 0; j < numFrequencies; j++) {
+				xr[j] = ar[j] * pr[j] + ai[j] * pi[j];
+				xi[j] = ai[j] * pr[j] - ar[j] * pi[j];
+			}
+			for (int b = 0; b < numBinsTracked; b++) {
+				const int c = center[b], l = left[b], r = right[b];
+				re[b] = centerWeight * xr[c] + sideWeight * (xr[l] + xr[r]);
+				im[b] = centerWeight * xi[c] + sideWeight * (xi[l] + xi[r]);
+				if (binIndices[b] == 0)
+					im[b] = 0;
+			}
+		}
+		positions[slot] = samplesPushed;
+		numQueued++;
+	}
+	
+	enum
+	{
+		phasorPeriod = 64,		// samples between phasor resets
+		recomputePeriod = 4		// fftSizes between recomputed sums
+	};
+	
+	pkmBasicFFT<T>			*FFT;
+	std::shared_ptr<const T> windowRef;
+	pkmPolarKernels<T>		polarKernels;
+	UpdateKernel			update;
+	pkmSlidingDFTMethod		method;
+	
+	std::vector<int>		binIndices,
+							center,					// frequency of each bin
+							left,					// and of its neighbours
+							right;
+	T						centerWeight,
+							sideWeight;
+	
+	T						*state[8],				// 6 and 7 hold a frame's X_j
+							*cosTable,
+							*sinTable,
+							*ring,
+							*difference,
+							*queueReal,
+							*queueImag,
+							*scratch,
+							*frame,
+							*binsReal,
+							*binsImag;
+	long					*frequencyIndex;
+	long long				*positions;
+	
+	int						fftSize,
+							hopSize,
+							queueSize,
+							numBinsTracked,
+							numFrequencies,
+							paddedFrequencies,
+							writePos,
+							sinceLastFrame,
+							head,
+							numQueued;
+	long					sinceRecompute;
+	long long				samplesPushed,
+							droppedFrames;
+};
+
+typedef pkmBasicSlidingDFT<float> pkmSlidingDFT;
+typedef pkmBasicSlidingDFT<double> pkmSlidingDFTD;
@@ -0,0 +1,462 @@
+/*
+ *  pkmSpectrogramFile.h
+ *
+ *  Memory-mapped on-disk spectrogram store
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  A spectrogram file holds the magnitudes and phases of an STFT too long to
+ *  keep in memory.  The file is mapped with mmap, so pkmSTFT writes its
+ *  frames straight into the page cache and readers get pointers into the
+ *  mapping for any range of frames without copying or reading the rest.
+ *
+ *  Format (version 1, native little endian):
+ *
+ *      0       pkmSpectrogramHeader: magic "PKMSPEC", version, fftSize,
+ *              hopSize, bins, window, storage type, layout, number of
+ *              frames and samples, sample rate and the plane offsets
+ *      4096    magnitude plane, numFrames rows of bins values
+ *      ...     phase plane, likewise, starting on the next 4096 byte boundary
+ *
+ *  Rows are stored as float, double, pkmHalf or pkmBFloat16; the 16 bit
+ *  types halve the file (see pkmHalf.h for their accuracy).  A 10 hour
+ *  48 kHz recording at fftSize 1024 and hop 128 is 13.5 million frames of
+ *  512 bins, 55 GB as float magnitude and phase or 28 GB as pkmHalf.
+ *
+ *  Usage:
+ *
+ *  pkmSTFT stft(1024, 128);
+ *  pkmSpectrogramFile file;
+ *  file.create("recording.pkmspec", 1024, 128, stft.getNumWindows(buffer_size), 48000, PKM_SPECTROGRAM_FLOAT16);
+ *  stft.STFT(sample_data, buffer_size, file);
+ *  file.close();
+ *
+ *  pkmSpectrogramFile reader;
+ *  reader.open("recording.pkmspec");
+ *  reader.prefetch(1000, 2000);
+ *  const pkmHalf *magnitudes = reader.magnitudes<pkmHalf>(1000);		// rows 1000 to 1999
+ *  stft.ISTFT(sample_data, buffer_size, reader);
+ *
+ *  The mapping is POSIX (Linux, OS X).  Pages of a file created on a full
+ *  disk can fail when first written, so create() reserves the space up
+ *  front where the filesystem allows it.
+ *
+ */
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pkmFFTPlanCache.h"
+#include "pkmHalf.h"
+
+enum pkmSpectrogramType
+{
+	PKM_SPECTROGRAM_FLOAT32 = 0,
+	PKM_SPECTROGRAM_FLOAT64,
+	PKM_SPECTROGRAM_FLOAT16,		// pkmHalf
+	PKM_SPECTROGRAM_BFLOAT16		// pkmBFloat16
+};
+
+enum pkmSpectrogramLayout
+{
+	PKM_SPECTROGRAM_PLANAR = 0		// magnitude plane then phase plane, one row per frame
+};
+
+template <typename S> struct pkmSpectrogramTypeOf;
+template <> struct pkmSpectrogramTypeOf<float>			{ static const pkmSpectrogramType value = PKM_SPECTROGRAM_FLOAT32; };
+template <> struct pkmSpectrogramTypeOf<double>			{ static const pkmSpectrogramType value = PKM_SPECTROGRAM_FLOAT64; };
+template <> struct pkmSpectrogramTypeOf<pkmHalf>		{ static const pkmSpectrogramType value = PKM_SPECTROGRAM_FLOAT16; };
+template <> struct pkmSpectrogramTypeOf<pkmBFloat16>	{ static const pkmSpectrogramType value = PKM_SPECTROGRAM_BFLOAT16; };
+
+// what is on disk at offset 0; fixed size, so new fields go at the end with
+// a new version
+struct pkmSpectrogramHeader
+{
+	char				magic[8];			// "PKMSPEC"
+	uint32_t			version;
+	uint32_t			byteOrder;			// 0x01020304 as written
+	uint32_t			fftSize,
+						hopSize,
+						bins,
+						window,				// pkmFFTWindow
+						type,				// pkmSpectrogramType
+						layout;				// pkmSpectrogramLayout
+	uint64_t			numFrames,
+						numSamples;			// signal length, 0 until an STFT has been written
+	double				sampleRate;
+	uint64_t			magnitudeOffset,	// bytes from the start of the file
+						phaseOffset,
+						rowBytes;
+};
+
+class pkmSpectrogramFile
+{
+public:
+	
+	static const uint32_t	currentVersion = 1;
+	static const size_t		planeAlignment = 4096;
+	
+	pkmSpectrogramFile()
+	{
+		map = NULL;
+		mapBytes = 0;
+		header = NULL;
+		bWritable = false;
+	}
+	~pkmSpectrogramFile()
+	{
+		close();
+	}
+	
+	static size_t typeSize(pkmSpectrogramType type)
+	{
+		switch (type) {
+			case PKM_SPECTROGRAM_FLOAT32:	return sizeof(float);
+			case PKM_SPECTROGRAM_FLOAT64:	return sizeof(double);
+			case PKM_SPECTROGRAM_FLOAT16:	return sizeof(pkmHalf);
+			case PKM_SPECTROGRAM_BFLOAT16:	return sizeof(pkmBFloat16);
+		}
+		return 0;
+	}
+	
+	// makes (or truncates) path with room for numFrames frames of an fftSize
+	// transform and maps it for writing; the planes start out zero
+	bool create(const char *path, int fftSize, int hopSize, long numFrames, double sampleRate,
+				pkmSpectrogramType type = PKM_SPECTROGRAM_FLOAT32,
+				pkmFFTWindow window = PKM_FFT_WINDOW_HANN,
+				pkmSpectrogramLayout layout = PKM_SPECTROGRAM_PLANAR)
+	{
+		close();
+		if (fftSize <= 0 || hopSize <= 0 || numFrames < 0 || typeSize(type) == 0) {
+			printf("\npkmSpectrogramFile: invalid parameters for %s.\n", path);
+			return false;
+		}
+		
+		pkmSpectrogramHeader h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, "PKMSPEC", 8);
+		h.version = currentVersion;
+		h.byteOrder = 0x01020304;
+		h.fftSize = fftSize;
+		h.hopSize = hopSize;
+		h.bins = (fftSize + 1) / 2;		// as pkmFFT's fftSizeOver2
+		h.window = window;
+		h.type = type;
+		h.layout = layout;
+		h.numFrames = numFrames;
+		h.sampleRate = sampleRate;
+		h.rowBytes = (uint64_t) h.bins * typeSize(type);
+		h.magnitudeOffset = planeAlignment;
+		h.phaseOffset = roundUp(h.magnitudeOffset + h.numFrames * h.rowBytes);
+		uint64_t fileBytes = h.phaseOffset + h.numFrames * h.rowBytes;
+		
+		int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			printf("\npkmSpectrogramFile could not create %s.\n", path);
+			return false;
+		}
+		bool bSized = ftruncate(fd, (off_t) fileBytes) == 0;
+#ifdef __linux__
+		// reserve the blocks now rather than fail on a page write later
+		if (bSized)
+			bSized = posix_fallocate(fd, 0, (off_t) fileBytes) == 0;
+#endif
+		if (!bSized) {
+			printf("\npkmSpectrogramFile could not make %s %llu bytes long.\n", path, (unsigned long long) fileBytes);
+			::close(fd);
+			return false;
+		}
+		if (!mapFile(fd, (size_t) fileBytes, true)) {
+			printf("\npkmSpectrogramFile could not map %s.\n", path);
+			return false;
+		}
+		memcpy(header, &h, sizeof(h));
+		return true;
+	}
+	
+	// maps an existing file, read only unless bWrite
+	bool open(const char *path, bool bWrite = false)
+	{
+		close();
+		int fd = ::open(path, bWrite ? O_RDWR : O_RDONLY);
+		if (fd < 0) {
+			printf("\npkmSpectrogramFile could not open %s.\n", path);
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < sizeof(pkmSpectrogramHeader)) {
+			printf("\npkmSpectrogramFile could not map %s.\n", path);
+			::close(fd);
+			return false;
+		}
+		if (!mapFile(fd, (size_t) st.st_size, bWrite)) {
+			printf("\npkmSpectrogramFile could not map %s.\n", path);
+			return false;
+		}
+		
+		const pkmSpectrogramHeader &h = *header;
+		const char *problem = NULL;
+		if (memcmp(h.magic, "PKMSPEC", 8) != 0)
+			problem = "is not a spectrogram file";
+		else if (h.byteOrder != 0x01020304)
+			problem = "was written with the other byte order";
+		else if (h.version == 0 || h.version > currentVersion)
+			problem = "has an unsupported version";
+		else if (h.layout != PKM_SPECTROGRAM_PLANAR || typeSize((pkmSpectrogramType) h.type) == 0 || h.rowBytes == 0 || 
+				 h.bins != (h.fftSize + 1) / 2 || h.rowBytes != h.bins * typeSize((pkmSpectrogramType) h.type))
+			problem = "has an unknown layout or storage type";
+		else if (!planeFits(h.magnitudeOffset, h.numFrames, h.rowBytes) || 
+				 !planeFits(h.phaseOffset, h.numFrames, h.rowBytes))
+			problem = "is truncated";
+		if (problem) {
+			printf("\npkmSpectrogramFile: %s %s.\n", path, problem);
+			close();
+			return false;
+		}
+		return true;
+	}
+	
+	// unmaps; written pages reach the disk in the background
+	void close()
+	{
+		if (map)
+			munmap(map, mapBytes);
+		map = NULL;
+		mapBytes = 0;
+		header = NULL;
+		bWritable = false;
+	}
+	
+	bool isOpen() const
+	{
+		return map != NULL;
+	}
+	
+	bool isWritable() const
+	{
+		return bWritable;
+	}
+	
+	// writes the dirty pages of frames [begin, end) back, or of every frame
+	// when end is 0, waiting for them when bWait
+	bool flush(long begin = 0, long end = 0, bool bWait = true)
+	{
+		if (!map || !bWritable)
+			return false;
+		int flags = bWait ? MS_SYNC : MS_ASYNC;
+		if (end <= 0)
+			return msync(map, mapBytes, flags) == 0;
+		bool bOk = msync(map, header->magnitudeOffset, flags) == 0;
+		bOk &= syncRows(header->magnitudeOffset, begin, end, flags);
+		bOk &= syncRows(header->phaseOffset, begin, end, flags);
+		return bOk;
+	}
+	
+	// hints that frames [begin, end) will be read soon, so the kernel pages
+	// them in ahead of time
+	void prefetch(long begin, long end) const
+	{
+		if (!map)
+			return;
+		adviseRows(header->magnitudeOffset, begin, end, MADV_WILLNEED);
+		adviseRows(header->phaseOffset, begin, end, MADV_WILLNEED);
+	}
+	
+	// zero-copy access to the rows from frame on, which stay valid until
+	// close(); NULL if S is not the file's storage type
+	template <typename S>
+	const S *magnitudes(long frame = 0) const
+	{
+		return row<S>(header ? header->magnitudeOffset : 0, frame);
+	}
+	
+	template <typename S>
+	const S *phases(long frame = 0) const
+	{
+		return row<S>(header ? header->phaseOffset : 0, frame);
+	}
+	
+	// the same rows for writing; NULL as well when the file is read only
+	template <typename S>
+	S *editMagnitudes(long frame = 0)
+	{
+		return bWritable ? (S *) magnitudes<S>(frame) : NULL;
+	}
+	
+	template <typename S>
+	S *editPhases(long frame = 0)
+	{
+		return bWritable ? (S *) phases<S>(frame) : NULL;
+	}
+	
+	void setNumSamples(long n)
+	{
+		if (header && bWritable)
+			header->numSamples = n;
+	}
+	
+	const pkmSpectrogramHeader &getHeader() const			{ return *header; }
+	int getFFTSize() const									{ return header ? header->fftSize : 0; }
+	int getHopSize() const									{ return header ? header->hopSize : 0; }
+	int getBins() const										{ return header ? header->bins : 0; }
+	long getNumFrames() const								{ return header ? (long) header->numFrames : 0; }
+	long getNumSamples() const								{ return header ? (long) header->numSamples : 0; }
+	double getSampleRate() const							{ return header ? header->sampleRate : 0; }
+	pkmSpectrogramType getType() const						{ return (pkmSpectrogramType) (header ? header->type : 0); }
+	pkmSpectrogramLayout getLayout() const					{ return (pkmSpectrogramLayout) (header ? header->layout : 0); }
+	pkmFFTWindow getWindow() const							{ return (pkmFFTWindow) (header ? header->window : 0); }
+	size_t getFileSize() const								{ return mapBytes; }
+	
+private:
+	
+	static uint64_t roundUp(uint64_t bytes)
+	{
+		return (bytes + planeAlignment - 1) / planeAlignment * planeAlignment;
+	}
+	
+	// numFrames rows at offset lie inside the mapping, divided rather than
+	// multiplied so a corrupt count cannot wrap around
+	bool planeFits(uint64_t offset, uint64_t numFrames, uint64_t rowBytes) const
+	{
+		return offset >= sizeof(pkmSpectrogramHeader) && offset <= mapBytes && 
+			numFrames <= (mapBytes - offset) / rowBytes;
+	}
+	
+	// the descriptor is not needed once mapped, and is closed even on failure
+	bool mapFile(int fd, size_t bytes, bool bWrite)
+	{
+		void *p = mmap(NULL, bytes, bWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return false;
+		map = (char *) p;
+		mapBytes = bytes;
+		header = (pkmSpectrogramHeader *) p;
+		bWritable = bWrite;
+		return true;
+	}
+	
+	template <typename S>
+	const S *row(uint64_t plane, long frame) const
+	{
+		if (!header || header->type != (uint32_t) pkmSpectrogramTypeOf<S>::value || 
+			frame < 0 || (uint64_t) frame > header->numFrames)
+			return NULL;
+		return (const S *) (map + plane + frame * header->rowBytes);
+	}
+	
+	// span of rows [begin, end) of a plane, widened to whole pages as msync
+	// and madvise want
+	bool span(uint64_t plane, long begin, long end, char *&start, size_t &bytes) const
+	{
+		const uint64_t page = (uint64_t) sysconf(_SC_PAGESIZE);
+		if (begin < 0)
+			begin = 0;
+		if ((uint64_t) end > header->numFrames)
+			end = (long) header->numFrames;
+		if (end <= begin)
+			return false;
+		uint64_t from = (plane + begin * header->rowBytes) / page * page;
+		uint64_t to = plane + end * header->rowBytes;
+		start = map + from;
+		bytes = (size_t) (to - from);
+		return true;
+	}
+	
+	bool syncRows(uint64_t plane, long begin, long end, int flags)
+	{
+		char *start;
+		size_t bytes;
+		return !span(plane, begin, end, start, bytes) || msync(start, bytes, flags) == 0;
+	}
+	
+	void adviseRows(uint64_t plane, long begin, long end, int advice) const
+	{
+		char *start;
+		size_t bytes;
+		if (span(plane, begin, end, start, bytes))
+			madvise(start, bytes, advice);
+	}
+	
+	char					*map;
+	size_t					mapBytes;
+	pkmSpectrogramHeader	*header;
+	bool					bWritable;
+};
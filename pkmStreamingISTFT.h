@@ -0,0 +1,230 @@
+/*
+ *  pkmStreamingISTFT.h
+ *
+ *  Streaming overlap-add resynthesis with window-sum normalization
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  pkmStreamingISTFT takes one frame of magnitudes and phases at a time and
+ *  returns exactly hopSize output samples per frame from a preallocated
+ *  overlap-add accumulator.  Nothing is allocated after construction.
+ *
+ *  Instead of pkmFFT::inverse's fixed 1/(4 fftSize), which only gives back
+ *  the input for hop = fftSize/4, each frame is weighted by
+ *
+ *      g[i] = s[i] / sum_k a[i + k hop] s[i + k hop]
+ *
+ *  with a the analysis window pkmFFT applies (Hann) and s the synthesis
+ *  window, precomputed once.  The weighted frames sum to the analysed
+ *  signal for any hop, except where the window sum is close to 0: a Hann
+ *  pair with hop = fftSize leaves frame edges that cannot be recovered
+ *  (gains under 1e-6 of the peak sum are set to 0).
+ *
+ *  Frame t from pkmStreamingSTFT covers input samples up to (t+1)*hopSize,
+ *  and the samples returned with it end fftSize - hopSize earlier, so the
+ *  pair reproduces the input delayed by getLatency() = fftSize - hopSize.
+ *
+ *  Usage:
+ *
+ *  pkmStreamingSTFT analysis(512, 128);
+ *  pkmStreamingISTFT synthesis(512, 128);
+ *
+ *  // audio callback, numSamples a multiple of the hop
+ *  analysis.push(input, numSamples);
+ *  for (int i = 0; analysis.pop(magnitudes, phases); i += 128)
+ *      synthesis.push(magnitudes, phases, output + i);
+ *
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include "pkmFFT.h"
+#include "pkmFFTPlanCache.h"
+
+class pkmStreamingISTFT
+{
+public:
+	
+	pkmStreamingISTFT(int size, int hop = 0, pkmFFTWindow synthesisWindow = PKM_FFT_WINDOW_HANN)
+	{
+		fftSize = size;
+		hopSize = hop ? hop : fftSize/4;
+		
+		FFT = new pkmFFT(fftSize);
+		fftBins = FFT->fftSizeOver2;
+		
+		frame = (float *) malloc(sizeof(float) * fftSize);
+		accumulator = (float *) malloc(sizeof(float) * fftSize);
+		gain = (float *) malloc(sizeof(float) * fftSize);
+		if (frame == NULL || accumulator == NULL || gain == NULL) {
+			printf("\npkmStreamingISTFT failed to allocate enough memory.\n");
+		}
+		else {
+			setSynthesisWindow(synthesisWindow);
+		}
+		reset();
+	}
+	~pkmStreamingISTFT()
+	{
+		delete FFT;
+		free(frame);
+		free(accumulator);
+		free(gain);
+	}
+	
+	// precomputes g[i] for this synthesis window against pkmFFT's analysis window
+	void setSynthesisWindow(pkmFFTWindow synthesisWindow)
+	{
+		pkmFFTPlanCache &cache = pkmFFTPlanCache::instance();
+		std::shared_ptr<const float> analysis = cache.window<float>(fftSize, PKM_FFT_WINDOW_HANN);
+		std::shared_ptr<const float> synthesis = cache.window<float>(fftSize, synthesisWindow);
+		const float *a = analysis.get(), *s = synthesis.get();
+		
+		// the overlapping window products repeat every hop
+		double peak = 0;
+		for (int i = 0; i < fftSize; i++) {
+			double sum = 0;
+			for (int j = i % hopSize; j < fftSize; j += hopSize)
+				sum += (double) a[j] * s[j];
+			gain[i] = (float) sum;
+			peak = sum > peak ? sum : peak;
+		}
+		
+		// pkmFFT::inverse without its window returns half the analysed frame
+		// (1/(4 fftSize) against the 2 fftSize of a real round trip)
+		for (int i = 0; i < fftSize; i++)
+			gain[i] = gain[i] > 1e-6 * peak ? (float) (2.0 * s[i] / gain[i]) : 0.0f;
+	}
+	
+	// drops whatever is still being overlap-added
+	void reset()
+	{
+		memset(accumulator, 0, sizeof(float) * fftSize);
+		readPos = 0;
+	}
+	
+	// overlap-adds one frame and writes the hopSize samples it completes
+	void push(const float *magnitudes, const float *phases, float *output)
+	{
+		FFT->inverse(0, frame, (float *) magnitudes, (float *) phases, false);
+		
+		// accumulator is a ring starting at readPos
+		int first = fftSize - readPos;
+		for (int i = 0; i < first; i++)
+			accumulator[readPos + i] += frame[i] * gain[i];
+		for (int i = first; i < fftSize; i++)
+			accumulator[i - first] += frame[i] * gain[i];
+		
+		int n = hopSize < fftSize ? hopSize : fftSize;
+		for (int i = 0; i < n; i++) {
+			output[i] = accumulator[readPos];
+			accumulator[readPos] = 0;
+			readPos = readPos + 1 == fftSize ? 0 : readPos + 1;
+		}
+		// hops longer than the frame leave gaps of silence
+		for (int i = n; i < hopSize; i++)
+			output[i] = 0;
+	}
+	
+	int getBins() const
+	{
+		return fftBins;
+	}
+	
+	int getHopSize() const
+	{
+		return hopSize;
+	}
+	
+	// samples between an input sample and its resynthesis through pkmStreamingSTFT
+	int getLatency() const
+	{
+		return fftSize > hopSize ? fftSize - hopSize : 0;
+	}
+	
+	pkmFFT				*FFT;
+	
+private:
+	
+	float				*frame,
+						*accumulator,
+						*gain;			// synthesis window / window-sum
+	
+	int					fftSize,
+						fftBins,
+						hopSize,
+						readPos;
+};
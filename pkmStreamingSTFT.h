@@ -0,0 +1,286 @@
+/*
+ *  pkmStreamingSTFT.h
+ *
+ *  Streaming STFT analysis of audio blocks of any size, for use in audio callbacks
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  pkmStreamingSTFT keeps the last fftSize samples in a ring buffer and runs
+ *  a frame through pkmFFT::forward every hopSize samples, into a queue of
+ *  maxFrames preallocated frames.  Everything is allocated by the
+ *  constructor; push and pop never allocate or lock.
+ *
+ *  The stream starts from silence: frame t covers samples
+ *  [(t+1)*hopSize - fftSize, (t+1)*hopSize), so the first frame is ready
+ *  after hopSize samples.  Latency is therefore bounded by the hop:
+ *
+ *      a sample is part of a queued frame at most hopSize - 1 samples after
+ *      it is pushed, within the push call that completes that frame; the
+ *      newest sample of every frame has waited 0 samples and the oldest
+ *      fftSize - 1.
+ *
+ *  framePosition() gives the sample count at which the front frame was
+ *  completed and getSamplesPushed() the current one, so the latency of any
+ *  frame can be measured as their difference.  A full queue drops its
+ *  oldest frame rather than block the caller; getDroppedFrames() counts them.
+ *
+ *  Usage:
+ *
+ *  pkmStreamingSTFT stft(512, 128);
+ *  float magnitudes[257], phases[257];
+ *
+ *  // audio callback
+ *  stft.push(input, numSamples);
+ *  while (stft.pop(magnitudes, phases))
+ *      process(magnitudes, phases);
+ *
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include "pkmFFT.h"
+
+class pkmStreamingSTFT
+{
+public:
+	
+	pkmStreamingSTFT(int size, int hop = 0, int maxFrames = 64)
+	{
+		fftSize = size;
+		hopSize = hop ? hop : fftSize/4;
+		queueSize = maxFrames > 0 ? maxFrames : 1;
+		
+		FFT = new pkmFFT(fftSize);
+		fftBins = FFT->fftSizeOver2;
+		
+		// every sample is written twice, so the last fftSize samples are
+		// always contiguous at ring + writePos
+		ring = (float *) calloc(2 * fftSize, sizeof(float));
+		magnitudes = (float *) malloc(sizeof(float) * queueSize * fftBins);
+		phases = (float *) malloc(sizeof(float) * queueSize * fftBins);
+		positions = (long long *) malloc(sizeof(long long) * queueSize);
+		if (ring == NULL || magnitudes == NULL || phases == NULL || positions == NULL) {
+			printf("\npkmStreamingSTFT failed to allocate enough memory.\n");
+		}
+		
+		reset();
+	}
+	~pkmStreamingSTFT()
+	{
+		delete FFT;
+		free(ring);
+		free(magnitudes);
+		free(phases);
+		free(positions);
+	}
+	
+	// back to silence with an empty queue
+	void reset()
+	{
+		memset(ring, 0, sizeof(float) * 2 * fftSize);
+		writePos = 0;
+		sinceLastFrame = 0;
+		samplesPushed = 0;
+		droppedFrames = 0;
+		head = 0;
+		numQueued = 0;
+	}
+	
+	// returns the number of frames completed by these samples
+	int push(const float *samples, int count)
+	{
+		int completed = 0;
+		while (count > 0) {
+			// up to the next frame or the ring's end, whichever is first
+			int n = hopSize - sinceLastFrame;
+			if (n > count)
+				n = count;
+			if (n > fftSize - writePos)
+				n = fftSize - writePos;
+			
+			memcpy(ring + writePos, samples, sizeof(float) * n);
+			memcpy(ring + writePos + fftSize, samples, sizeof(float) * n);
+			writePos = (writePos + n) % fftSize;
+			
+			samples += n;
+			count -= n;
+			samplesPushed += n;
+			sinceLastFrame += n;
+			if (sinceLastFrame == hopSize) {
+				analyze();
+				sinceLastFrame = 0;
+				completed++;
+			}
+		}
+		return completed;
+	}
+	
+	int framesAvailable() const
+	{
+		return numQueued;
+	}
+	
+	// the oldest queued frame, valid until the next push or pop
+	const float * frontMagnitudes() const
+	{
+		return numQueued ? magnitudes + (long) head * fftBins : NULL;
+	}
+	const float * frontPhases() const
+	{
+		return numQueued ? phases + (long) head * fftBins : NULL;
+	}
+	
+	// getSamplesPushed() when the oldest queued frame was completed, or -1
+	long long framePosition() const
+	{
+		return numQueued ? positions[head] : -1;
+	}
+	
+	// copies out the oldest queued frame (either pointer may be NULL) and
+	// removes it; false when the queue is empty
+	bool pop(float *magnitude = NULL, float *phase = NULL)
+	{
+		if (numQueued == 0)
+			return false;
+		if (magnitude)
+			memcpy(magnitude, frontMagnitudes(), sizeof(float) * fftBins);
+		if (phase)
+			memcpy(phase, frontPhases(), sizeof(float) * fftBins);
+		head = (head + 1) % queueSize;
+		numQueued--;
+		return true;
+	}
+	
+	int getBins() const
+	{
+		return fftBins;
+	}
+	
+	int getHopSize() const
+	{
+		return hopSize;
+	}
+	
+	// most samples any pushed sample waits before it is part of a frame
+	int getMaxLatency() const
+	{
+		return hopSize - 1;
+	}
+	
+	long long getSamplesPushed() const
+	{
+		return samplesPushed;
+	}
+	
+	long long getDroppedFrames() const
+	{
+		return droppedFrames;
+	}
+	
+	pkmFFT				*FFT;
+	
+private:
+	
+	void analyze()
+	{
+		if (numQueued == queueSize) {
+			// full: the oldest frame makes room
+			head = (head + 1) % queueSize;
+			numQueued--;
+			droppedFrames++;
+		}
+		int slot = (head + numQueued) % queueSize;
+		FFT->forward(0, ring + writePos, magnitudes + (long) slot * fftBins, phases + (long) slot * fftBins);
+		positions[slot] = samplesPushed;
+		numQueued++;
+	}
+	
+	float				*ring,
+						*magnitudes,
+						*phases;
+	long long			*positions,
+						samplesPushed,
+						droppedFrames;
+	
+	int					fftSize,
+						fftBins,
+						hopSize,
+						queueSize,
+						writePos,
+						sinceLastFrame,
+						head,
+						numQueued;
+};
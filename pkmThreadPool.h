@@ -0,0 +1,313 @@
+/*
+ *  pkmThreadPool.h
+ *
+ *  Persistent worker threads with a work-stealing parallel for
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  parallelFor splits [0, count) into one contiguous range per worker.
+ *  Each worker takes grain-sized chunks off the front of its own range and,
+ *  once that is empty, steals the back half of another worker's range, so
+ *  uneven chunks balance out without a shared queue.  Ranges are packed
+ *  (begin, end) pairs in one atomic word; taking and stealing are single
+ *  compare-and-swaps.
+ *
+ *  The calling thread works as worker 0.  Calls from inside a job, or from
+ *  a second thread while the pool is busy, run serially on the caller.
+ *
+ *  Usage:
+ *
+ *  pkmThreadPool &pool = pkmThreadPool::shared();
+ *  pool.parallelFor(numFrames, 16, [&](int begin, int end, int worker) {
+ *      for (int i = begin; i < end; i++)
+ *          process(i, scratch[worker]);
+ *  });
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+class pkmThreadPool
+{
+public:
+	
+	// numThreads includes the calling thread; 0 uses every hardware thread
+	pkmThreadPool(int numThreads = 0)
+	{
+		if (numThreads <= 0)
+			numThreads = (int) std::thread::hardware_concurrency();
+		if (numThreads <= 0)
+			numThreads = 1;
+		
+		numWorkers = numThreads;
+		ranges = new Range[numWorkers];
+		generation = 0;
+		finished = 0;
+		participants = 0;
+		jobGrain = 1;
+		job = NULL;
+		jobInvoke = NULL;
+		bQuit = false;
+		for (int i = 1; i < numWorkers; i++)
+			threads.push_back(std::thread(&pkmThreadPool::workerLoop, this, i));
+	}
+	~pkmThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			bQuit = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+		delete [] ranges;
+	}
+	
+	// process-wide pool with one worker per hardware thread
+	static pkmThreadPool & shared()
+	{
+		static pkmThreadPool pool;
+		return pool;
+	}
+	
+	int size() const
+	{
+		return numWorkers;
+	}
+	
+	// fn(begin, end, worker) over [0, count) in chunks of at most grain,
+	// using at most maxWorkers workers (0 for all); worker < size().  fn is
+	// called through a pointer rather than copied, so nothing is allocated
+	template <typename F>
+	void parallelFor(int count, int grain, const F &fn, int maxWorkers = 0)
+	{
+		if (count <= 0)
+			return;
+		if (grain < 1)
+			grain = 1;
+		if (maxWorkers <= 0 || maxWorkers > numWorkers)
+			maxWorkers = numWorkers;
+		if (maxWorkers > (count + grain - 1) / grain)
+			maxWorkers = (count + grain - 1) / grain;
+		
+		std::unique_lock<std::mutex> busy(jobMutex, std::try_to_lock);
+		if (maxWorkers <= 1 || currentPool() == this || !busy.owns_lock()) {
+			fn(0, count, 0);
+			return;
+		}
+		
+		for (int i = 0; i < numWorkers; i++) {
+			uint32_t begin = i < maxWorkers ? (uint32_t) ((int64_t) count * i / maxWorkers) : 0;
+			uint32_t end = i < maxWorkers ? (uint32_t) ((int64_t) count * (i + 1) / maxWorkers) : 0;
+			ranges[i].value.store(pack(begin, end));
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = &fn;
+			jobInvoke = &invoke<F>;
+			jobGrain = grain;
+			participants = maxWorkers;
+			finished = 0;
+			generation++;
+		}
+		wake.notify_all();
+		
+		run(0);
+		
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return finished == participants - 1; });
+		job = NULL;
+	}
+	
+private:
+	
+	struct Range
+	{
+		std::atomic<uint64_t> value;
+		char			padding[64 - sizeof(std::atomic<uint64_t>)];	// one cache line each
+	};
+	
+	template <typename F>
+	static void invoke(const void *fn, int begin, int end, int worker)
+	{
+		(*(const F *) fn)(begin, end, worker);
+	}
+	
+	static uint64_t pack(uint32_t begin, uint32_t end)
+	{
+		return ((uint64_t) begin << 32) | end;
+	}
+	
+	static const pkmThreadPool *& currentPool()
+	{
+		static thread_local const pkmThreadPool *pool = NULL;
+		return pool;
+	}
+	
+	// takes the next chunk of worker's own range
+	bool take(int worker, uint32_t &begin, uint32_t &end)
+	{
+		std::atomic<uint64_t> &range = ranges[worker].value;
+		uint64_t r = range.load();
+		for (;;) {
+			uint32_t b = (uint32_t) (r >> 32), e = (uint32_t) r;
+			if (b >= e)
+				return false;
+			uint32_t nb = e - b > (uint32_t) jobGrain ? b + jobGrain : e;
+			if (range.compare_exchange_weak(r, pack(nb, e))) {
+				begin = b;
+				end = nb;
+				return true;
+			}
+		}
+	}
+	
+	// moves the back half of some other worker's range into worker's own
+	bool steal(int worker)
+	{
+		for (int k = 1; k < participants; k++) {
+			std::atomic<uint64_t> &victim = ranges[(worker + k) % participants].value;
+			uint64_t r = victim.load();
+			for (;;) {
+				uint32_t b = (uint32_t) (r >> 32), e = (uint32_t) r;
+				if (b >= e)
+					break;
+				uint32_t remaining = e - b;
+				uint32_t mid = remaining > (uint32_t) jobGrain ? e - remaining / 2 : b;
+				if (victim.compare_exchange_weak(r, pack(b, mid))) {
+					ranges[worker].value.store(pack(mid, e));
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+	
+	void run(int worker)
+	{
+		const pkmThreadPool *previous = currentPool();
+		currentPool() = this;
+		uint32_t begin, end;
+		do {
+			while (take(worker, begin, end))
+				jobInvoke(job, (int) begin, (int) end, worker);
+		} while (steal(worker));
+		currentPool() = previous;
+	}
+	
+	void workerLoop(int worker)
+	{
+		unsigned long seen = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return bQuit || generation != seen; });
+				if (bQuit)
+					return;
+				seen = generation;
+				if (worker >= participants)
+					continue;
+			}
+			run(worker);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				finished++;
+			}
+			done.notify_one();
+		}
+	}
+	
+	int					numWorkers,
+						participants,
+						finished,
+						jobGrain;
+	Range				*ranges;
+	const void			*job;
+	void				(*jobInvoke)(const void *, int, int, int);
+	unsigned long		generation;
+	bool				bQuit;
+	
+	std::vector<std::thread> threads;
+	std::mutex			mutex,
+						jobMutex;
+	std::condition_variable wake,
+						done;
+};
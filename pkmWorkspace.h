@@ -0,0 +1,174 @@
+/*
+ *  pkmWorkspace.h
+ *
+ *  Growable scratch arena for buffers reused across calls
+ *
+ *  Created by Parag K. Mital - http://pkmital.com 
+ *  Contact: parag@pkmital.com
+ *
+ 
+ Copyright (C) 2011 Parag K. Mital
+ 
+ The Software is and remains the property of Parag K Mital
+ ("pkmital") The Licensee will ensure that the Copyright Notice set
+ out above appears prominently wherever the Software is used.
+ 
+ The Software is distributed under this Licence: 
+ 
+ - on a non-exclusive basis, 
+ 
+ - solely for non-commercial use in the hope that it will be useful, 
+ 
+ - "AS-IS" and in order for the benefit of its educational and research
+ purposes, pkmital makes clear that no condition is made or to be
+ implied, nor is any representation or warranty given or to be
+ implied, as to (i) the quality, accuracy or reliability of the
+ Software; (ii) the suitability of the Software for any particular
+ use or for use under any specific conditions; and (iii) whether use
+ of the Software will infringe third-party rights.
+ 
+ pkmital disclaims: 
+ 
+ - all responsibility for the use which is made of the Software; and
+ 
+ - any liability for the outcomes arising from using the Software.
+ 
+ The Licensee may make public, results or data obtained from, dependent
+ on or arising out of the use of the Software provided that any such
+ publication includes a prominent statement identifying the Software as
+ the source of the results or the data, including the Copyright Notice
+ and stating that the Software has been made available for use by the
+ Licensee under licence from pkmital and the Licensee provides a copy of
+ any such publication to pkmital.
+ 
+ The Licensee agrees to indemnify pkmital and hold them
+ harmless from and against any and all claims, damages and liabilities
+ asserted by third parties (including claims for negligence) which
+ arise directly or indirectly from the use of the Software or any
+ derivative of it or the sale of any products based on the
+ Software. The Licensee undertakes to make no liability claim against
+ any employee, student, agent or appointee of pkmital, in connection 
+ with this Licence or the Software.
+ 
+ 
+ No part of the Software may be reproduced, modified, transmitted or
+ transferred in any form or by any means, electronic or mechanical,
+ without the express permission of pkmital. pkmital's permission is not
+ required if the said reproduction, modification, transmission or
+ transference is done without financial return, the conditions of this
+ Licence are imposed upon the receiver of the product, and all original
+ and amended source code is included in any transmitted product. You
+ may be held legally responsible for any copyright infringement that is
+ caused or encouraged by your failure to abide by these terms and
+ conditions.
+ 
+ You are not permitted under this Licence to use this Software
+ commercially. Use for which any financial return is received shall be
+ defined as commercial use, and includes (1) integration of all or part
+ of the source code or the Software into a product for sale or license
+ by or on behalf of Licensee to third parties or (2) use of the
+ Software or any derivative of it for research with the final aim of
+ developing software products for sale or license to a third party or
+ (3) use of the Software or any derivative of it for research with the
+ final aim of developing non-software products for sale or license to a
+ third party, or (4) use of the Software to provide any service to an
+ external organisation for which payment is received. If you are
+ interested in using the Software commercially, please contact pkmital to
+ negotiate a licence. Contact details are: parag@pkmital.com
+ 
+ *
+ *  A pkmWorkspace owns one block of memory.  reserve() makes room for the
+ *  next call's buffers, allocating only when it needs more than it already
+ *  holds, and get() carves 64 byte aligned buffers out of it.  Once the
+ *  workspace has grown to the largest call, calls stop allocating;
+ *  getAllocations() counts every time it had to grow.
+ *
+ *  Usage:
+ *
+ *  pkmWorkspace workspace;
+ *  workspace.reserve(pkmWorkspace::bytes<float>(n) + pkmWorkspace::bytes<float>(m));
+ *  float *a = workspace.get<float>(n);
+ *  float *b = workspace.get<float>(m);
+ *
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+class pkmWorkspace
+{
+public:
+	
+	pkmWorkspace()
+	{
+		block = NULL;
+		capacity = 0;
+		used = 0;
+		allocations = 0;
+	}
+	~pkmWorkspace()
+	{
+		free(block);
+	}
+	
+	// room a get<T>(n) takes, alignment included
+	template <typename T>
+	static size_t bytes(size_t n)
+	{
+		return (n * sizeof(T) + alignment - 1) & ~(size_t)(alignment - 1);
+	}
+	
+	// starts over with room for at least size bytes; buffers from earlier
+	// get() calls are invalid afterwards
+	bool reserve(size_t size)
+	{
+		used = 0;
+		if (size <= capacity)
+			return true;
+		free(block);
+		block = (char *) malloc(size + alignment);
+		allocations++;
+		if (block == NULL) {
+			printf("\npkmWorkspace failed to allocate %lu bytes.\n", (unsigned long) size);
+			capacity = 0;
+			return false;
+		}
+		capacity = size;
+		return true;
+	}
+	
+	// NULL when the last reserve() did not make room for it
+	template <typename T>
+	T * get(size_t n)
+	{
+		size_t size = bytes<T>(n);
+		if (used + size > capacity)
+			return NULL;
+		char *aligned = block + ((alignment - (uintptr_t) block % alignment) % alignment);
+		T *buffer = (T *) (aligned + used);
+		used += size;
+		return buffer;
+	}
+	
+	size_t getCapacity() const
+	{
+		return capacity;
+	}
+	
+	// times the workspace has had to grow
+	long getAllocations() const
+	{
+		return allocations;
+	}
+	
+private:
+	
+	static const size_t	alignment = 64;
+	
+	char				*block;
+	size_t				capacity,
+						used;
+	long				allocations;
+};